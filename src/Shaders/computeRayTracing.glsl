@@ -8,154 +8,84 @@ uniform mat3 cameraRotation;
 uniform int  MAX_TRACE_BOUNCES;
 uniform int  MAX_TRACE_PER_PIXEL;
 uniform float fov;
-uniform int numSpheres;
+uniform int frameIndex;                 // Frames accumulated into screenTex since the last reset
+uniform int persistentThreads;          // 1: a fixed number of groups pull tiles from nextWorkItem until none are left
 
-struct Sphere {
-    vec4  positionRadius;           // position (xyz) + radius (w)
-    vec4  baseColor;                // baseColor (xyz) + padding (w)
-    vec4  emissionColorStrength;    // emissionColor (xyz) + emissionStrength (w)
+// Work items are pixels in 16x16 tile order; reset to 0 before every persistent dispatch
+layout (std430, binding = 12) buffer WorkCounterBuffer {
+    uint nextWorkItem;
 };
 
-layout (std430, binding = 0) readonly buffer SphereBuffer {
-    Sphere spheres[];
-};
-
-float FOV = tan(radians(fov) * 0.5);
-
-struct Ray {
-    vec3 origin;
-    vec3 direction;
-};
-
-struct SurfaceMaterial
-{
-	vec3  baseColor;
-    vec3  emissionColor;
-    float emissionStrength;
-};
+#include "rayTracingCommon.glsl"
+#include "restirCommon.glsl"
 
-struct HitResult {
-    bool  hit;
-    float dist;
-    vec3  position;
-    vec3  normal;
-    SurfaceMaterial material;
+// How the paths of every 4th pixel in x and y ended, at PathEndBin(); zeroed before the
+// dispatch. The wavefront pipeline copies its own counts here.
+layout (std430, binding = 20) buffer PathEndBuffer {
+    uint pathEnds[PATH_END_REASONS * PATH_DEPTH_BINS];
 };
 
+float FOV = tan(radians(fov) * 0.5);
 
-
-float randomValueInt(inout uint state) 
-{
-    state = state * 747796405 + 2891336453;
-    uint result = ((state >> ((state >> 28u) + 4)) ^ state) * 277803737;
-    result = (result >> 22) ^ result;
-    return result / 4294967296.0;
-}
-
-float randomValueNormalDist(inout uint state) 
-{
-    float theta = 2 * 3.1415926 * randomValueInt(state);
-    float rho = sqrt(-2 * log(randomValueInt(state)));
-    return rho * cos(theta); 
-}
-
-vec3 randomValueVec3(inout uint state) 
-{
-    float x = randomValueNormalDist(state);
-    float y = randomValueNormalDist(state);
-    float z = randomValueNormalDist(state);
-    return normalize(vec3(x, y, z));
-}
-
-vec3 randomValueVec3Hemisphere(inout uint state, vec3 normal) 
-{
-    vec3 randomDir = randomValueVec3(state);
-    return randomDir * sign(dot(randomDir, normal));
-}
-
-HitResult RaySphereIntersection(Ray ray, vec3 sphereCenter, float sphereRadius) 
-{
-    HitResult hitResult;
-    hitResult.hit = false;
-    
-    vec3 offsetRayOrigin = ray.origin - sphereCenter;
-
-    float a = dot(ray.direction, ray.direction);
-    float b = 2.0 * dot(offsetRayOrigin, ray.direction);
-    float c = dot(offsetRayOrigin, offsetRayOrigin) - sphereRadius * sphereRadius;
-
-    float discriminant = b * b - 4.0 * a * c;
-
-    if(discriminant >= 0) 
-    {
-        float dist = (-b - sqrt(discriminant)) / (2.0 * a);
-
-        if(dist > 0) 
-        {
-            hitResult.hit = true;
-            hitResult.dist = dist;
-            hitResult.position = ray.origin + ray.direction * dist;
-            hitResult.normal = normalize(hitResult.position - sphereCenter);
-        }
-    }
-    
-    return hitResult;
-}
-
-HitResult CalculateRayCollision(Ray ray)
+void CountPathEnd(SampleIndex index, int reason, int bounce)
 {
-    // Find closest sphere hit
-    HitResult hitResult;
-    hitResult.hit = false;
-    hitResult.dist = 1e10;
-    hitResult.position = vec3(0.0);
-    hitResult.normal = vec3(0.0);
-    hitResult.material.baseColor = vec3(0.0);
-    hitResult.material.emissionColor = vec3(0.0);
-    hitResult.material.emissionStrength = 0.0;
-
-    for (int i = 0; i < numSpheres; ++i) {
-        vec3 spherePos = spheres[i].positionRadius.xyz;
-        float sphereRadius = spheres[i].positionRadius.w;
-        
-        HitResult hit = RaySphereIntersection(ray, spherePos, sphereRadius);
-        if (hit.hit && hit.dist < hitResult.dist && hit.dist > 0.001) {  // Avoid self-intersection
-            hitResult = hit;
-            hitResult.material.baseColor = spheres[i].baseColor.xyz;
-            hitResult.material.emissionColor = spheres[i].emissionColorStrength.xyz;
-            hitResult.material.emissionStrength = spheres[i].emissionColorStrength.w;
-        }
-    }
-
-    return hitResult;
+    if ((index.pixel % index.width) % 4u == 0u && (index.pixel / index.width) % 4u == 0u)
+        atomicAdd(pathEnds[PathEndBin(reason, bounce)], 1u);
 }
 
-vec3 Trace(Ray ray, inout uint state) 
+vec3 Trace(Ray ray, SampleIndex index, inout uint state) 
 {
     vec3 incomingLight = vec3(0.0);
     vec3 rayColor = vec3(1.0);
+    float bsdfPdf = 0.0;                // pdf of ray.direction, 0 for the camera ray
+    vec3 normal = vec3(0.0);            // of the surface ray.origin lies on
 
     for(int i = 0; i < MAX_TRACE_BOUNCES; i++)
     {
         HitResult hitResult = CalculateRayCollision(ray);
         if(hitResult.hit) 
         {
-            ray.origin = hitResult.position + hitResult.normal * 0.01;  // Offset to avoid self-intersection
-            ray.direction = randomValueVec3Hemisphere(state, hitResult.normal);
-
             SurfaceMaterial material = hitResult.material;
             vec3 emittedLight = material.emissionColor * material.emissionStrength;
-            incomingLight += emittedLight * rayColor;
+            // With ReSTIR the camera ray hit's light sample stands for all of its direct light from
+            // the spheres; emissive meshes are never sampled and count fully
+            float emissionWeight = restir != 0 && i == 1 && hitResult.sphere >= 0 ? 0.0 : EmissionWeight(bsdfPdf, ray.origin, normal, hitResult.sphere);
+            incomingLight += emittedLight * rayColor * emissionWeight;
             rayColor *= material.baseColor;
-            
-            // Russian roulette: stop tracing if ray color becomes too dark
-            float maxComponent = max(max(rayColor.r, rayColor.g), rayColor.b);
-            if (maxComponent < 0.1) break;
+
+            bool survives = i + 1 < MAX_TRACE_BOUNCES && SurvivesRoulette(index, i, rayColor, state);
+            if (!survives) {
+                CountPathEnd(index, i + 1 < MAX_TRACE_BOUNCES ? PATH_ROULETTE : PATH_BOUNCE_LIMIT, i);
+                break;
+            }
+
+            // Light sampling stands in for the next bounce hitting the light, so only paths
+            // that get a next bounce do it
+            vec3 origin = hitResult.position + hitResult.normal * 0.01;  // Offset to avoid self-intersection
+            if (nextEventEstimation != 0 && numLights > 0) {
+                LightSample lightSample;
+                bool sampled;
+                if (restir != 0 && i == 0) {
+                    sampled = RestirLightSample(reservoirs[index.pixel], lightSample);
+                } else {
+                    vec2 u = SampleSquare(index, LIGHT_SAMPLE_DIMENSION + i, state);
+                    vec2 uPick = SampleSquare(index, LIGHT_PICK_DIMENSION + i, state);
+                    sampled = SampleLight(origin, hitResult.normal, u, uPick, lightSample);
+                }
+                if (sampled && !Occluded(lightSample.shadowRay, lightSample.maxDist))
+                    incomingLight += rayColor * lightSample.radianceScale;
+            }
+
+            ray.origin = origin;
+            ray.direction = SampleCosineHemisphere(hitResult.normal, SampleSquare(index, i, state));
+            bsdfPdf = dot(hitResult.normal, ray.direction) / PI;
+            normal = hitResult.normal;
         }
         else 
         {
             // Add background color when ray doesn't hit anything
             incomingLight += vec3(0.1) * rayColor;  // Ambient light
+            CountPathEnd(index, PATH_ESCAPED, i);
             break;
         }
     }
@@ -164,13 +94,13 @@ vec3 Trace(Ray ray, inout uint state)
 }
 
 
-void main()
+void RenderPixel(ivec2 pixelCoords)
 {
-    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);    // Pixel index 0 to 1920 for fHD
     vec2  uvCoords = (pixelCoords / resolution) * 2.0 - 1.0; // Screen coordinates from -1 to 1
     
-    // Better seed for random number generator per pixel
+    // Better seed for random number generator per pixel, decorrelated across accumulated frames
     uint rngState = uint(pixelCoords.x * 73856093 ^ pixelCoords.y * 19349663);
+    rngState ^= uint(frameIndex) * 2654435761u;
 
     float aspectRation = resolution.x / resolution.y;       // Aspect ration correction for non-square screens
     uvCoords.x *= aspectRation;                             // Correct the UV coordinates for the aspect ratio (prevents stretching)
@@ -179,13 +109,64 @@ void main()
     ray.origin = cameraPosition;
     ray.direction = normalize(cameraRotation * vec3(uvCoords * FOV, 1.0)); 
 
+    SampleIndex index;
+    index.pixel = uint(pixelCoords.y * int(resolution.x) + pixelCoords.x);
+    index.width = uint(resolution.x);
+    index.frame = uint(frameIndex);
+    index.sampleCount = uint(MAX_TRACE_PER_PIXEL);
+
     vec3 totalIncomingLight = vec3(0.0);
 
     for(int rayIndex = 0; rayIndex < MAX_TRACE_PER_PIXEL; rayIndex++) {
-        totalIncomingLight += Trace(ray, rngState);
+        index.rayIndex = uint(rayIndex);
+        totalIncomingLight += Trace(ray, index, rngState);
     }
 
     vec3 pixelColor = totalIncomingLight / float(MAX_TRACE_PER_PIXEL); // Average the color from multiple rays per pixel
 
+    // Running average with the frames accumulated so far
+    if (frameIndex > 0) {
+        vec3 accumulated = imageLoad(screenTex, pixelCoords).rgb;
+        pixelColor = accumulated + (pixelColor - accumulated) / float(frameIndex + 1);
+    }
+
     imageStore(screenTex, pixelCoords, vec4(pixelColor, 1.0));
-}
\ No newline at end of file
+}
+
+shared uint batchStart;                 // First work item of the group's current tile
+
+ivec2 WorkItemPixel(uint item)
+{
+    uint tilesX = (uint(resolution.x) + 15u) / 16u;
+    uint tile = item / 256u;
+    uint inTile = item % 256u;
+    return ivec2((tile % tilesX) * 16u + inTile % 16u, (tile / tilesX) * 16u + inTile / 16u);
+}
+
+void main()
+{
+    if (persistentThreads == 0) {
+        // The grid is rounded up to whole groups; invocations past the edge have no pixel,
+        // reservoir or path-end sample of their own
+        ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);    // Pixel index 0 to 1920 for fHD
+        if (pixelCoords.x >= int(resolution.x) || pixelCoords.y >= int(resolution.y)) return;
+        RenderPixel(pixelCoords);
+        return;
+    }
+
+    // Groups that drew cheap tiles (background, short paths) go on to the next one instead
+    // of retiring, so the frame ends when the work runs out, not with a tail of launch-order
+    // tiles. The tile is fetched once per group, which keeps the loop uniform.
+    uint tilesX = (uint(resolution.x) + 15u) / 16u;
+    uint tilesY = (uint(resolution.y) + 15u) / 16u;
+    uint workItems = tilesX * tilesY * 256u;
+    while (true) {
+        if (gl_LocalInvocationIndex == 0u) batchStart = atomicAdd(nextWorkItem, 256u);
+        barrier();
+        uint first = batchStart;
+        barrier();
+        if (first >= workItems) break;
+        ivec2 pixelCoords = WorkItemPixel(first + gl_LocalInvocationIndex);
+        if (pixelCoords.x < int(resolution.x) && pixelCoords.y < int(resolution.y)) RenderPixel(pixelCoords);
+    }
+}
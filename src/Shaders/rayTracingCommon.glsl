@@ -0,0 +1,588 @@
+// Scene buffers, intersection and BVH traversal shared by the megakernel
+// (computeRayTracing.glsl) and the wavefront passes (wavefront*.glsl).
+// Included by each compute shader after its #version, layout and own uniforms.
+
+uniform int numSphereNodes;             // 0 when there are no spheres
+uniform int numTlasNodes;               // 0 when no mesh is loaded
+uniform vec3 meshBaseColor;            // tints the base color of every mesh material
+uniform int numLights;                  // entries of lights[]
+uniform int nextEventEstimation;        // 1: connect every bounce to a sampled light, MIS-weighted with the bounce direction
+uniform int lightSampler;               // light selection: 0 uniform, 1 by power (alias table), 2 light BVH (LightSampler on the CPU)
+uniform int rouletteMinDepth;           // bounces every path gets before Russian roulette may end it
+
+struct Sphere {
+    vec4  positionRadius;           // position (xyz) + radius (w)
+    vec4  baseColor;                // baseColor (xyz) + padding (w)
+    vec4  emissionColorStrength;    // emissionColor (xyz) + emissionStrength (w)
+};
+
+layout (std430, binding = 0) readonly buffer SphereBuffer {
+    Sphere spheres[];
+};
+
+struct Triangle {
+    vec4  v0;                       // vertex 0 (xyz) + padding (w)
+    vec4  v1;                       // vertex 1 (xyz) + padding (w)
+    vec4  v2;                       // vertex 2 (xyz) + padding (w)
+};
+
+// Interior nodes: left child = leftFirst, right child = leftFirst + 1
+// Leaves (primCount > 0): triangles[leftFirst .. leftFirst + primCount)
+struct BvhNode {
+    vec3  boundsMin;
+    uint  leftFirst;
+    vec3  boundsMax;
+    uint  primCount;
+};
+
+layout (std430, binding = 1) readonly buffer TriangleBuffer {
+    Triangle triangles[];
+};
+
+// Every BLAS back to back; leaves index triangles[] directly
+layout (std430, binding = 2) readonly buffer BlasNodeBuffer {
+    BvhNode blasNodes[];
+};
+
+// Sphere leaves index spheres[] through sphereIndices[]
+layout (std430, binding = 3) readonly buffer SphereBvhBuffer {
+    BvhNode sphereNodes[];
+};
+
+layout (std430, binding = 4) readonly buffer SphereIndexBuffer {
+    uint sphereIndices[];
+};
+
+struct TlasInstance {
+    mat4  worldToObject;
+    uint  blasRoot;                 // root node in blasNodes[]
+    uint  padding0, padding1, padding2;
+    vec4  baseColor;                // material of the instanced primitive: baseColor (xyz) + padding (w)
+    vec4  emissionColorStrength;    // emissionColor (xyz) + emissionStrength (w)
+};
+
+// Top level over mesh instances; leaves index tlasInstances[] directly
+layout (std430, binding = 5) readonly buffer TlasNodeBuffer {
+    BvhNode tlasNodes[];
+};
+
+layout (std430, binding = 6) readonly buffer TlasInstanceBuffer {
+    TlasInstance tlasInstances[];
+};
+
+// Emissive spheres, see BuildLights
+struct Light {
+    uint  sphere;
+    uint  alias;                    // alias table: the light that fills the rest of this one's bin
+    float aliasThreshold;           // keep this light when the second pick number is below, else take alias
+    float pmf;                      // power / total power
+    uint  bvhTrail;                 // path from the light BVH root to its leaf, bit k set: right child at depth k
+};
+
+layout (std430, binding = 13) readonly buffer LightBuffer {
+    Light lights[];
+};
+
+// lights[] index per sphere, -1 if it does not emit
+layout (std430, binding = 15) readonly buffer SphereLightBuffer {
+    int sphereLights[];
+};
+
+struct LightBvhNode {
+    vec3  boundsMin;
+    float power;                    // sum over the lights below
+    vec3  boundsMax;
+    uint  child;                    // left child (the right one follows it), or LIGHT_BVH_LEAF | light
+};
+
+layout (std430, binding = 16) readonly buffer LightBvhBuffer {
+    LightBvhNode lightBvhNodes[];
+};
+
+const uint LIGHT_BVH_LEAF = 0x80000000u;
+
+// BVH_MAX_DEPTH + 1 of bvh.h: the builders keep every tree shallow enough for both
+// pushes to fit. The pushes still check, a full stack drops the far child instead of
+// writing past the array.
+const int   BVH_STACK_SIZE = 64;
+const float BVH_MISS = 1e30;
+
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+};
+
+struct SurfaceMaterial
+{
+	vec3  baseColor;
+    vec3  emissionColor;
+    float emissionStrength;
+};
+
+struct HitResult {
+    bool  hit;
+    float dist;
+    vec3  position;
+    vec3  normal;
+    int   sphere;                   // spheres[] index of a sphere hit, -1 otherwise
+    SurfaceMaterial material;
+};
+
+#include "sampling.glsl"
+
+HitResult RaySphereIntersection(Ray ray, vec3 sphereCenter, float sphereRadius) 
+{
+    HitResult hitResult;
+    hitResult.hit = false;
+    
+    vec3 offsetRayOrigin = ray.origin - sphereCenter;
+
+    float a = dot(ray.direction, ray.direction);
+    float b = 2.0 * dot(offsetRayOrigin, ray.direction);
+    float c = dot(offsetRayOrigin, offsetRayOrigin) - sphereRadius * sphereRadius;
+
+    float discriminant = b * b - 4.0 * a * c;
+
+    if(discriminant >= 0) 
+    {
+        float dist = (-b - sqrt(discriminant)) / (2.0 * a);
+
+        if(dist > 0) 
+        {
+            hitResult.hit = true;
+            hitResult.dist = dist;
+            hitResult.position = ray.origin + ray.direction * dist;
+            hitResult.normal = normalize(hitResult.position - sphereCenter);
+        }
+    }
+    
+    return hitResult;
+}
+
+// Moller-Trumbore, two-sided so meshes work regardless of winding
+HitResult RayTriangleIntersection(Ray ray, vec3 v0, vec3 v1, vec3 v2)
+{
+    HitResult hitResult;
+    hitResult.hit = false;
+
+    vec3 edge1 = v1 - v0;
+    vec3 edge2 = v2 - v0;
+    vec3 pvec = cross(ray.direction, edge2);
+    float det = dot(edge1, pvec);
+    if (abs(det) < 1e-8) return hitResult;
+
+    float invDet = 1.0 / det;
+    vec3 tvec = ray.origin - v0;
+    float u = dot(tvec, pvec) * invDet;
+    if (u < 0.0 || u > 1.0) return hitResult;
+
+    vec3 qvec = cross(tvec, edge1);
+    float v = dot(ray.direction, qvec) * invDet;
+    if (v < 0.0 || u + v > 1.0) return hitResult;
+
+    float dist = dot(edge2, qvec) * invDet;
+    if (dist > 0)
+    {
+        vec3 normal = normalize(cross(edge1, edge2));
+        hitResult.hit = true;
+        hitResult.dist = dist;
+        hitResult.position = ray.origin + ray.direction * dist;
+        hitResult.normal = dot(normal, ray.direction) > 0.0 ? -normal : normal;
+    }
+
+    return hitResult;
+}
+
+// Slab test; returns the entry distance or BVH_MISS when the box is missed or farther than maxDist
+float RayAabbDistance(Ray ray, vec3 invDir, BvhNode node, float maxDist)
+{
+    vec3 t0 = (node.boundsMin - ray.origin) * invDir;
+    vec3 t1 = (node.boundsMax - ray.origin) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar  = max(t0, t1);
+    float entry = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float exit  = min(min(tFar.x, tFar.y), min(tFar.z, maxDist));
+    return entry <= exit ? entry : BVH_MISS;
+}
+
+void TraverseSphereBvh(Ray ray, inout HitResult hitResult)
+{
+    vec3 invDir = 1.0 / ray.direction;
+
+    // Stack-based traversal, nearer child first
+    uint stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    if (RayAabbDistance(ray, invDir, sphereNodes[0], hitResult.dist) < BVH_MISS) stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        BvhNode node = sphereNodes[stack[--stackSize]];
+
+        if (node.primCount > 0) {
+            for (uint k = node.leftFirst; k < node.leftFirst + node.primCount; ++k) {
+                uint i = sphereIndices[k];
+                HitResult hit = RaySphereIntersection(ray, spheres[i].positionRadius.xyz, spheres[i].positionRadius.w);
+                if (hit.hit && hit.dist < hitResult.dist && hit.dist > 0.001) {  // Avoid self-intersection
+                    hitResult = hit;
+                    hitResult.sphere = int(i);
+                    hitResult.material.baseColor = spheres[i].baseColor.xyz;
+                    hitResult.material.emissionColor = spheres[i].emissionColorStrength.xyz;
+                    hitResult.material.emissionStrength = spheres[i].emissionColorStrength.w;
+                }
+            }
+            continue;
+        }
+
+        uint nearChild = node.leftFirst;
+        uint farChild  = node.leftFirst + 1;
+        float distNear = RayAabbDistance(ray, invDir, sphereNodes[nearChild], hitResult.dist);
+        float distFar  = RayAabbDistance(ray, invDir, sphereNodes[farChild], hitResult.dist);
+        if (distFar < distNear) {
+            float d = distNear; distNear = distFar; distFar = d;
+            uint c = nearChild; nearChild = farChild; farChild = c;
+        }
+        if (distFar  < BVH_MISS && stackSize < BVH_STACK_SIZE - 1) stack[stackSize++] = farChild;
+        if (distNear < BVH_MISS && stackSize < BVH_STACK_SIZE)     stack[stackSize++] = nearChild;
+    }
+}
+
+// ray is in the object space of the instance; hits stay in object space and get their
+// material from the instance in TraverseTlas
+void TraverseBlas(Ray ray, uint root, inout HitResult hitResult)
+{
+    vec3 invDir = 1.0 / ray.direction;
+
+    // Stack-based traversal, nearer child first
+    uint stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    if (RayAabbDistance(ray, invDir, blasNodes[root], hitResult.dist) < BVH_MISS) stack[stackSize++] = root;
+
+    while (stackSize > 0) {
+        BvhNode node = blasNodes[stack[--stackSize]];
+
+        if (node.primCount > 0) {
+            for (uint t = node.leftFirst; t < node.leftFirst + node.primCount; ++t) {
+                HitResult hit = RayTriangleIntersection(ray, triangles[t].v0.xyz, triangles[t].v1.xyz, triangles[t].v2.xyz);
+                if (hit.hit && hit.dist < hitResult.dist && hit.dist > 0.001) {
+                    hitResult = hit;
+                    hitResult.sphere = -1;
+                }
+            }
+            continue;
+        }
+
+        uint nearChild = node.leftFirst;
+        uint farChild  = node.leftFirst + 1;
+        float distNear = RayAabbDistance(ray, invDir, blasNodes[nearChild], hitResult.dist);
+        float distFar  = RayAabbDistance(ray, invDir, blasNodes[farChild], hitResult.dist);
+        if (distFar < distNear) {
+            float d = distNear; distNear = distFar; distFar = d;
+            uint c = nearChild; nearChild = farChild; farChild = c;
+        }
+        if (distFar  < BVH_MISS && stackSize < BVH_STACK_SIZE - 1) stack[stackSize++] = farChild;
+        if (distNear < BVH_MISS && stackSize < BVH_STACK_SIZE)     stack[stackSize++] = nearChild;
+    }
+}
+
+void TraverseTlas(Ray ray, inout HitResult hitResult)
+{
+    vec3 invDir = 1.0 / ray.direction;
+
+    // Stack-based traversal, nearer child first
+    uint stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    if (RayAabbDistance(ray, invDir, tlasNodes[0], hitResult.dist) < BVH_MISS) stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        BvhNode node = tlasNodes[stack[--stackSize]];
+
+        if (node.primCount > 0) {
+            for (uint k = node.leftFirst; k < node.leftFirst + node.primCount; ++k) {
+                mat4 worldToObject = tlasInstances[k].worldToObject;
+
+                // Unnormalized object-space ray, so hit distances stay comparable with world space
+                Ray objectRay;
+                objectRay.origin = (worldToObject * vec4(ray.origin, 1.0)).xyz;
+                objectRay.direction = (worldToObject * vec4(ray.direction, 0.0)).xyz;
+
+                float closestDist = hitResult.dist;
+                TraverseBlas(objectRay, tlasInstances[k].blasRoot, hitResult);
+
+                // Bring a hit in this instance back to world space
+                if (hitResult.dist < closestDist) {
+                    hitResult.position = ray.origin + ray.direction * hitResult.dist;
+                    hitResult.normal = normalize(transpose(mat3(worldToObject)) * hitResult.normal);
+                    hitResult.material.baseColor = meshBaseColor * tlasInstances[k].baseColor.xyz;
+                    hitResult.material.emissionColor = tlasInstances[k].emissionColorStrength.xyz;
+                    hitResult.material.emissionStrength = tlasInstances[k].emissionColorStrength.w;
+                }
+            }
+            continue;
+        }
+
+        uint nearChild = node.leftFirst;
+        uint farChild  = node.leftFirst + 1;
+        float distNear = RayAabbDistance(ray, invDir, tlasNodes[nearChild], hitResult.dist);
+        float distFar  = RayAabbDistance(ray, invDir, tlasNodes[farChild], hitResult.dist);
+        if (distFar < distNear) {
+            float d = distNear; distNear = distFar; distFar = d;
+            uint c = nearChild; nearChild = farChild; farChild = c;
+        }
+        if (distFar  < BVH_MISS && stackSize < BVH_STACK_SIZE - 1) stack[stackSize++] = farChild;
+        if (distNear < BVH_MISS && stackSize < BVH_STACK_SIZE)     stack[stackSize++] = nearChild;
+    }
+}
+
+// Closest hit nearer than maxDist
+HitResult CalculateRayCollision(Ray ray, float maxDist)
+{
+    // Find closest sphere or triangle hit
+    HitResult hitResult;
+    hitResult.hit = false;
+    hitResult.dist = maxDist;
+    hitResult.position = vec3(0.0);
+    hitResult.normal = vec3(0.0);
+    hitResult.sphere = -1;
+    hitResult.material.baseColor = vec3(0.0);
+    hitResult.material.emissionColor = vec3(0.0);
+    hitResult.material.emissionStrength = 0.0;
+
+    if (numSphereNodes > 0) TraverseSphereBvh(ray, hitResult);
+    if (numTlasNodes > 0)   TraverseTlas(ray, hitResult);
+
+    return hitResult;
+}
+
+HitResult CalculateRayCollision(Ray ray)
+{
+    return CalculateRayCollision(ray, 1e10);
+}
+
+// Shadow rays only need to know whether anything is in the way, but the closest-hit
+// traversal bounded by maxDist already skips everything behind the light
+bool Occluded(Ray ray, float maxDist)
+{
+    return CalculateRayCollision(ray, maxDist).hit;
+}
+
+// Next-event estimation: a light is picked by lightSampler, then a direction uniformly
+// inside the cone the sphere subtends, which is the visible cap.
+
+// 1 - cos of the half angle of the cone from origin around a sphere, without the
+// cancellation of the direct form for small or distant spheres; 0 from inside
+float SphereConeOneMinusCos(vec3 origin, vec4 positionRadius)
+{
+    vec3 toCenter = positionRadius.xyz - origin;
+    float distSquared = dot(toCenter, toCenter);
+    float radiusSquared = positionRadius.w * positionRadius.w;
+    if (distSquared <= radiusSquared) return 0.0;
+    float sinSquared = radiusSquared / distSquared;
+    return sinSquared / (1.0 + sqrt(1.0 - sinSquared));
+}
+
+// Power heuristic weight of a sample from the technique with pdf > 0, against one other
+// technique; in ratio form so extreme pdfs cannot overflow into NaN, and exactly 1 for otherPdf 0
+float PowerHeuristic(float pdf, float otherPdf)
+{
+    float ratio = otherPdf / pdf;
+    return 1.0 / (1.0 + ratio * ratio);
+}
+
+// Estimate of the light a light BVH node sends to a surface at origin: its power over the
+// squared distance, times the cosine at the surface towards the node's bounding sphere,
+// taken at the sphere's edge nearest the normal. Spheres emit in every direction, so
+// there is no emitter-side cone to bound.
+float LightBvhImportance(LightBvhNode node, vec3 origin, vec3 normal)
+{
+    vec3 halfExtent = 0.5 * (node.boundsMax - node.boundsMin);
+    vec3 toCenter = 0.5 * (node.boundsMin + node.boundsMax) - origin;
+    float radiusSquared = dot(halfExtent, halfExtent);
+    float distSquared = dot(toCenter, toCenter);
+    if (distSquared <= radiusSquared) return node.power / radiusSquared;    // origin inside the bounds
+
+    // cos(max(0, angle to center - bounding half angle)), without trigonometric functions
+    float cosCenter = dot(normal, toCenter) / sqrt(distSquared);
+    float sinBoundSquared = radiusSquared / distSquared;
+    float cosBound = sqrt(1.0 - sinBoundSquared);
+    float cosSurface = 1.0;
+    if (cosCenter < cosBound) {
+        float sinCenter = sqrt(max(0.0, 1.0 - cosCenter * cosCenter));
+        cosSurface = cosCenter * cosBound + sinCenter * sqrt(sinBoundSquared);
+    }
+    return cosSurface > 0.0 ? node.power * cosSurface / distSquared : 0.0;
+}
+
+// Chance that light selection goes to left rather than its sibling left + 1; -1 when neither can light origin
+float LightBvhLeftProbability(uint left, vec3 origin, vec3 normal)
+{
+    float importanceLeft = LightBvhImportance(lightBvhNodes[left], origin, normal);
+    float importanceRight = LightBvhImportance(lightBvhNodes[left + 1u], origin, normal);
+    float importance = importanceLeft + importanceRight;
+    return importance > 0.0 ? importanceLeft / importance : -1.0;
+}
+
+// Walks the light BVH by importance, rescaling u at every node; -1 when no light can be seen from origin
+int SampleLightBvh(vec3 origin, vec3 normal, float u, out float pmf)
+{
+    pmf = 1.0;
+    uint child = lightBvhNodes[0].child;
+    while ((child & LIGHT_BVH_LEAF) == 0u) {
+        float leftProbability = LightBvhLeftProbability(child, origin, normal);
+        if (leftProbability < 0.0) return -1;
+        if (u < leftProbability) {
+            u = min(u / leftProbability, 0.99999994);
+            pmf *= leftProbability;
+        } else {
+            u = min((u - leftProbability) / (1.0 - leftProbability), 0.99999994);
+            pmf *= 1.0 - leftProbability;
+            child += 1u;
+        }
+        child = lightBvhNodes[child].child;
+    }
+    return int(child & ~LIGHT_BVH_LEAF);
+}
+
+// The pmf SampleLightBvh() picks lights[light] with, by following its trail
+float LightBvhPmf(vec3 origin, vec3 normal, uint light)
+{
+    float pmf = 1.0;
+    uint child = lightBvhNodes[0].child;
+    uint trail = lights[light].bvhTrail;
+    while ((child & LIGHT_BVH_LEAF) == 0u) {
+        float leftProbability = LightBvhLeftProbability(child, origin, normal);
+        if (leftProbability < 0.0) return 0.0;
+        if ((trail & 1u) == 0u) {
+            pmf *= leftProbability;
+        } else {
+            pmf *= 1.0 - leftProbability;
+            child += 1u;
+        }
+        child = lightBvhNodes[child].child;
+        trail >>= 1;
+    }
+    return pmf;
+}
+
+// Chance that light selection at a surface at origin picks lights[light]
+float LightSelectionPmf(vec3 origin, vec3 normal, uint light)
+{
+    if (lightSampler == 1) return lights[light].pmf;
+    if (lightSampler == 2) return LightBvhPmf(origin, normal, light);
+    return 1.0 / float(numLights);
+}
+
+// Solid angle pdf of SampleLight() at a surface at origin producing the direction to spheres[sphere]
+float LightPdf(vec3 origin, vec3 normal, int sphere)
+{
+    if (nextEventEstimation == 0 || numLights == 0 || sphere < 0 || sphereLights[sphere] < 0) return 0.0;
+    float oneMinusCos = SphereConeOneMinusCos(origin, spheres[sphere].positionRadius);
+    if (oneMinusCos <= 0.0) return 0.0;
+    return LightSelectionPmf(origin, normal, uint(sphereLights[sphere])) / (2.0 * PI * oneMinusCos);
+}
+
+// MIS weight of emission found by a bounce direction drawn with bsdfPdf from the surface
+// at origin; camera rays pass 0 and count fully, the light sampling never sees them
+float EmissionWeight(float bsdfPdf, vec3 origin, vec3 normal, int sphere)
+{
+    return bsdfPdf > 0.0 ? PowerHeuristic(bsdfPdf, LightPdf(origin, normal, sphere)) : 1.0;
+}
+
+// A direction SampleLight() draws towards a light, before it is weighted
+struct LightPoint {
+    int   sphere;                   // spheres[] index of the light
+    vec3  direction;                // from origin
+    float dist;                     // to the sphere's surface along direction
+    float pdf;                      // solid angle pdf of direction, light selection included
+    float cosSurface;               // between direction and the surface normal, > 0
+};
+
+// Only call with nextEventEstimation on and numLights > 0. uPick chooses the light,
+// u the direction towards it. False when the sample cannot contribute: no light
+// above the surface, origin inside the light, or the light below the surface.
+bool SampleLightPoint(vec3 origin, vec3 normal, vec2 u, vec2 uPick, out LightPoint lightPoint)
+{
+    uint light;
+    float selectionPmf;
+    if (lightSampler == 1) {
+        light = min(uint(uPick.x * float(numLights)), uint(numLights - 1));
+        if (uPick.y >= lights[light].aliasThreshold) light = lights[light].alias;
+        selectionPmf = lights[light].pmf;
+    } else if (lightSampler == 2) {
+        int picked = SampleLightBvh(origin, normal, uPick.x, selectionPmf);
+        if (picked < 0) return false;
+        light = uint(picked);
+    } else {
+        light = min(uint(uPick.x * float(numLights)), uint(numLights - 1));
+        selectionPmf = 1.0 / float(numLights);
+    }
+
+    vec4 positionRadius = spheres[lights[light].sphere].positionRadius;
+    float oneMinusCos = SphereConeOneMinusCos(origin, positionRadius);
+    if (oneMinusCos <= 0.0) return false;
+
+    vec3 direction = SampleCone(normalize(positionRadius.xyz - origin), oneMinusCos, u);
+    float cosSurface = dot(normal, direction);
+    if (cosSurface <= 0.0) return false;
+
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    HitResult lightHit = RaySphereIntersection(ray, positionRadius.xyz, positionRadius.w);
+    if (!lightHit.hit) return false;            // grazed the rim
+
+    lightPoint.sphere = int(lights[light].sphere);
+    lightPoint.direction = direction;
+    lightPoint.dist = lightHit.dist;
+    lightPoint.pdf = selectionPmf / (2.0 * PI * oneMinusCos);
+    lightPoint.cosSurface = cosSurface;
+    return true;
+}
+
+struct LightSample {
+    Ray   shadowRay;
+    float maxDist;                  // just short of the light
+    vec3  radianceScale;            // emitted * cos / (PI * pdf) * MIS weight; times rayColor * baseColor is the light reaching the path
+};
+
+// SampleLightPoint() as a shadow ray and the light it brings, MIS-weighted against the bounce direction
+bool SampleLight(vec3 origin, vec3 normal, vec2 u, vec2 uPick, out LightSample lightSample)
+{
+    LightPoint lightPoint;
+    if (!SampleLightPoint(origin, normal, u, uPick, lightPoint)) return false;
+
+    lightSample.shadowRay.origin = origin;
+    lightSample.shadowRay.direction = lightPoint.direction;
+    lightSample.maxDist = lightPoint.dist * 0.999;
+
+    float bsdfPdf = lightPoint.cosSurface / PI;
+    vec4 emission = spheres[lightPoint.sphere].emissionColorStrength;
+    vec3 emittedLight = emission.xyz * emission.w;
+    lightSample.radianceScale = emittedLight * (bsdfPdf / lightPoint.pdf * PowerHeuristic(lightPoint.pdf, bsdfPdf));
+    return true;
+}
+
+// Why a path ended, and at which bounce: counts per reason and depth in a pathEnds[]
+// buffer, PathEndBin() indexes it. Depths from PATH_DEPTH_BINS - 1 on share the last bin.
+const int PATH_ESCAPED      = 0;        // missed the scene
+const int PATH_ROULETTE     = 1;        // Russian roulette, or no throughput left
+const int PATH_BOUNCE_LIMIT = 2;        // reached MAX_TRACE_BOUNCES
+const int PATH_END_REASONS  = 3;
+const int PATH_DEPTH_BINS   = 32;
+
+int PathEndBin(int reason, int bounce)
+{
+    return reason * PATH_DEPTH_BINS + min(bounce, PATH_DEPTH_BINS - 1);
+}
+
+// Russian roulette at a bounce that is not the last, after rayColor took the surface's
+// base color. From rouletteMinDepth on, the path goes on with its largest rayColor
+// component as probability and is divided by it, so the estimate stays unbiased; paths
+// without throughput end at any depth. False when the path ends here.
+bool SurvivesRoulette(SampleIndex index, int bounce, inout vec3 rayColor, inout uint state)
+{
+    float survival = min(max(max(rayColor.r, rayColor.g), rayColor.b), 1.0);
+    if (survival <= 0.0) return false;
+    if (bounce < rouletteMinDepth || survival >= 1.0) return true;
+    if (SampleSquare(index, ROULETTE_DIMENSION + bounce, state).x >= survival) return false;
+    rayColor /= survival;
+    return true;
+}
@@ -0,0 +1,111 @@
+#version 450 core
+layout (local_size_x = 16, local_size_y = 16) in;
+
+uniform vec2 resolution;
+uniform vec3 cameraPosition;
+uniform mat3 cameraRotation;
+uniform float fov;
+uniform int frameIndex;                 // Seeds the random numbers; must change every frame, also while the camera moves
+uniform int restirCandidates;           // light samples resampled per pixel
+uniform int restirHistory;              // 1: reservoirs[] holds last frame's, seen from the previous camera
+uniform vec3 previousCameraPosition;
+uniform mat3 previousCameraRotation;
+
+#include "rayTracingCommon.glsl"
+#include "restirCommon.glsl"
+
+// This frame's reservoirs after temporal reuse, for restirSpatial.glsl
+layout (std430, binding = 17) writeonly buffer TemporalReservoirBuffer {
+    Reservoir temporalReservoirs[];
+};
+
+float FOV = tan(radians(fov) * 0.5);
+
+// Pixel of the previous camera's image that position falls into, -1 if none
+int PreviousPixel(vec3 position)
+{
+    vec3 local = transpose(previousCameraRotation) * (position - previousCameraPosition);
+    if (local.z <= 0.0) return -1;
+    vec2 uvCoords = local.xy / (local.z * FOV);
+    uvCoords.x /= resolution.x / resolution.y;
+    ivec2 pixelCoords = ivec2(floor((uvCoords + 1.0) * 0.5 * resolution + 0.5));
+    if (any(lessThan(pixelCoords, ivec2(0))) || any(greaterThanEqual(pixelCoords, ivec2(resolution)))) return -1;
+    return pixelCoords.y * int(resolution.x) + pixelCoords.x;
+}
+
+// Per pixel: resample restirCandidates light samples of the camera ray hit by the
+// target function, keep the pick only if the light is visible, then merge with last
+// frame's reservoir of the same surface
+void main()
+{
+    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
+    if (pixelCoords.x >= int(resolution.x) || pixelCoords.y >= int(resolution.y)) return;
+    uint pixel = uint(pixelCoords.y * int(resolution.x) + pixelCoords.x);
+
+    // Same camera ray as the megakernel
+    vec2 uvCoords = (pixelCoords / resolution) * 2.0 - 1.0;
+    uvCoords.x *= resolution.x / resolution.y;
+    Ray ray;
+    ray.origin = cameraPosition;
+    ray.direction = normalize(cameraRotation * vec3(uvCoords * FOV, 1.0));
+
+    HitResult hitResult = CalculateRayCollision(ray);
+    if (!hitResult.hit) {
+        temporalReservoirs[pixel] = EmptyReservoir(vec3(0.0), vec3(0.0));
+        return;
+    }
+    vec3 normal = hitResult.normal;
+    vec3 origin = hitResult.position + normal * 0.01;  // Offset to avoid self-intersection, like Trace()
+    Reservoir reservoir = EmptyReservoir(origin, normal);
+
+    uint state = HashUint(pixel ^ HashUint(uint(frameIndex) ^ 0x5bd1e995u));
+    float weightSum = 0.0;
+    for (int candidate = 0; candidate < restirCandidates; candidate++) {
+        float ux = randomValueInt(state);
+        float uy = randomValueInt(state);
+        float pickX = randomValueInt(state);
+        float pickY = randomValueInt(state);
+        float choice = randomValueInt(state);
+        reservoir.M += 1.0;
+
+        LightPoint lightPoint;
+        if (!SampleLightPoint(origin, normal, vec2(ux, uy), vec2(pickX, pickY), lightPoint)) continue;
+        vec3 point = origin + lightPoint.direction * lightPoint.dist;
+        float areaPdf = lightPoint.pdf * LightAreaFactor(origin, lightPoint.sphere, point);
+        if (areaPdf <= 0.0) continue;
+
+        float weight = RestirTarget(origin, normal, lightPoint.sphere, point) / areaPdf;
+        weightSum += weight;
+        if (choice * weightSum < weight) {
+            reservoir.lightPoint = point;
+            reservoir.sphere = lightPoint.sphere;
+        }
+    }
+    RestirFinish(reservoir, weightSum, reservoir.M > 0.0 ? 1.0 / reservoir.M : 0.0);
+
+    // Visibility before reuse, so neighbours don't inherit occluded samples
+    LightSample lightSample;
+    if (RestirLightSample(reservoir, lightSample) && Occluded(lightSample.shadowRay, lightSample.maxDist)) reservoir.W = 0.0;
+
+    int previous = restirHistory != 0 ? PreviousPixel(origin) : -1;
+    if (previous >= 0) {
+        Reservoir history = reservoirs[previous];
+        if (RestirSimilar(history, origin, normal, distance(origin, cameraPosition))) {
+            history.M = min(history.M, RESTIR_HISTORY_LIMIT * float(restirCandidates));
+            float currentChoice = randomValueInt(state);
+            float historyChoice = randomValueInt(state);
+            Reservoir merged = EmptyReservoir(origin, normal);
+            float mergedWeightSum = 0.0;
+            RestirStream(merged, mergedWeightSum, reservoir, currentChoice);
+            bool fromHistory = RestirStream(merged, mergedWeightSum, history, historyChoice);
+            float currentTarget = RestirInputTarget(reservoir, merged);
+            float historyTarget = RestirInputTarget(history, merged);
+            float targetSum = currentTarget * reservoir.M + historyTarget * history.M;
+            float chosenTarget = fromHistory ? historyTarget : currentTarget;
+            RestirFinish(merged, mergedWeightSum, targetSum > 0.0 ? chosenTarget / targetSum : 0.0);
+            reservoir = merged;
+        }
+    }
+
+    temporalReservoirs[pixel] = reservoir;
+}
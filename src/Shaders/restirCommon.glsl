@@ -0,0 +1,118 @@
+// ReSTIR DI (Bitterli et al. 2020) for the light sample of the camera ray hit: every
+// pixel keeps a reservoir of one light sample standing for M candidates, which
+// restirCandidates.glsl fills by resampling and by reusing last frame's reservoir,
+// and restirSpatial.glsl by reusing the neighbours'. Mirrored in cpuTracer.cpp.
+// Included after rayTracingCommon.glsl.
+
+uniform int restir;                     // 1: the camera ray hit takes its light sample from reservoirs[pixel]
+
+const float RESTIR_HISTORY_LIMIT  = 20.0;  // last frame's M is capped at this many times restirCandidates
+const float RESTIR_SPATIAL_RADIUS = 30.0;  // pixels
+const int   RESTIR_MAX_SPATIAL_SAMPLES = 16;
+
+struct Reservoir {
+    vec3  lightPoint;               // the sample: a point on spheres[sphere]
+    int   sphere;                   // -1: no sample
+    vec3  origin;                   // shading point: the camera ray hit, offset along the normal
+    float W;                        // contribution weight of lightPoint, 0 when it is not seen
+    vec3  normal;                   // of the surface; 0 when the camera ray missed
+    float M;                        // candidates the reservoir stands for
+};
+
+// Reservoirs the tracers shade with; written by restirSpatial.glsl, read back by
+// restirCandidates.glsl as last frame's
+layout (std430, binding = 18) buffer RestirBuffer {
+    Reservoir reservoirs[];
+};
+
+Reservoir EmptyReservoir(vec3 origin, vec3 normal)
+{
+    Reservoir reservoir;
+    reservoir.lightPoint = vec3(0.0);
+    reservoir.sphere = -1;
+    reservoir.origin = origin;
+    reservoir.W = 0.0;
+    reservoir.normal = normal;
+    reservoir.M = 0.0;
+    return reservoir;
+}
+
+// cos at the light over the squared distance of lightPoint on spheres[sphere] seen from
+// origin: turns solid angle at origin into area on the light. 0 for the far side.
+float LightAreaFactor(vec3 origin, int sphere, vec3 lightPoint)
+{
+    vec3 toLight = lightPoint - origin;
+    float distSquared = dot(toLight, toLight);
+    float cosLight = -dot(normalize(lightPoint - spheres[sphere].positionRadius.xyz), toLight) / sqrt(distSquared);
+    return cosLight > 0.0 ? cosLight / distSquared : 0.0;
+}
+
+// Target function of the resampling: luminance of the unshadowed light from lightPoint
+// reaching the surface (origin, normal), per unit area of the light. The diffuse BRDF is
+// left out, it only scales a surface's targets.
+float RestirTarget(vec3 origin, vec3 normal, int sphere, vec3 lightPoint)
+{
+    if (sphere < 0) return 0.0;
+    float cosSurface = dot(normal, normalize(lightPoint - origin));
+    if (cosSurface <= 0.0) return 0.0;
+    vec4 emission = spheres[sphere].emissionColorStrength;
+    float luminance = 0.2126 * emission.r + 0.7152 * emission.g + 0.0722 * emission.b;
+    return luminance * emission.w * cosSurface * LightAreaFactor(origin, sphere, lightPoint);
+}
+
+// Whether candidates of r's surface can stand in for the surface (origin, normal) at the
+// given distance from the camera: similar normals and close to the same plane
+bool RestirSimilar(Reservoir r, vec3 origin, vec3 normal, float depth)
+{
+    return dot(r.normal, normal) > 0.9 && abs(dot(r.origin - origin, normal)) < 0.05 * depth;
+}
+
+// One step of resampling reservoirs into merged at merged's surface; u picks the sample.
+// True when r's sample was taken.
+bool RestirStream(inout Reservoir merged, inout float weightSum, Reservoir r, float u)
+{
+    float weight = RestirTarget(merged.origin, merged.normal, r.sphere, r.lightPoint) * r.W * r.M;
+    weightSum += weight;
+    merged.M += r.M;
+    if (u * weightSum < weight) {
+        merged.lightPoint = r.lightPoint;
+        merged.sphere = r.sphere;
+        return true;
+    }
+    return false;
+}
+
+// Target of merged's sample at the surface of an input r. The MIS weight of the sample is
+// this for the input it came from over the sum of this times M over all inputs (Bitterli
+// et al. 2020, Algorithm 6): a sample that was unlikely where it was drawn but bright here
+// stays rare instead of turning into a firefly.
+float RestirInputTarget(Reservoir r, Reservoir merged)
+{
+    return RestirTarget(r.origin, r.normal, merged.sphere, merged.lightPoint);
+}
+
+void RestirFinish(inout Reservoir merged, float weightSum, float misWeight)
+{
+    float target = RestirTarget(merged.origin, merged.normal, merged.sphere, merged.lightPoint);
+    merged.W = target > 0.0 ? weightSum * misWeight / target : 0.0;
+}
+
+// The reservoir's sample as a shadow ray and the light it brings, like SampleLight().
+// Not MIS-weighted: with ReSTIR on, the bounce direction leaving the camera ray hit
+// does not count the lights it finds.
+bool RestirLightSample(Reservoir r, out LightSample lightSample)
+{
+    if (r.sphere < 0 || r.W <= 0.0) return false;
+    vec3 toLight = r.lightPoint - r.origin;
+    float dist = length(toLight);
+    lightSample.shadowRay.origin = r.origin;
+    lightSample.shadowRay.direction = toLight / dist;
+    lightSample.maxDist = dist * 0.999;
+
+    float cosSurface = dot(r.normal, lightSample.shadowRay.direction);
+    float areaFactor = LightAreaFactor(r.origin, r.sphere, r.lightPoint);
+    if (cosSurface <= 0.0 || areaFactor <= 0.0) return false;
+    vec4 emission = spheres[r.sphere].emissionColorStrength;
+    lightSample.radianceScale = emission.xyz * emission.w * (cosSurface * areaFactor / PI * r.W);
+    return true;
+}
@@ -0,0 +1,76 @@
+#version 450 core
+layout (local_size_x = 16, local_size_y = 16) in;
+
+uniform vec2 resolution;
+uniform vec3 cameraPosition;
+uniform int frameIndex;                 // Seeds the random numbers; must change every frame, also while the camera moves
+uniform int restirSpatialSamples;       // neighbours merged per pixel, at most RESTIR_MAX_SPATIAL_SAMPLES
+
+#include "rayTracingCommon.glsl"
+#include "restirCommon.glsl"
+
+// Written by restirCandidates.glsl
+layout (std430, binding = 17) readonly buffer TemporalReservoirBuffer {
+    Reservoir temporalReservoirs[];
+};
+
+// Candidates behind the final reservoirs of every 4th pixel in x and y, for the UI's
+// effective sample count; zeroed before the dispatch
+layout (std430, binding = 19) buffer RestirStatsBuffer {
+    uint sampleCountSum;
+    uint sampledPixels;
+};
+
+// Per pixel: merge the reservoirs of random neighbours within RESTIR_SPATIAL_RADIUS that
+// lie on a similar surface into the pixel's own
+void main()
+{
+    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
+    if (pixelCoords.x >= int(resolution.x) || pixelCoords.y >= int(resolution.y)) return;
+    uint pixel = uint(pixelCoords.y * int(resolution.x) + pixelCoords.x);
+
+    Reservoir own = temporalReservoirs[pixel];
+    Reservoir merged = own;
+    if (own.normal != vec3(0.0) && restirSpatialSamples > 0) {
+        uint state = HashUint(pixel ^ HashUint(uint(frameIndex) ^ 0x27d4eb2fu));
+        float depth = distance(own.origin, cameraPosition);
+
+        merged = EmptyReservoir(own.origin, own.normal);
+        float weightSum = 0.0;
+        RestirStream(merged, weightSum, own, randomValueInt(state));
+
+        uint neighbours[RESTIR_MAX_SPATIAL_SAMPLES];
+        int neighbourCount = 0;
+        int chosen = -1;                                // neighbours[] entry merged's sample came from, -1 for own
+        for (int i = 0; i < min(restirSpatialSamples, RESTIR_MAX_SPATIAL_SAMPLES); i++) {
+            float ux = randomValueInt(state);
+            float uy = randomValueInt(state);
+            float choice = randomValueInt(state);
+            ivec2 neighbourCoords = pixelCoords + ivec2(floor(ConcentricDisk(vec2(ux, uy)) * RESTIR_SPATIAL_RADIUS + 0.5));
+            if (neighbourCoords == pixelCoords) continue;
+            if (any(lessThan(neighbourCoords, ivec2(0))) || any(greaterThanEqual(neighbourCoords, ivec2(resolution)))) continue;
+
+            uint neighbour = uint(neighbourCoords.y * int(resolution.x) + neighbourCoords.x);
+            Reservoir r = temporalReservoirs[neighbour];
+            if (!RestirSimilar(r, own.origin, own.normal, depth)) continue;
+            if (RestirStream(merged, weightSum, r, choice)) chosen = neighbourCount;
+            neighbours[neighbourCount++] = neighbour;
+        }
+
+        float chosenTarget = RestirInputTarget(own, merged);
+        float targetSum = chosenTarget * own.M;
+        for (int i = 0; i < neighbourCount; i++) {
+            Reservoir r = temporalReservoirs[neighbours[i]];
+            float target = RestirInputTarget(r, merged);
+            targetSum += target * r.M;
+            if (i == chosen) chosenTarget = target;
+        }
+        RestirFinish(merged, weightSum, targetSum > 0.0 ? chosenTarget / targetSum : 0.0);
+    }
+    reservoirs[pixel] = merged;
+
+    if (pixelCoords.x % 4 == 0 && pixelCoords.y % 4 == 0 && merged.normal != vec3(0.0)) {
+        atomicAdd(sampleCountSum, uint(merged.M));
+        atomicAdd(sampledPixels, 1u);
+    }
+}
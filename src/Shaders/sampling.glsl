@@ -0,0 +1,215 @@
+// Random numbers and bounce direction sampling; mirrored by src/sampling.h.
+// Included by rayTracingCommon.glsl.
+
+uniform int hemisphereSampler;          // 0 random, 1 stratified, 2 R2 sequence, 3 Sobol, 4 Sobol + blue noise (HemisphereSampler on the CPU)
+
+// BlueNoiseTile(): two void-and-cluster rank matrices in .x and .y
+layout (binding = 1) uniform usampler2D blueNoiseTex;
+const uint BLUE_NOISE_SIZE = 64u;
+const uint BLUE_NOISE_BITS = 12u;
+
+const float PI = 3.14159265;
+// Dimensions of the light sample of a bounce, far past any bounce count: SampleSquare(index,
+// LIGHT_SAMPLE_DIMENSION + bounce) is the direction towards the light, LIGHT_PICK_DIMENSION + bounce picks it
+const int   LIGHT_SAMPLE_DIMENSION = 0x10000;
+const int   LIGHT_PICK_DIMENSION   = 0x20000;
+// SampleSquare(index, ROULETTE_DIMENSION + bounce).x decides whether a path survives Russian roulette
+const int   ROULETTE_DIMENSION     = 0x30000;
+
+// Which sample of which pixel a path belongs to
+struct SampleIndex {
+    uint pixel;                         // row-major image index
+    uint width;                         // image width, to find the pixel in the blue-noise tile
+    uint frame;                         // frameIndex
+    uint rayIndex;                      // sample within the frame
+    uint sampleCount;                   // MAX_TRACE_PER_PIXEL
+};
+
+float randomValueInt(inout uint state)
+{
+    state = state * 747796405u + 2891336453u;
+    uint result = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    result = (result >> 22u) ^ result;
+    return result / 4294967296.0;
+}
+
+// lowbias32 integer hash
+uint HashUint(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// 24 high bits, so the result is exact and never rounds up to 1.0
+float UintToUnitFloat(uint bits)
+{
+    return float(bits >> 8) * (1.0 / 16777216.0);
+}
+
+// Kensler's hash-based permutation of [0, count): element i of a random shuffle chosen by seed
+uint PermuteIndex(uint i, uint count, uint seed)
+{
+    uint w = count - 1u;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;             i *= 0xe170893du;
+        i ^= seed >> 16;       i ^= (i & w) >> 4;
+        i ^= seed >> 8;        i *= 0x0929eb3fu;
+        i ^= seed >> 23;       i ^= (i & w) >> 1;
+        i *= 1u | seed >> 27;  i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;    i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;     i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;     i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= count);
+    return (i + seed) % count;
+}
+
+// Hash-based Laine-Karras permutation (Burley 2020): every bit is flipped depending only on the bits below it
+uint LaineKarrasPermutation(uint x, uint seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen (nested uniform) scrambling of the binary fraction 0.x: bits flip depending on the bits above them
+uint OwenScramble(uint x, uint seed)
+{
+    return bitfieldReverse(LaineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+// Second Sobol dimension; the first one is bitfieldReverse(n)
+uint SobolDimension1(uint n)
+{
+    uint result = 0u;
+    for (uint v = 0x80000000u; n != 0u; n >>= 1, v ^= v >> 1)
+        if ((n & 1u) != 0u) result ^= v;
+    return result;
+}
+
+// Dimension allocator: bounce b owns dimensions 2b and 2b + 1. Each pair is the 2D Sobol
+// net again, decorrelated by its own index shuffle and scrambles (Burley's padding).
+uint SobolDimensionSeed(uint pixelSeed, int bounce)
+{
+    return HashUint(pixelSeed ^ HashUint(uint(bounce) + 0x68bc21ebu));
+}
+
+// Point n of the Owen-scrambled 2D Sobol sequence as 0.32 fixed point
+uvec2 SobolPoint(uint n, uint seed)
+{
+    uint shuffled = OwenScramble(n, seed);
+    // OwenScramble(bitfieldReverse(shuffled)) without the two reversals that cancel
+    return uvec2(bitfieldReverse(LaineKarrasPermutation(shuffled, HashUint(seed ^ 0xa511e9b3u))),
+                 OwenScramble(SobolDimension1(shuffled), HashUint(seed ^ 0x63d83595u)));
+}
+
+// Toroidal shift of the pixel for this bounce, from a window of the tile that moves with the bounce
+uvec2 BlueNoiseShift(SampleIndex index, int bounce)
+{
+    uint window = HashUint(uint(bounce));
+    uint x = (index.pixel % index.width + window) & (BLUE_NOISE_SIZE - 1u);
+    uint y = (index.pixel / index.width + (window >> 16)) & (BLUE_NOISE_SIZE - 1u);
+    return texelFetch(blueNoiseTex, ivec2(x, y), 0).xy << (32u - BLUE_NOISE_BITS);
+}
+
+// 2D point in [0, 1)^2 for the bounce'th direction of a path:
+//  random:          two draws from the path's RNG
+//  stratified:      Latin hypercube over the samples of the frame, shuffled per pixel, frame and bounce
+//  R2:              low-discrepancy R2 sequence over all samples accumulated so far, rotated per pixel and bounce
+//  Sobol:           Owen-scrambled Sobol over all samples accumulated so far, scrambled per pixel and bounce
+//  blue noise:      the same Sobol points in every pixel, shifted by the blue-noise tile, so the
+//                   error of neighbouring pixels is anticorrelated and reads as fine grain
+vec2 SampleSquare(SampleIndex index, int bounce, inout uint state)
+{
+    if (hemisphereSampler == 1) {
+        uint seed = HashUint(index.pixel ^ HashUint(index.frame ^ HashUint(uint(bounce))));
+        float jitterX = randomValueInt(state);
+        float jitterY = randomValueInt(state);
+        float strataX = float(PermuteIndex(index.rayIndex, index.sampleCount, seed));
+        float strataY = float(PermuteIndex(index.rayIndex, index.sampleCount, HashUint(seed)));
+        return min(vec2(strataX + jitterX, strataY + jitterY) / float(index.sampleCount), vec2(0.99999994));
+    }
+    if (hemisphereSampler == 2) {
+        // 0.32 fixed point keeps the sequence exact however many frames accumulate
+        uint n = index.frame * index.sampleCount + index.rayIndex;
+        uint seed = HashUint(index.pixel ^ HashUint(uint(bounce)));
+        return vec2(UintToUnitFloat(HashUint(seed) + n * 3242174889u),
+                    UintToUnitFloat(HashUint(seed ^ 0x9e3779b9u) + n * 2447445413u));
+    }
+    if (hemisphereSampler >= 3) {
+        uint n = index.frame * index.sampleCount + index.rayIndex;
+        bool blueNoise = hemisphereSampler == 4;
+        uvec2 bits = SobolPoint(n, SobolDimensionSeed(blueNoise ? 0u : HashUint(index.pixel), bounce));
+        if (blueNoise) bits += BlueNoiseShift(index, bounce);
+        return vec2(UintToUnitFloat(bits.x), UintToUnitFloat(bits.y));
+    }
+
+    float u = randomValueInt(state);
+    float v = randomValueInt(state);
+    return vec2(u, v);
+}
+
+// Shirley-Chiu concentric mapping of the unit square onto the unit disk
+vec2 ConcentricDisk(vec2 u)
+{
+    vec2 offset = u * 2.0 - 1.0;
+    if (offset.x == 0.0 && offset.y == 0.0) return vec2(0.0);
+
+    float r, theta;
+    if (abs(offset.x) > abs(offset.y)) {
+        r = offset.x;
+        theta = (PI / 4.0) * (offset.y / offset.x);
+    } else {
+        r = offset.y;
+        theta = PI / 2.0 - (PI / 4.0) * (offset.x / offset.y);
+    }
+    return r * vec2(cos(theta), sin(theta));
+}
+
+// Branchless orthonormal basis around a unit vector (Duff et al.)
+void OrthonormalBasis(vec3 normal, out vec3 tangent, out vec3 bitangent)
+{
+    float s = normal.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (s + normal.z);
+    float b = normal.x * normal.y * a;
+    tangent   = vec3(1.0 + s * normal.x * normal.x * a, s * b, -s * normal.x);
+    bitangent = vec3(b, s + normal.y * normal.y * a, -normal.y);
+}
+
+// Cosine-weighted direction around the (unit) normal: the disk point lifted onto the
+// hemisphere (Malley's method)
+vec3 SampleCosineHemisphere(vec3 normal, vec2 u)
+{
+    vec2 disk = ConcentricDisk(u);
+    float z = sqrt(max(0.0, 1.0 - dot(disk, disk)));
+
+    vec3 tangent, bitangent;
+    OrthonormalBasis(normal, tangent, bitangent);
+    return disk.x * tangent + disk.y * bitangent + z * normal;
+}
+
+// Direction in the cone of half angle acos(1 - oneMinusCosMax) around the (unit) axis,
+// uniform in solid angle
+vec3 SampleCone(vec3 axis, float oneMinusCosMax, vec2 u)
+{
+    float cosTheta = 1.0 - u.y * oneMinusCosMax;
+    float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+    float phi = 2.0 * PI * u.x;
+
+    vec3 tangent, bitangent;
+    OrthonormalBasis(axis, tangent, bitangent);
+    return (cos(phi) * sinTheta) * tangent + (sin(phi) * sinTheta) * bitangent + cosTheta * axis;
+}
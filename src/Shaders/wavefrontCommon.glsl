@@ -0,0 +1,74 @@
+// Persistent buffers of the wavefront pipeline (see gpuWavefront.h). Paths live
+// in two ping-pong queues: a bounce reads the queue bound as inPaths and appends
+// the paths that survive it to outPaths through an atomic counter, so the next
+// bounce only launches lanes for live paths.
+
+const uint WAVEFRONT_GROUP_SIZE = 64;   // local_size_x of the per-path passes
+
+uniform int inQueue;                    // 0 or 1: queueCount[] entry of inPaths, outPaths uses the other one
+
+struct PathState {
+    vec3  origin;
+    uint  pixel;                    // y * width + x
+    vec3  direction;
+    float bsdfPdf;                  // pdf of direction, 0 for the camera ray
+    vec3  normal;                   // of the surface origin lies on
+    float padding0;
+    vec3  rayColor;                 // throughput so far
+    float padding1;
+    vec3  incomingLight;            // light gathered so far
+    float padding2;
+};
+
+layout (std430, binding = 7) buffer InPathBuffer {
+    PathState inPaths[];
+};
+
+// outPaths (binding 8) is declared by wavefrontConnect.glsl, the only pass that appends to
+// it: every block counts against GL_MAX_COMPUTE_SHADER_STORAGE_BLOCKS, as low as 16
+
+// Closest hit of inPaths[i], written by the extend pass for the shade pass
+struct PathHit {
+    vec3  position;
+    uint  hit;                      // 0 on a miss
+    vec3  normal;
+    int   sphere;                   // spheres[] index of a sphere hit, -1 otherwise
+    vec3  baseColor;
+    float padding1;
+    vec3  emittedLight;             // emissionColor * emissionStrength
+    float padding2;
+};
+
+layout (std430, binding = 9) buffer HitBuffer {
+    PathHit hits[];
+};
+
+// Light sample of inPaths[i], written by the shade pass for the connect pass
+struct ShadowRay {
+    vec3  origin;
+    float maxDist;                  // 0: no light sample
+    vec3  direction;
+    uint  alive;                    // 1: the path goes on to the next bounce
+    vec3  contribution;             // light it adds when nothing blocks the shadow ray
+    int   pathEnd;                  // PATH_* reason the path ends for when alive is 0
+};
+
+layout (std430, binding = 14) buffer ShadowRayBuffer {
+    ShadowRay shadowRays[];
+};
+
+struct PixelState {
+    vec3  totalIncomingLight;       // sum over the finished samples of this frame
+    uint  rngState;
+};
+
+layout (std430, binding = 10) buffer PixelBuffer {
+    PixelState pixels[];
+};
+
+layout (std430, binding = 11) buffer QueueCounterBuffer {
+    uint queueCount[2];
+    uint dispatchArgs[3];           // DispatchIndirectCommand over the input queue of the next bounce
+    uint pathEnds[];                // at PathEndBin(), counted by the connect pass and copied to binding 20 after
+                                    // the frame; a block of their own would not fit the connect pass's limit
+};
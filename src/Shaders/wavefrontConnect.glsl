@@ -0,0 +1,38 @@
+#version 450 core
+layout (local_size_x = 64) in;
+
+uniform int bounce;                     // Bounce of Trace() this pass runs
+uniform int imageWidth;
+
+#include "rayTracingCommon.glsl"
+#include "wavefrontCommon.glsl"
+
+layout (std430, binding = 8) buffer OutPathBuffer {
+    PathState outPaths[];
+};
+
+// Traces the shadow rays of a bounce, then compacts the surviving paths into
+// outPaths; finished ones add their light to the pixel and, for every 4th pixel in
+// x and y, count in pathEnds[].
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= queueCount[inQueue]) return;
+
+    PathState path = inPaths[i];
+    ShadowRay shadowRay = shadowRays[i];
+    if (shadowRay.maxDist > 0.0) {
+        Ray ray;
+        ray.origin = shadowRay.origin;
+        ray.direction = shadowRay.direction;
+        if (!Occluded(ray, shadowRay.maxDist)) path.incomingLight += shadowRay.contribution;
+    }
+
+    if (shadowRay.alive != 0u) {
+        outPaths[atomicAdd(queueCount[1 - inQueue], 1u)] = path;
+        return;
+    }
+    pixels[path.pixel].totalIncomingLight += path.incomingLight;
+    if ((path.pixel % uint(imageWidth)) % 4u == 0u && (path.pixel / uint(imageWidth)) % 4u == 0u)
+        atomicAdd(pathEnds[PathEndBin(shadowRay.pathEnd, bounce)], 1u);
+}
@@ -0,0 +1,24 @@
+#version 450 core
+layout (local_size_x = 64) in;
+
+#include "rayTracingCommon.glsl"
+#include "wavefrontCommon.glsl"
+
+// Closest hit of every live path
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= queueCount[inQueue]) return;
+
+    Ray ray;
+    ray.origin = inPaths[i].origin;
+    ray.direction = inPaths[i].direction;
+
+    HitResult hitResult = CalculateRayCollision(ray);
+    hits[i].position = hitResult.position;
+    hits[i].hit = hitResult.hit ? 1u : 0u;
+    hits[i].normal = hitResult.normal;
+    hits[i].sphere = hitResult.sphere;
+    hits[i].baseColor = hitResult.material.baseColor;
+    hits[i].emittedLight = hitResult.material.emissionColor * hitResult.material.emissionStrength;
+}
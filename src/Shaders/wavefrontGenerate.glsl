@@ -0,0 +1,50 @@
+#version 450 core
+layout (local_size_x = 16, local_size_y = 16) in;
+
+uniform vec2 resolution;
+uniform vec3 cameraPosition;
+uniform mat3 cameraRotation;
+uniform float fov;
+uniform int frameIndex;                 // Frames accumulated into screenTex since the last reset
+uniform int rayIndex;                   // Sample of the frame this pass starts
+
+#include "wavefrontCommon.glsl"
+
+float FOV = tan(radians(fov) * 0.5);
+
+// One camera ray per pixel into inPaths[pixel]; also resets the queues for the first bounce
+void main()
+{
+    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = ivec2(resolution);
+    if (pixelCoords.x >= size.x || pixelCoords.y >= size.y) return;
+    uint pixel = uint(pixelCoords.y * size.x + pixelCoords.x);
+
+    if (pixel == 0) {
+        uint pathCount = uint(size.x * size.y);
+        queueCount[inQueue] = pathCount;
+        queueCount[1 - inQueue] = 0;
+        dispatchArgs[0] = (pathCount + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+        dispatchArgs[1] = 1;
+        dispatchArgs[2] = 1;
+    }
+
+    // Same seed as the megakernel; the state carries over between the samples of a frame
+    if (rayIndex == 0) {
+        uint rngState = uint(pixelCoords.x * 73856093 ^ pixelCoords.y * 19349663);
+        rngState ^= uint(frameIndex) * 2654435761u;
+        pixels[pixel].totalIncomingLight = vec3(0.0);
+        pixels[pixel].rngState = rngState;
+    }
+
+    vec2 uvCoords = (pixelCoords / resolution) * 2.0 - 1.0;
+    uvCoords.x *= resolution.x / resolution.y;
+
+    inPaths[pixel].origin = cameraPosition;
+    inPaths[pixel].pixel = pixel;
+    inPaths[pixel].direction = normalize(cameraRotation * vec3(uvCoords * FOV, 1.0));
+    inPaths[pixel].bsdfPdf = 0.0;
+    inPaths[pixel].normal = vec3(0.0);
+    inPaths[pixel].rayColor = vec3(1.0);
+    inPaths[pixel].incomingLight = vec3(0.0);
+}
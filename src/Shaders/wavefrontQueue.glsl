@@ -0,0 +1,15 @@
+#version 450 core
+layout (local_size_x = 1) in;
+
+#include "wavefrontCommon.glsl"
+
+// Single invocation between bounces: sizes the next indirect dispatch to the
+// paths that survived and empties the queue that was just consumed
+void main()
+{
+    uint pathCount = queueCount[1 - inQueue];
+    dispatchArgs[0] = (pathCount + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+    dispatchArgs[1] = 1;
+    dispatchArgs[2] = 1;
+    queueCount[inQueue] = 0;
+}
@@ -0,0 +1,27 @@
+#version 450 core
+layout (local_size_x = 16, local_size_y = 16) in;
+layout (rgba32f, binding = 0) uniform image2D screenTex;
+
+uniform vec2 resolution;
+uniform int  MAX_TRACE_PER_PIXEL;
+uniform int  frameIndex;                // Frames accumulated into screenTex since the last reset
+
+#include "wavefrontCommon.glsl"
+
+// Averages the samples of every pixel into screenTex like the end of the megakernel
+void main()
+{
+    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = ivec2(resolution);
+    if (pixelCoords.x >= size.x || pixelCoords.y >= size.y) return;
+
+    vec3 pixelColor = pixels[pixelCoords.y * size.x + pixelCoords.x].totalIncomingLight / float(MAX_TRACE_PER_PIXEL);
+
+    // Running average with the frames accumulated so far
+    if (frameIndex > 0) {
+        vec3 accumulated = imageLoad(screenTex, pixelCoords).rgb;
+        pixelColor = accumulated + (pixelColor - accumulated) / float(frameIndex + 1);
+    }
+
+    imageStore(screenTex, pixelCoords, vec4(pixelColor, 1.0));
+}
@@ -0,0 +1,79 @@
+#version 450 core
+layout (local_size_x = 64) in;
+
+uniform int lastBounce;                 // 1 on the final bounce: every path finishes
+uniform int bounce;                     // Bounce of Trace() this pass runs
+uniform int imageWidth;
+uniform int frameIndex;
+uniform int rayIndex;
+uniform int MAX_TRACE_PER_PIXEL;
+
+#include "rayTracingCommon.glsl"
+#include "wavefrontCommon.glsl"
+#include "restirCommon.glsl"
+
+// One bounce of the megakernel's Trace() loop up to the shadow ray: the path is
+// updated in place and its light sample left in shadowRays[i] for the connect pass.
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= queueCount[inQueue]) return;
+
+    PathState path = inPaths[i];
+    ShadowRay shadowRay;
+    shadowRay.maxDist = 0.0;
+    shadowRay.alive = 0u;
+    shadowRay.pathEnd = PATH_ESCAPED;
+
+    if (hits[i].hit != 0u)
+    {
+        SampleIndex index = SampleIndex(path.pixel, uint(imageWidth), uint(frameIndex), uint(rayIndex), uint(MAX_TRACE_PER_PIXEL));
+        uint state = pixels[path.pixel].rngState;
+
+        // With ReSTIR the camera ray hit's light sample stands for all of its direct light from
+        // the spheres; emissive meshes are never sampled and count fully
+        float emissionWeight = restir != 0 && bounce == 1 && hits[i].sphere >= 0 ? 0.0 : EmissionWeight(path.bsdfPdf, path.origin, path.normal, hits[i].sphere);
+        path.incomingLight += hits[i].emittedLight * path.rayColor * emissionWeight;
+        path.rayColor *= hits[i].baseColor;
+
+        bool alive = lastBounce == 0 && SurvivesRoulette(index, bounce, path.rayColor, state);
+        shadowRay.pathEnd = lastBounce == 0 ? PATH_ROULETTE : PATH_BOUNCE_LIMIT;
+
+        vec3 normal = hits[i].normal;
+        vec3 origin = hits[i].position + normal * 0.01;  // Offset to avoid self-intersection
+        if (nextEventEstimation != 0 && numLights > 0 && alive) {
+            LightSample lightSample;
+            bool sampled;
+            if (restir != 0 && bounce == 0) {
+                sampled = RestirLightSample(reservoirs[path.pixel], lightSample);
+            } else {
+                vec2 u = SampleSquare(index, LIGHT_SAMPLE_DIMENSION + bounce, state);
+                vec2 uPick = SampleSquare(index, LIGHT_PICK_DIMENSION + bounce, state);
+                sampled = SampleLight(origin, normal, u, uPick, lightSample);
+            }
+            if (sampled) {
+                shadowRay.origin = lightSample.shadowRay.origin;
+                shadowRay.maxDist = lightSample.maxDist;
+                shadowRay.direction = lightSample.shadowRay.direction;
+                shadowRay.contribution = path.rayColor * lightSample.radianceScale;
+            }
+        }
+
+        if (alive) {
+            path.origin = origin;
+            path.direction = SampleCosineHemisphere(normal, SampleSquare(index, bounce, state));
+            path.bsdfPdf = dot(normal, path.direction) / PI;
+            path.normal = normal;
+        }
+        pixels[path.pixel].rngState = state;
+        shadowRay.alive = alive ? 1u : 0u;
+    }
+    else
+    {
+        // Add background color when ray doesn't hit anything
+        path.incomingLight += vec3(0.1) * path.rayColor;  // Ambient light
+    }
+
+    inPaths[i] = path;
+    shadowRays[i] = shadowRay;
+}
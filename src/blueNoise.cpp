@@ -0,0 +1,116 @@
+#include "blueNoise.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const float BLUE_NOISE_SIGMA = 1.5f;     // Ulichney's choice, wide enough to see the neighbours
+
+// Binary pattern on a torus plus the Gaussian-filtered density ("energy") of its points
+struct VoidAndCluster {
+    int                  size;
+    std::vector<float>   kernel;        // indexed by the wrapped offset dy * size + dx
+    std::vector<float>   energy;
+    std::vector<uint8_t> points;
+
+    explicit VoidAndCluster(int size) : size(size), kernel(size * size), energy(size * size, 0.0f), points(size * size, 0)
+    {
+        for (int dy = 0; dy < size; ++dy) {
+            for (int dx = 0; dx < size; ++dx) {
+                const float x = (float)std::min(dx, size - dx);
+                const float y = (float)std::min(dy, size - dy);
+                kernel[dy * size + dx] = std::exp(-(x * x + y * y) / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+            }
+        }
+    }
+
+    void Set(int index, bool on)
+    {
+        points[index] = on ? 1 : 0;
+        const int px = index % size, py = index / size;
+        const float sign = on ? 1.0f : -1.0f;
+        for (int y = 0; y < size; ++y) {
+            const float* row = &kernel[((y - py) & (size - 1)) * size];
+            for (int x = 0; x < size; ++x)
+                energy[y * size + x] += sign * row[(x - px) & (size - 1)];
+        }
+    }
+
+    // The point with the most neighbours
+    int TightestCluster() const
+    {
+        int best = -1;
+        for (int i = 0; i < size * size; ++i)
+            if (points[i] && (best < 0 || energy[i] > energy[best])) best = i;
+        return best;
+    }
+
+    // The empty texel farthest from every point. Once more than half the texels are set
+    // this is also Ulichney's tightest cluster of empty texels, as the energies of a
+    // pattern and its inverse add up to a constant.
+    int LargestVoid() const
+    {
+        int best = -1;
+        for (int i = 0; i < size * size; ++i)
+            if (!points[i] && (best < 0 || energy[i] < energy[best])) best = i;
+        return best;
+    }
+};
+
+std::vector<uint16_t> GenerateBlueNoise(int size, uint32_t seed)
+{
+    const int count = size * size;
+    const int initialPoints = count / 10;
+    VoidAndCluster pattern(size);
+
+    // Random initial pattern from an LCG
+    uint32_t state = seed;
+    for (int placed = 0; placed < initialPoints; ) {
+        state = state * 1664525u + 1013904223u;
+        const int index = (int)((state >> 8) % (uint32_t)count);
+        if (pattern.points[index]) continue;
+        pattern.Set(index, true);
+        ++placed;
+    }
+
+    // Move the tightest cluster into the largest void until that stops changing anything
+    for (int iteration = 0; iteration < count; ++iteration) {
+        const int cluster = pattern.TightestCluster();
+        pattern.Set(cluster, false);
+        const int largestVoid = pattern.LargestVoid();
+        pattern.Set(largestVoid, true);
+        if (largestVoid == cluster) break;
+    }
+
+    std::vector<uint16_t> ranks(count);
+
+    // Ranks below initialPoints: take clusters away from a copy, densest first
+    VoidAndCluster removal = pattern;
+    for (int rank = initialPoints - 1; rank >= 0; --rank) {
+        const int cluster = removal.TightestCluster();
+        removal.Set(cluster, false);
+        ranks[cluster] = (uint16_t)rank;
+    }
+
+    // The rest: fill the largest void, one texel at a time
+    for (int rank = initialPoints; rank < count; ++rank) {
+        const int largestVoid = pattern.LargestVoid();
+        pattern.Set(largestVoid, true);
+        ranks[largestVoid] = (uint16_t)rank;
+    }
+    return ranks;
+}
+
+const std::vector<uint16_t>& BlueNoiseTile()
+{
+    static const std::vector<uint16_t> tile = [] {
+        const std::vector<uint16_t> x = GenerateBlueNoise(BLUE_NOISE_SIZE, 0x2545f491u);
+        const std::vector<uint16_t> y = GenerateBlueNoise(BLUE_NOISE_SIZE, 0x9e3779b9u);
+        std::vector<uint16_t> interleaved(2 * x.size());
+        for (size_t i = 0; i < x.size(); ++i) {
+            interleaved[2 * i]     = x[i];
+            interleaved[2 * i + 1] = y[i];
+        }
+        return interleaved;
+    }();
+    return tile;
+}
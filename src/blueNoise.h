@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+const int BLUE_NOISE_SIZE = 64;         // Edge of the tile in texels, a power of two
+const int BLUE_NOISE_BITS = 12;         // log2(BLUE_NOISE_SIZE * BLUE_NOISE_SIZE)
+
+// Void-and-cluster rank matrix: every value in [0, size * size) once, spread so that
+// any threshold of it is a blue-noise point set, and tiling without seams
+std::vector<uint16_t> GenerateBlueNoise(int size, uint32_t seed);
+
+// The tile the samplers use: two independent rank matrices of BLUE_NOISE_SIZE,
+// interleaved (x, y) per texel in row-major order. Generated on first use.
+const std::vector<uint16_t>& BlueNoiseTile();
@@ -0,0 +1,501 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+static const int      SAH_BIN_COUNT       = 16;
+static const uint32_t MAX_LEAF_PRIMS      = 8;
+static const uint32_t PARALLEL_TASK_PRIMS = 4096;    // smaller subtrees build on one thread
+static const uint32_t PARALLEL_SCAN_PRIMS = 65536;   // larger nodes are scanned/binned in parallel
+static const uint32_t SCAN_CHUNK_PRIMS    = 16384;
+
+// Whether count primitives at depth only end in leaves of at most leafPrims by
+// BVH_MAX_DEPTH if every split from here on halves them. Builders that follow this
+// keep count <= leafPrims << (BVH_MAX_DEPTH - depth) on every node.
+static bool MustSplitByCount(uint32_t count, uint32_t depth, uint32_t leafPrims)
+{
+    const uint32_t levelsLeft = BVH_MAX_DEPTH - depth;
+    return levelsLeft <= 32 && count > ((uint64_t)leafPrims << (levelsLeft - 1));
+}
+
+// Children are always allocated after their parent, so one pass in index order
+// reaches every parent first
+uint32_t BvhMaxDepth(const Bvh& bvh)
+{
+    std::vector<uint32_t> depth(bvh.nodes.size(), 0);
+    uint32_t maxDepth = 0;
+    for (size_t i = 0; i < bvh.nodes.size(); ++i) {
+        const BvhNode& node = bvh.nodes[i];
+        maxDepth = std::max(maxDepth, depth[i]);
+        if (!node.IsLeaf()) depth[node.leftFirst] = depth[node.leftFirst + 1] = depth[i] + 1;
+    }
+    return maxDepth;
+}
+
+struct SahBin {
+    Aabb     bounds;
+    uint32_t count = 0;
+};
+
+struct RangeInfo {
+    Aabb bounds;
+    Aabb centroidBounds;
+};
+
+struct SahBuilder {
+    const std::vector<Aabb>& primBounds;
+    std::vector<glm::vec3>   centroids;
+    ThreadPool&              pool;
+    Bvh&                     bvh;
+    std::atomic<uint32_t>    nodeCount{1};
+
+    SahBuilder(const std::vector<Aabb>& primBounds, ThreadPool& pool, Bvh& bvh)
+        : primBounds(primBounds), pool(pool), bvh(bvh) {}
+
+    static size_t ChunkCount(uint32_t count)
+    {
+        return count > PARALLEL_SCAN_PRIMS ? (count + SCAN_CHUNK_PRIMS - 1) / SCAN_CHUNK_PRIMS : 1;
+    }
+
+    // Runs fn(chunkFirst, chunkCount, chunkIndex) over [first, first + count), in parallel when large
+    template <typename Fn>
+    size_t ForChunks(uint32_t first, uint32_t count, Fn&& fn)
+    {
+        const size_t chunks = ChunkCount(count);
+        if (chunks == 1) {
+            fn(first, count, 0);
+            return 1;
+        }
+        pool.ParallelFor(chunks, [&](size_t c) {
+            uint32_t chunkFirst = first + (uint32_t)c * SCAN_CHUNK_PRIMS;
+            uint32_t chunkCount = std::min(SCAN_CHUNK_PRIMS, first + count - chunkFirst);
+            fn(chunkFirst, chunkCount, c);
+        });
+        return chunks;
+    }
+
+    RangeInfo ScanRange(uint32_t first, uint32_t count)
+    {
+        // Small nodes use the stack, only parallel scans need per-chunk storage
+        RangeInfo local;
+        std::vector<RangeInfo> chunkInfo(ChunkCount(count) > 1 ? ChunkCount(count) : 0);
+        RangeInfo* partial = chunkInfo.empty() ? &local : chunkInfo.data();
+        size_t chunks = ForChunks(first, count, [&](uint32_t f, uint32_t n, size_t c) {
+            RangeInfo info;
+            for (uint32_t i = f; i < f + n; ++i) {
+                uint32_t prim = bvh.primIndices[i];
+                info.bounds.Grow(primBounds[prim]);
+                info.centroidBounds.Grow(centroids[prim]);
+            }
+            partial[c] = info;
+        });
+
+        RangeInfo result;
+        for (size_t c = 0; c < chunks; ++c) {
+            result.bounds.Grow(partial[c].bounds);
+            result.centroidBounds.Grow(partial[c].centroidBounds);
+        }
+        return result;
+    }
+
+    void MakeLeaf(BvhNode& node, const Aabb& bounds, uint32_t first, uint32_t count)
+    {
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+        node.leftFirst = first;
+        node.primCount = count;
+    }
+
+    void Build(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth)
+    {
+        const RangeInfo range = ScanRange(first, count);
+        BvhNode& node = bvh.nodes[nodeIndex];
+
+        if (count == 1 || depth == BVH_MAX_DEPTH) {
+            MakeLeaf(node, range.bounds, first, count);
+            return;
+        }
+
+        // Bin centroids along all three axes
+        const glm::vec3 cmin = range.centroidBounds.min;
+        const glm::vec3 extent = range.centroidBounds.max - cmin;
+        glm::vec3 scale;
+        for (int a = 0; a < 3; ++a) scale[a] = extent[a] > 0.0f ? SAH_BIN_COUNT / extent[a] : 0.0f;
+
+        auto binOf = [&](const glm::vec3& c, int axis) {
+            return std::min(SAH_BIN_COUNT - 1, (int)((c[axis] - cmin[axis]) * scale[axis]));
+        };
+
+        SahBin localBins[3 * SAH_BIN_COUNT];
+        std::vector<SahBin> chunkBins(ChunkCount(count) > 1 ? ChunkCount(count) * 3 * SAH_BIN_COUNT : 0);
+        SahBin* partialBins = chunkBins.empty() ? localBins : chunkBins.data();
+        size_t chunks = ForChunks(first, count, [&](uint32_t f, uint32_t n, size_t c) {
+            SahBin* bins = &partialBins[c * 3 * SAH_BIN_COUNT];
+            for (uint32_t i = f; i < f + n; ++i) {
+                uint32_t prim = bvh.primIndices[i];
+                for (int a = 0; a < 3; ++a) {
+                    SahBin& bin = bins[a * SAH_BIN_COUNT + binOf(centroids[prim], a)];
+                    bin.bounds.Grow(primBounds[prim]);
+                    bin.count++;
+                }
+            }
+        });
+
+        SahBin bins[3][SAH_BIN_COUNT];
+        for (size_t c = 0; c < chunks; ++c) {
+            for (int a = 0; a < 3; ++a) {
+                for (int b = 0; b < SAH_BIN_COUNT; ++b) {
+                    const SahBin& src = partialBins[(c * 3 + a) * SAH_BIN_COUNT + b];
+                    bins[a][b].bounds.Grow(src.bounds);
+                    bins[a][b].count += src.count;
+                }
+            }
+        }
+
+        // Sweep for the cheapest split plane
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestSplit = 0;
+        for (int a = 0; a < 3; ++a) {
+            if (scale[a] == 0.0f) continue;
+
+            float leftArea[SAH_BIN_COUNT - 1];
+            uint32_t leftCount[SAH_BIN_COUNT - 1];
+            Aabb leftBox;
+            uint32_t leftSum = 0;
+            for (int b = 0; b < SAH_BIN_COUNT - 1; ++b) {
+                leftBox.Grow(bins[a][b].bounds);
+                leftSum += bins[a][b].count;
+                leftArea[b] = leftBox.Area();
+                leftCount[b] = leftSum;
+            }
+
+            Aabb rightBox;
+            uint32_t rightSum = 0;
+            for (int b = SAH_BIN_COUNT - 1; b > 0; --b) {
+                rightBox.Grow(bins[a][b].bounds);
+                rightSum += bins[a][b].count;
+                if (leftCount[b - 1] == 0 || rightSum == 0) continue;
+
+                float cost = leftArea[b - 1] * leftCount[b - 1] + rightBox.Area() * rightSum;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        // SAH with unit traversal and intersection cost
+        const float nodeArea = range.bounds.Area();
+        const float splitCost = 1.0f + (nodeArea > 0.0f ? bestCost / nodeArea : (float)count);
+        if (count <= MAX_LEAF_PRIMS && (bestAxis < 0 || splitCost >= (float)count)) {
+            MakeLeaf(node, range.bounds, first, count);
+            return;
+        }
+
+        uint32_t* begin = bvh.primIndices.data() + first;
+        uint32_t* end = begin + count;
+        uint32_t* mid = begin + count / 2;
+        if (MustSplitByCount(count, depth, MAX_LEAF_PRIMS)) {
+            // Too deep for SAH splits that peel off a few primitives, take the median along the widest axis
+            const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            std::nth_element(begin, mid, end, [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        } else if (bestAxis >= 0) {
+            mid = std::partition(begin, end, [&](uint32_t prim) { return binOf(centroids[prim], bestAxis) < bestSplit; });
+        }
+        if (mid == begin || mid == end) mid = begin + count / 2;    // Coincident centroids, split by count
+
+        const uint32_t leftCount = (uint32_t)(mid - begin);
+        const uint32_t left = nodeCount.fetch_add(2, std::memory_order_relaxed);
+
+        node.boundsMin = range.bounds.min;
+        node.boundsMax = range.bounds.max;
+        node.leftFirst = left;
+        node.primCount = 0;
+
+        if (count > PARALLEL_TASK_PRIMS) {
+            TaskGroup group(pool);
+            group.Run([=] { Build(left, first, leftCount, depth + 1); });
+            Build(left + 1, first + leftCount, count - leftCount, depth + 1);
+            group.Wait();
+        } else {
+            Build(left, first, leftCount, depth + 1);
+            Build(left + 1, first + leftCount, count - leftCount, depth + 1);
+        }
+    }
+};
+
+Bvh BuildBvhSah(const std::vector<Aabb>& primBounds, ThreadPool& pool)
+{
+    Bvh bvh;
+    const uint32_t primCount = (uint32_t)primBounds.size();
+    if (primCount == 0) return bvh;
+
+    bvh.primIndices.resize(primCount);
+    bvh.nodes.resize(2 * (size_t)primCount - 1);
+
+    SahBuilder builder(primBounds, pool, bvh);
+    builder.centroids.resize(primCount);
+    pool.ParallelFor((primCount + SCAN_CHUNK_PRIMS - 1) / SCAN_CHUNK_PRIMS, [&](size_t c) {
+        uint32_t end = std::min(primCount, (uint32_t)(c + 1) * SCAN_CHUNK_PRIMS);
+        for (uint32_t i = (uint32_t)c * SCAN_CHUNK_PRIMS; i < end; ++i) {
+            bvh.primIndices[i] = i;
+            builder.centroids[i] = primBounds[i].Centroid();
+        }
+    });
+
+    builder.Build(0, 0, primCount, 0);
+    bvh.nodes.resize(builder.nodeCount.load());
+    assert(BvhMaxDepth(bvh) <= BVH_MAX_DEPTH);
+    return bvh;
+}
+
+void PrepareBvhRefit(Bvh& bvh)
+{
+    bvh.parents.assign(bvh.nodes.size(), UINT32_MAX);
+    bvh.primLeaf.assign(bvh.primIndices.size(), UINT32_MAX);
+
+    for (uint32_t i = 0; i < (uint32_t)bvh.nodes.size(); ++i) {
+        const BvhNode& node = bvh.nodes[i];
+        if (node.IsLeaf()) {
+            for (uint32_t k = node.leftFirst; k < node.leftFirst + node.primCount; ++k)
+                bvh.primLeaf[bvh.primIndices[k]] = i;
+        } else {
+            bvh.parents[node.leftFirst] = i;
+            bvh.parents[node.leftFirst + 1] = i;
+        }
+    }
+}
+
+void RefitBvhPrimitive(Bvh& bvh, const std::function<Aabb(uint32_t)>& primBounds, uint32_t prim, std::vector<uint32_t>* touchedNodes)
+{
+    uint32_t index = bvh.primLeaf[prim];
+    while (index != UINT32_MAX) {
+        BvhNode& node = bvh.nodes[index];
+
+        Aabb bounds;
+        if (node.IsLeaf()) {
+            for (uint32_t k = node.leftFirst; k < node.leftFirst + node.primCount; ++k)
+                bounds.Grow(primBounds(bvh.primIndices[k]));
+        } else {
+            const BvhNode& left = bvh.nodes[node.leftFirst];
+            const BvhNode& right = bvh.nodes[node.leftFirst + 1];
+            bounds.min = glm::min(left.boundsMin, right.boundsMin);
+            bounds.max = glm::max(left.boundsMax, right.boundsMax);
+        }
+
+        if (bounds.min == node.boundsMin && bounds.max == node.boundsMax) return;   // Ancestors unaffected
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+        if (touchedNodes) touchedNodes->push_back(index);
+
+        index = bvh.parents[index];
+    }
+}
+
+//=================================== LINEAR BVH (MORTON CODES) ===================================
+
+static const uint32_t LBVH_MAX_LEAF_PRIMS = 4;
+static const int      RADIX_BITS          = 8;
+static const uint32_t RADIX_BUCKETS       = 1u << RADIX_BITS;
+
+// Spreads the low 10 bits of v so there are two zero bits between each of them
+static uint64_t ExpandBits10(uint64_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v <<  8)) & 0x0300f00f;
+    v = (v | (v <<  4)) & 0x030c30c3;
+    v = (v | (v <<  2)) & 0x09249249;
+    return v;
+}
+
+// Spreads the low 21 bits of v so there are two zero bits between each of them
+static uint64_t ExpandBits21(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffull;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+    v = (v | (v <<  8)) & 0x100f00f00f00f00full;
+    v = (v | (v <<  4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v <<  2)) & 0x1249249249249249ull;
+    return v;
+}
+
+uint64_t MortonCode(const glm::vec3& unitPosition, int mortonBits)
+{
+    const bool wide = mortonBits > 30;
+    const float cells = wide ? 2097152.0f : 1024.0f;
+    glm::vec3 p = glm::clamp(unitPosition * cells, glm::vec3(0.0f), glm::vec3(cells - 1.0f));
+
+    if (wide) return (ExpandBits21((uint64_t)p.x) << 2) | (ExpandBits21((uint64_t)p.y) << 1) | ExpandBits21((uint64_t)p.z);
+    return (ExpandBits10((uint64_t)p.x) << 2) | (ExpandBits10((uint64_t)p.y) << 1) | ExpandBits10((uint64_t)p.z);
+}
+
+// Every chunk counts its digits, a prefix sum over (digit, chunk) gives each chunk
+// its private output ranges, then all chunks scatter concurrently.
+void ParallelRadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int keyBits, ThreadPool& pool)
+{
+    const size_t count = keys.size();
+    const size_t chunkCount = std::max<size_t>(1, std::min<size_t>((count + SCAN_CHUNK_PRIMS - 1) / SCAN_CHUNK_PRIMS, (size_t)pool.ThreadCount() * 4));
+    const size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    std::vector<uint64_t> keysTmp(count);
+    std::vector<uint32_t> valuesTmp(count);
+    std::vector<size_t> offsets(chunkCount * RADIX_BUCKETS);
+
+    for (int shift = 0; shift < keyBits; shift += RADIX_BITS) {
+        pool.ParallelFor(chunkCount, [&](size_t c) {
+            size_t* histogram = &offsets[c * RADIX_BUCKETS];
+            std::fill(histogram, histogram + RADIX_BUCKETS, 0);
+            for (size_t i = c * chunkSize; i < std::min(count, (c + 1) * chunkSize); ++i)
+                histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        });
+
+        size_t sum = 0;
+        for (uint32_t d = 0; d < RADIX_BUCKETS; ++d) {
+            for (size_t c = 0; c < chunkCount; ++c) {
+                size_t n = offsets[c * RADIX_BUCKETS + d];
+                offsets[c * RADIX_BUCKETS + d] = sum;
+                sum += n;
+            }
+        }
+
+        pool.ParallelFor(chunkCount, [&](size_t c) {
+            size_t* offset = &offsets[c * RADIX_BUCKETS];
+            for (size_t i = c * chunkSize; i < std::min(count, (c + 1) * chunkSize); ++i) {
+                size_t dst = offset[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                keysTmp[dst] = keys[i];
+                valuesTmp[dst] = values[i];
+            }
+        });
+
+        keys.swap(keysTmp);
+        values.swap(valuesTmp);
+    }
+}
+
+struct LbvhBuilder {
+    const std::vector<Aabb>&     primBounds;
+    const std::vector<uint64_t>& codes;         // sorted, parallel to bvh.primIndices
+    ThreadPool&                  pool;
+    Bvh&                         bvh;
+    std::atomic<uint32_t>        nodeCount{1};
+
+    LbvhBuilder(const std::vector<Aabb>& primBounds, const std::vector<uint64_t>& codes, ThreadPool& pool, Bvh& bvh)
+        : primBounds(primBounds), codes(codes), pool(pool), bvh(bvh) {}
+
+    // First index in (first, last] whose code has the highest bit that differs across the range set
+    uint32_t FindSplit(uint32_t first, uint32_t last)
+    {
+        const uint64_t diff = codes[first] ^ codes[last];
+        if (diff == 0) return (first + last + 1) / 2;   // Identical codes, split by count
+
+        uint64_t highestBit = diff;
+        highestBit |= highestBit >> 1;  highestBit |= highestBit >> 2;  highestBit |= highestBit >> 4;
+        highestBit |= highestBit >> 8;  highestBit |= highestBit >> 16; highestBit |= highestBit >> 32;
+        highestBit ^= highestBit >> 1;
+
+        // Codes are sorted, so the ones with the bit set form a suffix
+        uint32_t lo = first, hi = last;
+        while (lo + 1 < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (codes[mid] & highestBit) hi = mid;
+            else lo = mid;
+        }
+        return hi;
+    }
+
+    void Build(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth)
+    {
+        BvhNode& node = bvh.nodes[nodeIndex];
+
+        if (count <= LBVH_MAX_LEAF_PRIMS || depth == BVH_MAX_DEPTH) {
+            Aabb bounds;
+            for (uint32_t i = first; i < first + count; ++i) bounds.Grow(primBounds[bvh.primIndices[i]]);
+            node.boundsMin = bounds.min;
+            node.boundsMax = bounds.max;
+            node.leftFirst = first;
+            node.primCount = count;
+            return;
+        }
+
+        // One code bit can peel off a single primitive per level, so near the depth limit
+        // the sorted range is halved instead; its halves are still compact along the curve
+        const uint32_t split = MustSplitByCount(count, depth, LBVH_MAX_LEAF_PRIMS) ? first + count / 2 : FindSplit(first, first + count - 1);
+        const uint32_t leftCount = split - first;
+        const uint32_t left = nodeCount.fetch_add(2, std::memory_order_relaxed);
+
+        if (count > PARALLEL_TASK_PRIMS) {
+            TaskGroup group(pool);
+            group.Run([=] { Build(left, first, leftCount, depth + 1); });
+            Build(left + 1, split, count - leftCount, depth + 1);
+            group.Wait();
+        } else {
+            Build(left, first, leftCount, depth + 1);
+            Build(left + 1, split, count - leftCount, depth + 1);
+        }
+
+        // Bounds bottom-up once both children are done
+        const BvhNode& l = bvh.nodes[left];
+        const BvhNode& r = bvh.nodes[left + 1];
+        node.boundsMin = glm::min(l.boundsMin, r.boundsMin);
+        node.boundsMax = glm::max(l.boundsMax, r.boundsMax);
+        node.leftFirst = left;
+        node.primCount = 0;
+    }
+};
+
+Bvh BuildBvhLbvh(const std::vector<Aabb>& primBounds, ThreadPool& pool, int mortonBits)
+{
+    Bvh bvh;
+    const uint32_t primCount = (uint32_t)primBounds.size();
+    if (primCount == 0) return bvh;
+
+    const uint32_t chunks = (primCount + SCAN_CHUNK_PRIMS - 1) / SCAN_CHUNK_PRIMS;
+    auto forChunks = [&](const std::function<void(uint32_t, uint32_t)>& fn) {
+        pool.ParallelFor(chunks, [&](size_t c) {
+            fn((uint32_t)c * SCAN_CHUNK_PRIMS, std::min(primCount, (uint32_t)(c + 1) * SCAN_CHUNK_PRIMS));
+        });
+    };
+
+    // Quantize centroids inside the centroid bounds
+    std::vector<Aabb> chunkBounds(chunks);
+    forChunks([&](uint32_t begin, uint32_t end) {
+        Aabb b;
+        for (uint32_t i = begin; i < end; ++i) b.Grow(primBounds[i].Centroid());
+        chunkBounds[begin / SCAN_CHUNK_PRIMS] = b;
+    });
+    Aabb centroidBounds;
+    for (const Aabb& b : chunkBounds) centroidBounds.Grow(b);
+    const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+    const glm::vec3 invExtent = glm::vec3(
+        extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    std::vector<uint64_t> codes(primCount);
+    bvh.primIndices.resize(primCount);
+    forChunks([&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            codes[i] = MortonCode((primBounds[i].Centroid() - centroidBounds.min) * invExtent, mortonBits);
+            bvh.primIndices[i] = i;
+        }
+    });
+
+    ParallelRadixSort(codes, bvh.primIndices, mortonBits > 30 ? 63 : 30, pool);
+
+    bvh.nodes.resize(2 * (size_t)primCount - 1);
+    LbvhBuilder builder(primBounds, codes, pool, bvh);
+    builder.Build(0, 0, primCount, 0);
+    bvh.nodes.resize(builder.nodeCount.load());
+    assert(BvhMaxDepth(bvh) <= BVH_MAX_DEPTH);
+    return bvh;
+}
+
+Bvh BuildBvh(const std::vector<Aabb>& primBounds, ThreadPool& pool, BvhBuilder builder, int mortonBits)
+{
+    if (builder == BvhBuilder::Lbvh) return BuildBvhLbvh(primBounds, pool, mortonBits);
+    return BuildBvhSah(primBounds, pool);
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cfloat>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "threadPool.h"
+
+struct Aabb {
+    glm::vec3 min = glm::vec3( FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    void Grow(const glm::vec3& p)  { min = glm::min(min, p); max = glm::max(max, p); }
+    void Grow(const Aabb& b)       { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+    glm::vec3 Centroid() const     { return (min + max) * 0.5f; }
+    float Area() const
+    {
+        glm::vec3 e = max - min;
+        return (e.x < 0.0f) ? 0.0f : 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+// Flattened BVH node, 32 bytes. Layout matches the std430 BvhNode of the shaders:
+//   struct BvhNode { vec3 boundsMin; uint leftFirst; vec3 boundsMax; uint primCount; };
+// Interior nodes (primCount == 0) store their left child in leftFirst, the right
+// child is always leftFirst + 1. Leaves store their first primitive instead.
+struct BvhNode {
+    glm::vec3 boundsMin;
+    uint32_t  leftFirst;
+    glm::vec3 boundsMax;
+    uint32_t  primCount;
+
+    bool IsLeaf() const { return primCount > 0; }
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode must stay 32 bytes for the std430 SSBO");
+
+struct Bvh {
+    std::vector<BvhNode>  nodes;        // nodes[0] is the root
+    std::vector<uint32_t> primIndices;  // leaf ranges index into this, values are input primitive ids
+
+    // Refit bookkeeping, filled by PrepareBvhRefit
+    std::vector<uint32_t> parents;      // parent node per node, root has UINT32_MAX
+    std::vector<uint32_t> primLeaf;     // leaf node per input primitive id
+
+    bool Empty() const { return nodes.empty(); }
+};
+
+// Deepest node level any builder emits, the root being level 0. A walk that pushes
+// both children never holds more than BVH_MAX_DEPTH + 1 nodes, which is what the CPU
+// and shader traversal stacks are sized for.
+const uint32_t BVH_MAX_DEPTH = 63;
+
+enum class BvhBuilder {
+    Sah,        // binned SAH: best traversal speed, slower build
+    Lbvh        // linear BVH from sorted Morton codes: much faster build, looser tree
+};
+
+// Parallel binned-SAH build over per-primitive bounds. Nodes that could not reach
+// leaf size within BVH_MAX_DEPTH otherwise are split at their centroid median.
+Bvh BuildBvhSah(const std::vector<Aabb>& primBounds, ThreadPool& pool);
+
+// Parallel LBVH build: radix-sorts Morton codes of the primitive centroids and
+// emits the hierarchy top-down by splitting at the highest differing code bit.
+// Ranges the bits cannot separate within BVH_MAX_DEPTH are halved by count instead.
+// mortonBits is 30 (10 bits per axis) or 63 (21 bits per axis).
+Bvh BuildBvhLbvh(const std::vector<Aabb>& primBounds, ThreadPool& pool, int mortonBits = 30);
+
+Bvh BuildBvh(const std::vector<Aabb>& primBounds, ThreadPool& pool, BvhBuilder builder, int mortonBits = 30);
+
+// Interleaves the bits of a point in [0, 1]^3 into a 30- or 63-bit Morton code
+uint64_t MortonCode(const glm::vec3& unitPosition, int mortonBits);
+
+// Stable parallel LSD radix sort of keys with their values, 8 bits per pass over the low keyBits
+void ParallelRadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int keyBits, ThreadPool& pool);
+
+// Level of the deepest node, the root being level 0
+uint32_t BvhMaxDepth(const Bvh& bvh);
+
+// Fills parents and primLeaf so single primitives can be refit
+void PrepareBvhRefit(Bvh& bvh);
+
+// Updates the bounds on the path from prim's leaf to the root after the bounds of
+// prim changed, stopping early once a node's bounds come out unchanged. primBounds
+// returns the current bounds of a primitive id. Appends every rewritten node index
+// to touchedNodes when given. Topology is kept as is.
+void RefitBvhPrimitive(Bvh& bvh, const std::function<Aabb(uint32_t)>& primBounds, uint32_t prim, std::vector<uint32_t>* touchedNodes = nullptr);
+
+// Returns items permuted into BVH leaf order, so leaf ranges can index it directly
+template <typename T>
+std::vector<T> ReorderByBvh(const Bvh& bvh, const std::vector<T>& items)
+{
+    std::vector<T> ordered(items.size());
+    for (size_t i = 0; i < bvh.primIndices.size(); ++i) ordered[i] = items[bvh.primIndices[i]];
+    return ordered;
+}
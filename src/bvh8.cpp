@@ -0,0 +1,227 @@
+#include "bvh8.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define BVH8_X86_KERNELS 1
+  #include <immintrin.h>
+#else
+  #define BVH8_X86_KERNELS 0
+#endif
+
+static const int BVH8_WIDTH = 8;
+
+static float NodeArea(const BvhNode& node)
+{
+    Aabb bounds;
+    bounds.min = node.boundsMin;
+    bounds.max = node.boundsMax;
+    return bounds.Area();
+}
+
+struct Bvh8Collapser {
+    const BvhNode* nodes;
+    std::vector<Bvh8Node>& wideNodes;
+
+    uint32_t Collapse(uint32_t binaryIndex)
+    {
+        // Open the interior child with the largest surface area until all slots are used;
+        // a leaf root ends up as the only child of its wide node
+        uint32_t slots[BVH8_WIDTH];
+        int slotCount = 0;
+        const BvhNode& top = nodes[binaryIndex];
+        if (top.IsLeaf()) {
+            slots[slotCount++] = binaryIndex;
+        } else {
+            slots[slotCount++] = top.leftFirst;
+            slots[slotCount++] = top.leftFirst + 1;
+        }
+
+        while (slotCount < BVH8_WIDTH) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < slotCount; ++i) {
+                const BvhNode& node = nodes[slots[i]];
+                if (!node.IsLeaf() && NodeArea(node) > bestArea) {
+                    bestArea = NodeArea(node);
+                    best = i;
+                }
+            }
+            if (best < 0) break;
+
+            const uint32_t opened = slots[best];
+            slots[best] = nodes[opened].leftFirst;
+            slots[slotCount++] = nodes[opened].leftFirst + 1;
+        }
+
+        const uint32_t wideIndex = (uint32_t)wideNodes.size();
+        wideNodes.emplace_back();
+        {
+            Bvh8Node& wide = wideNodes[wideIndex];
+            for (int i = 0; i < BVH8_WIDTH; ++i) {
+                for (int axis = 0; axis < 3; ++axis) {
+                    wide.bounds[axis][i]     =  INFINITY;
+                    wide.bounds[axis + 3][i] = -INFINITY;
+                }
+                wide.child[i] = 0;
+                wide.primCount[i] = 0;
+            }
+        }
+
+        for (int i = 0; i < slotCount; ++i) {
+            const BvhNode& node = nodes[slots[i]];
+            const uint32_t child = node.IsLeaf() ? node.leftFirst : Collapse(slots[i]);
+
+            // Collapse() may have reallocated wideNodes
+            Bvh8Node& wide = wideNodes[wideIndex];
+            for (int axis = 0; axis < 3; ++axis) {
+                wide.bounds[axis][i]     = node.boundsMin[axis];
+                wide.bounds[axis + 3][i] = node.boundsMax[axis];
+            }
+            wide.child[i] = child;
+            wide.primCount[i] = node.IsLeaf() ? node.primCount : 0;
+        }
+        return wideIndex;
+    }
+};
+
+uint32_t AppendBvh8(const BvhNode* nodes, uint32_t root, std::vector<Bvh8Node>& wideNodes)
+{
+    Bvh8Collapser collapser{ nodes, wideNodes };
+    return collapser.Collapse(root);
+}
+
+Bvh8Ray MakeBvh8Ray(const glm::vec3& origin, const glm::vec3& direction)
+{
+    Bvh8Ray ray;
+    for (int axis = 0; axis < 3; ++axis) {
+        ray.origin[axis] = origin[axis];
+        ray.invDir[axis] = 1.0f / direction[axis];
+        ray.nearPlane[axis] = std::signbit(ray.invDir[axis]) ? axis + 3 : axis;
+        ray.farPlane[axis]  = std::signbit(ray.invDir[axis]) ? axis : axis + 3;
+    }
+    return ray;
+}
+
+// At most eight entries, insertion sort beats anything fancier
+static void SortHitsFarthestFirst(Bvh8Hit* hits, int count)
+{
+    for (int i = 1; i < count; ++i) {
+        Bvh8Hit hit = hits[i];
+        int j = i - 1;
+        while (j >= 0 && hits[j].dist < hit.dist) {
+            hits[j + 1] = hits[j];
+            --j;
+        }
+        hits[j + 1] = hit;
+    }
+}
+
+static int IntersectBvh8Scalar(const Bvh8Node& node, const Bvh8Ray& ray, float maxDist, Bvh8Hit* hits)
+{
+    int count = 0;
+    for (int i = 0; i < BVH8_WIDTH; ++i) {
+        float entry = 0.0f, exit = maxDist;
+        for (int axis = 0; axis < 3; ++axis) {
+            float tNear = (node.bounds[ray.nearPlane[axis]][i] - ray.origin[axis]) * ray.invDir[axis];
+            float tFar  = (node.bounds[ray.farPlane[axis]][i]  - ray.origin[axis]) * ray.invDir[axis];
+            entry = std::max(entry, tNear);
+            exit  = std::min(exit, tFar);
+        }
+        if (entry <= exit) hits[count++] = { entry, (uint32_t)i };
+    }
+    SortHitsFarthestFirst(hits, count);
+    return count;
+}
+
+#if BVH8_X86_KERNELS
+
+// Slab test of all eight slots; NaN lanes (0 * inf) keep the running entry/exit like the scalar kernel
+__attribute__((target("avx2")))
+static inline void Bvh8Slabs(const Bvh8Node& node, const Bvh8Ray& ray, float maxDist, __m256& entry, __m256& exit)
+{
+    entry = _mm256_setzero_ps();
+    exit  = _mm256_set1_ps(maxDist);
+    for (int axis = 0; axis < 3; ++axis) {
+        const __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+        const __m256 invDir = _mm256_set1_ps(ray.invDir[axis]);
+        const __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearPlane[axis]]), origin), invDir);
+        const __m256 tFar  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.farPlane[axis]]),  origin), invDir);
+        entry = _mm256_max_ps(tNear, entry);
+        exit  = _mm256_min_ps(tFar, exit);
+    }
+}
+
+__attribute__((target("avx2")))
+static int IntersectBvh8Avx2(const Bvh8Node& node, const Bvh8Ray& ray, float maxDist, Bvh8Hit* hits)
+{
+    __m256 entry, exit;
+    Bvh8Slabs(node, ray, maxDist, entry, exit);
+
+    unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+    alignas(32) float dist[BVH8_WIDTH];
+    _mm256_store_ps(dist, entry);
+    _mm256_zeroupper();     // the rest of the tracer is SSE code; GCC omits this for target() functions
+
+    int count = 0;
+    while (mask) {
+        const uint32_t slot = (uint32_t)__builtin_ctz(mask);
+        mask &= mask - 1;
+        hits[count++] = { dist[slot], slot };
+    }
+    SortHitsFarthestFirst(hits, count);
+    return count;
+}
+
+__attribute__((target("avx2,avx512f,avx512vl")))
+static int IntersectBvh8Avx512(const Bvh8Node& node, const Bvh8Ray& ray, float maxDist, Bvh8Hit* hits)
+{
+    __m256 entry, exit;
+    Bvh8Slabs(node, ray, maxDist, entry, exit);
+
+    // Compress the hit lanes to the front instead of walking the mask bit by bit
+    const __mmask8 mask = _mm256_cmp_ps_mask(entry, exit, _CMP_LE_OQ);
+    alignas(32) float    dist[BVH8_WIDTH];
+    alignas(32) uint32_t slot[BVH8_WIDTH];
+    _mm256_store_ps(dist, _mm256_maskz_compress_ps(mask, entry));
+    _mm256_store_si256((__m256i*)slot, _mm256_maskz_compress_epi32(mask, _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    _mm256_zeroupper();
+
+    const int count = __builtin_popcount(mask);
+    for (int i = 0; i < count; ++i) hits[i] = { dist[i], slot[i] };
+    SortHitsFarthestFirst(hits, count);
+    return count;
+}
+
+#endif
+
+SimdLevel DetectSimdLevel()
+{
+#if BVH8_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::Avx512: return "AVX-512";
+        case SimdLevel::Avx2:   return "AVX2";
+        default:                return "scalar";
+    }
+}
+
+Bvh8IntersectFn Bvh8IntersectFor(SimdLevel level)
+{
+    level = std::min(level, DetectSimdLevel());
+#if BVH8_X86_KERNELS
+    if (level == SimdLevel::Avx512) return IntersectBvh8Avx512;
+    if (level == SimdLevel::Avx2)   return IntersectBvh8Avx2;
+#endif
+    return IntersectBvh8Scalar;
+}
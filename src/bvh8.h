@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+// 8-wide BVH for the CPU tracer, collapsed from a binary BvhNode tree.
+// Child bounds are stored SoA so one node tests all eight children with a
+// single pass of 8-lane SIMD; a node is exactly four cache lines.
+struct alignas(64) Bvh8Node {
+    float    bounds[6][8];          // minX, minY, minZ, maxX, maxY, maxZ per child slot
+    uint32_t child[8];              // interior child: Bvh8Node index, leaf child: first primitive
+    uint32_t primCount[8];          // > 0 for leaf children, 0 for interior children and empty slots
+};
+static_assert(sizeof(Bvh8Node) == 256, "Bvh8Node must stay four cache lines");
+
+// Collapses the binary subtree under nodes[root] into wideNodes and returns the
+// index of its wide root. Leaf children keep the primitive ranges of the binary
+// leaves, so primitives reordered for the binary tree stay valid. Empty slots
+// get inverted infinite bounds and are never hit.
+uint32_t AppendBvh8(const BvhNode* nodes, uint32_t root, std::vector<Bvh8Node>& wideNodes);
+
+enum class SimdLevel {
+    Scalar,
+    Avx2,
+    Avx512                          // AVX-512F + VL: compress-stores the hit children
+};
+
+// Best level the running CPU supports
+SimdLevel DetectSimdLevel();
+const char* SimdLevelName(SimdLevel level);
+
+// Ray data shared by every node test of one traversal
+struct Bvh8Ray {
+    float    origin[3];
+    float    invDir[3];
+    int      nearPlane[3];          // bounds row entered first per axis: axis for positive directions, axis + 3 otherwise
+    int      farPlane[3];
+};
+
+Bvh8Ray MakeBvh8Ray(const glm::vec3& origin, const glm::vec3& direction);
+
+struct Bvh8Hit {
+    float    dist;                  // entry distance
+    uint32_t slot;
+};
+
+// Tests all eight children of node, writes the hit ones to hits ordered
+// farthest first (ready to push on a traversal stack) and returns their count.
+using Bvh8IntersectFn = int (*)(const Bvh8Node& node, const Bvh8Ray& ray, float maxDist, Bvh8Hit* hits);
+
+// Kernel for level; levels the CPU or compiler does not support fall back to a lower one
+Bvh8IntersectFn Bvh8IntersectFor(SimdLevel level);
@@ -0,0 +1,1813 @@
+#include "cpuTracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define CPU_TRACER_PACKETS 1
+  #include <immintrin.h>
+#else
+  #define CPU_TRACER_PACKETS 0
+#endif
+
+// Everything below mirrors src/Shaders/computeRayTracing.glsl (and the
+// rayTracingCommon.glsl it includes) function by function. Keep them in sync:
+// the CPU path is the reference for the shader.
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct SurfaceMaterial
+{
+    glm::vec3 baseColor;
+    glm::vec3 emissionColor;
+    float     emissionStrength;
+};
+
+struct HitResult {
+    bool      hit;
+    float     dist;
+    glm::vec3 position;
+    glm::vec3 normal;
+    int       sphere;               // spheres index of a sphere hit, -1 otherwise
+    SurfaceMaterial material;
+};
+
+// Model of a 32 KiB, 8-way set-associative LRU data cache with 64-byte lines. BVH
+// traversal feeds its node fetches through it when cache statistics are on, which
+// shows how well a ray order reuses nodes without needing hardware counters.
+struct NodeCacheModel {
+    static const int LINE_BYTES = 64;
+    static const int SETS = 64;
+    static const int WAYS = 8;
+
+    uintptr_t tags[SETS][WAYS] = {};    // line addresses per set, most recently used first
+    uint64_t  accesses = 0;
+    uint64_t  misses = 0;
+
+    void Touch(const void* data, size_t bytes)
+    {
+        const uintptr_t first = (uintptr_t)data / LINE_BYTES;
+        const uintptr_t last  = ((uintptr_t)data + bytes - 1) / LINE_BYTES;
+        for (uintptr_t line = first; line <= last; ++line) Access(line + 1);    // + 1 keeps 0 free as the empty tag
+    }
+
+    void Access(uintptr_t tag)
+    {
+        uintptr_t* ways = tags[tag % SETS];
+        ++accesses;
+        int way = 0;
+        while (way < WAYS - 1 && ways[way] != tag) ++way;
+        if (ways[way] != tag) ++misses;
+        for (; way > 0; --way) ways[way] = ways[way - 1];
+        ways[0] = tag;
+    }
+};
+
+// Per-tile counters, flushed into the tracer once per tile
+struct TraceCounters {
+    uint64_t rays = 0;
+    uint64_t packetRays = 0;            // part of rays that went through the packet path
+    uint64_t shadowRays = 0;            // part of rays that were next-event estimation shadow rays
+    uint64_t nodeVisits = 0;
+    uint64_t pathEnds[PATH_END_REASONS][PATH_DEPTH_BINS] = {};
+    NodeCacheModel* cache = nullptr;    // set while cache statistics are on
+
+    void TouchNodes(const void* nodes, size_t bytes) { if (cache) cache->Touch(nodes, bytes); }
+    void EndPath(PathEnd reason, int bounce) { ++pathEnds[(int)reason][std::min(bounce, PATH_DEPTH_BINS - 1)]; }
+};
+
+void TraceStats::Add(const TraceCounters& counters)
+{
+    rays.fetch_add(counters.rays, std::memory_order_relaxed);
+    packetRays.fetch_add(counters.packetRays, std::memory_order_relaxed);
+    shadowRays.fetch_add(counters.shadowRays, std::memory_order_relaxed);
+    nodeVisits.fetch_add(counters.nodeVisits, std::memory_order_relaxed);
+    if (counters.cache) {
+        nodeCacheAccesses.fetch_add(counters.cache->accesses, std::memory_order_relaxed);
+        nodeCacheMisses.fetch_add(counters.cache->misses, std::memory_order_relaxed);
+    }
+    for (int reason = 0; reason < PATH_END_REASONS; ++reason)
+        for (int bounce = 0; bounce < PATH_DEPTH_BINS; ++bounce)
+            if (counters.pathEnds[reason][bounce]) pathEnds[reason][bounce].fetch_add(counters.pathEnds[reason][bounce], std::memory_order_relaxed);
+}
+
+void TraceStats::Reset()
+{
+    rays = 0; packetRays = 0; shadowRays = 0; nodeVisits = 0; nodeCacheAccesses = 0; nodeCacheMisses = 0;
+    for (auto& reasonEnds : pathEnds)
+        for (auto& ends : reasonEnds) ends = 0;
+}
+
+const int   BVH_STACK_SIZE = BVH_MAX_DEPTH + 1;     // Enough for any tree the builders emit
+const int   BVH8_STACK_SIZE = 8 * BVH_STACK_SIZE;
+const float BVH_MISS = 1e30f;
+
+static HitResult RaySphereIntersection(const Ray& ray, const glm::vec3& sphereCenter, float sphereRadius)
+{
+    HitResult hitResult;
+    hitResult.hit = false;
+
+    glm::vec3 offsetRayOrigin = ray.origin - sphereCenter;
+
+    float a = glm::dot(ray.direction, ray.direction);
+    float b = 2.0f * glm::dot(offsetRayOrigin, ray.direction);
+    float c = glm::dot(offsetRayOrigin, offsetRayOrigin) - sphereRadius * sphereRadius;
+
+    float discriminant = b * b - 4.0f * a * c;
+
+    if (discriminant >= 0.0f)
+    {
+        float dist = (-b - std::sqrt(discriminant)) / (2.0f * a);
+
+        if (dist > 0.0f)
+        {
+            hitResult.hit = true;
+            hitResult.dist = dist;
+            hitResult.position = ray.origin + ray.direction * dist;
+            hitResult.normal = glm::normalize(hitResult.position - sphereCenter);
+        }
+    }
+
+    return hitResult;
+}
+
+// Moller-Trumbore, two-sided so meshes work regardless of winding
+static HitResult RayTriangleIntersection(const Ray& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+{
+    HitResult hitResult;
+    hitResult.hit = false;
+
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+    glm::vec3 pvec = glm::cross(ray.direction, edge2);
+    float det = glm::dot(edge1, pvec);
+    if (std::abs(det) < 1e-8f) return hitResult;
+
+    float invDet = 1.0f / det;
+    glm::vec3 tvec = ray.origin - v0;
+    float u = glm::dot(tvec, pvec) * invDet;
+    if (u < 0.0f || u > 1.0f) return hitResult;
+
+    glm::vec3 qvec = glm::cross(tvec, edge1);
+    float v = glm::dot(ray.direction, qvec) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return hitResult;
+
+    float dist = glm::dot(edge2, qvec) * invDet;
+    if (dist > 0.0f)
+    {
+        glm::vec3 normal = glm::normalize(glm::cross(edge1, edge2));
+        hitResult.hit = true;
+        hitResult.dist = dist;
+        hitResult.position = ray.origin + ray.direction * dist;
+        hitResult.normal = glm::dot(normal, ray.direction) > 0.0f ? -normal : normal;
+    }
+
+    return hitResult;
+}
+
+// Slab test; returns the entry distance or BVH_MISS when the box is missed or farther than maxDist
+static float RayAabbDistance(const Ray& ray, const glm::vec3& invDir, const BvhNode& node, float maxDist)
+{
+    glm::vec3 t0 = (node.boundsMin - ray.origin) * invDir;
+    glm::vec3 t1 = (node.boundsMax - ray.origin) * invDir;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar  = glm::max(t0, t1);
+    float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit  = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDist));
+    return entry <= exit ? entry : BVH_MISS;
+}
+
+// Stack-based traversal from nodes[root], nearer child first. leafFn(node, hitResult)
+// intersects the primitives of a leaf and shrinks hitResult.dist on closer hits.
+template <typename LeafFn>
+static void TraverseBvh(const BvhNode* nodes, uint32_t root, const Ray& ray, HitResult& hitResult, TraceCounters& counters, LeafFn&& leafFn)
+{
+    const glm::vec3 invDir = 1.0f / ray.direction;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    counters.TouchNodes(&nodes[root], sizeof(BvhNode));
+    if (RayAabbDistance(ray, invDir, nodes[root], hitResult.dist) < BVH_MISS) stack[stackSize++] = root;
+
+    while (stackSize > 0) {
+        const BvhNode& node = nodes[stack[--stackSize]];
+        ++counters.nodeVisits;
+
+        if (node.IsLeaf()) {
+            leafFn(node, hitResult);
+            continue;
+        }
+
+        counters.TouchNodes(&nodes[node.leftFirst], 2 * sizeof(BvhNode));
+        float distNear = RayAabbDistance(ray, invDir, nodes[node.leftFirst], hitResult.dist);
+        float distFar  = RayAabbDistance(ray, invDir, nodes[node.leftFirst + 1], hitResult.dist);
+        uint32_t nearChild = node.leftFirst, farChild = node.leftFirst + 1;
+        if (distFar < distNear) {
+            std::swap(distNear, distFar);
+            std::swap(nearChild, farChild);
+        }
+        if (distFar  < BVH_MISS) stack[stackSize++] = farChild;
+        if (distNear < BVH_MISS) stack[stackSize++] = nearChild;
+    }
+}
+
+// Same contract as TraverseBvh over a collapsed 8-wide tree. Hit children are pushed
+// farthest first with their entry distance, leaves included, and skipped on pop once
+// a closer hit was found. Not part of the shader; visit order differs from the binary walk.
+template <typename LeafFn>
+static void TraverseBvh8(const Bvh8Node* nodes, uint32_t root, Bvh8IntersectFn intersect8, const Ray& ray, HitResult& hitResult, TraceCounters& counters, LeafFn&& leafFn)
+{
+    struct StackEntry {
+        float    dist;
+        uint32_t child;
+        uint32_t primCount;             // > 0 for leaves
+    };
+
+    const Bvh8Ray wideRay = MakeBvh8Ray(ray.origin, ray.direction);
+
+    StackEntry stack[BVH8_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = { 0.0f, root, 0 };
+
+    while (stackSize > 0) {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.dist >= hitResult.dist) continue;
+
+        if (entry.primCount > 0) {
+            BvhNode leaf = {};
+            leaf.leftFirst = entry.child;
+            leaf.primCount = entry.primCount;
+            leafFn(leaf, hitResult);
+            continue;
+        }
+
+        const Bvh8Node& node = nodes[entry.child];
+        ++counters.nodeVisits;
+        counters.TouchNodes(&node, sizeof(Bvh8Node));
+
+        Bvh8Hit hits[8];
+        const int hitCount = intersect8(node, wideRay, hitResult.dist, hits);
+        for (int i = 0; i < hitCount; ++i)
+            stack[stackSize++] = { hits[i].dist, node.child[hits[i].slot], node.primCount[hits[i].slot] };
+    }
+}
+
+// Hit of ray with spheres[sphereIndex], material filled in; hit is false on a miss
+static HitResult SphereHit(const Scene& scene, const Ray& ray, uint32_t sphereIndex)
+{
+    const Sphere& sphere = scene.spheres[sphereIndex];
+    HitResult hit = RaySphereIntersection(ray, glm::vec3(sphere.positionRadius), sphere.positionRadius.w);
+    hit.sphere = (int)sphereIndex;
+    hit.material.baseColor = glm::vec3(sphere.baseColor);
+    hit.material.emissionColor = glm::vec3(sphere.emissionColorStrength);
+    hit.material.emissionStrength = sphere.emissionColorStrength.w;
+    return hit;
+}
+
+// Unnormalized object-space ray, so hit distances stay comparable with world space
+static Ray ObjectRay(const TlasInstance& instance, const Ray& ray)
+{
+    Ray objectRay;
+    objectRay.origin = glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.0f));
+    objectRay.direction = glm::vec3(instance.worldToObject * glm::vec4(ray.direction, 0.0f));
+    return objectRay;
+}
+
+// Object-space hit of objectRay with triangles[t]; the material comes from the instance
+static HitResult TriangleHit(const Scene& scene, const Ray& objectRay, uint32_t t)
+{
+    const Triangle& tri = scene.triangles[t];
+    HitResult hit = RayTriangleIntersection(objectRay, glm::vec3(tri.v0), glm::vec3(tri.v1), glm::vec3(tri.v2));
+    hit.sphere = -1;
+    return hit;
+}
+
+// Brings the closest hit found inside an instance back to world space and gives it
+// the instance's material
+static void InstanceHitToWorld(const Scene& scene, const TlasInstance& instance, const Ray& ray, HitResult& hit)
+{
+    hit.position = ray.origin + ray.direction * hit.dist;
+    hit.normal = glm::normalize(glm::transpose(glm::mat3(instance.worldToObject)) * hit.normal);
+    hit.material.baseColor = glm::vec3(scene.meshBaseColor) * glm::vec3(instance.baseColor);
+    hit.material.emissionColor = glm::vec3(instance.emissionColorStrength);
+    hit.material.emissionStrength = instance.emissionColorStrength.w;
+}
+
+static HitResult NoHit()
+{
+    HitResult hitResult;
+    hitResult.hit = false;
+    hitResult.dist = 1e10f;
+    hitResult.position = glm::vec3(0.0f);
+    hitResult.normal = glm::vec3(0.0f);
+    hitResult.sphere = -1;
+    hitResult.material.baseColor = glm::vec3(0.0f);
+    hitResult.material.emissionColor = glm::vec3(0.0f);
+    hitResult.material.emissionStrength = 0.0f;
+    return hitResult;
+}
+
+// Closest hit nearer than maxDist. Uses the 8-wide copies of the scene BVHs when they
+// were built, the binary trees otherwise.
+static HitResult CalculateRayCollision(const Scene& scene, const Ray& ray, Bvh8IntersectFn intersect8, TraceCounters& counters, float maxDist = 1e10f)
+{
+    ++counters.rays;
+
+    // Find closest sphere or triangle hit
+    HitResult hitResult = NoHit();
+    hitResult.dist = maxDist;
+
+    auto sphereLeaf = [&](const BvhNode& leaf, HitResult& closest) {
+        for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.primCount; ++k) {
+            HitResult hit = SphereHit(scene, ray, scene.sphereBvh.primIndices[k]);
+            if (hit.hit && hit.dist < closest.dist && hit.dist > 0.001f) closest = hit;  // Avoid self-intersection
+        }
+    };
+
+    if (!scene.sphereBvh8.empty())      TraverseBvh8(scene.sphereBvh8.data(), 0, intersect8, ray, hitResult, counters, sphereLeaf);
+    else if (!scene.sphereBvh.Empty())  TraverseBvh(scene.sphereBvh.nodes.data(), 0, ray, hitResult, counters, sphereLeaf);
+
+    auto instanceLeaf = [&](const BvhNode& leaf, HitResult& closest) {
+        for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.primCount; ++k) {
+            const TlasInstance& instance = scene.tlasInstances[k];
+            const Ray objectRay = ObjectRay(instance, ray);
+
+            auto triangleLeaf = [&](const BvhNode& blasLeaf, HitResult& blasClosest) {
+                for (uint32_t t = blasLeaf.leftFirst; t < blasLeaf.leftFirst + blasLeaf.primCount; ++t) {
+                    HitResult hit = TriangleHit(scene, objectRay, t);
+                    if (hit.hit && hit.dist < blasClosest.dist && hit.dist > 0.001f) blasClosest = hit;
+                }
+            };
+
+            const float closestDist = closest.dist;
+            if (!scene.tlasInstanceRoots8.empty()) TraverseBvh8(scene.blasNodes8.data(), scene.tlasInstanceRoots8[k], intersect8, objectRay, closest, counters, triangleLeaf);
+            else                                   TraverseBvh(scene.blasNodes.data(), instance.blasRoot, objectRay, closest, counters, triangleLeaf);
+
+            if (closest.dist < closestDist) InstanceHitToWorld(scene, instance, ray, closest);
+        }
+    };
+
+    if (!scene.tlas8.empty())      TraverseBvh8(scene.tlas8.data(), 0, intersect8, ray, hitResult, counters, instanceLeaf);
+    else if (!scene.tlas.Empty())  TraverseBvh(scene.tlas.nodes.data(), 0, ray, hitResult, counters, instanceLeaf);
+
+    return hitResult;
+}
+
+static bool Occluded(const Scene& scene, const Ray& ray, float maxDist, Bvh8IntersectFn intersect8, TraceCounters& counters)
+{
+    ++counters.shadowRays;
+    return CalculateRayCollision(scene, ray, intersect8, counters, maxDist).hit;
+}
+
+// 1 - cos of the half angle of the cone from origin around a sphere, without the
+// cancellation of the direct form for small or distant spheres; 0 from inside
+static float SphereConeOneMinusCos(const glm::vec3& origin, const glm::vec4& positionRadius)
+{
+    glm::vec3 toCenter = glm::vec3(positionRadius) - origin;
+    float distSquared = glm::dot(toCenter, toCenter);
+    float radiusSquared = positionRadius.w * positionRadius.w;
+    if (distSquared <= radiusSquared) return 0.0f;
+    float sinSquared = radiusSquared / distSquared;
+    return sinSquared / (1.0f + std::sqrt(1.0f - sinSquared));
+}
+
+// Power heuristic weight of a sample from the technique with pdf > 0, against one other technique
+static float PowerHeuristic(float pdf, float otherPdf)
+{
+    float ratio = otherPdf / pdf;
+    return 1.0f / (1.0f + ratio * ratio);
+}
+
+// Estimate of the light a light BVH node sends to a surface at origin: its power over the
+// squared distance, times the cosine at the surface towards the node's bounding sphere
+static float LightBvhImportance(const LightBvhNode& node, const glm::vec3& origin, const glm::vec3& normal)
+{
+    glm::vec3 halfExtent = 0.5f * (node.boundsMax - node.boundsMin);
+    glm::vec3 toCenter = 0.5f * (node.boundsMin + node.boundsMax) - origin;
+    float radiusSquared = glm::dot(halfExtent, halfExtent);
+    float distSquared = glm::dot(toCenter, toCenter);
+    if (distSquared <= radiusSquared) return node.power / radiusSquared;    // origin inside the bounds
+
+    // cos(max(0, angle to center - bounding half angle)), without trigonometric functions
+    float cosCenter = glm::dot(normal, toCenter) / std::sqrt(distSquared);
+    float sinBoundSquared = radiusSquared / distSquared;
+    float cosBound = std::sqrt(1.0f - sinBoundSquared);
+    float cosSurface = 1.0f;
+    if (cosCenter < cosBound) {
+        float sinCenter = std::sqrt(std::max(0.0f, 1.0f - cosCenter * cosCenter));
+        cosSurface = cosCenter * cosBound + sinCenter * std::sqrt(sinBoundSquared);
+    }
+    return cosSurface > 0.0f ? node.power * cosSurface / distSquared : 0.0f;
+}
+
+// Chance that light selection goes to left rather than its sibling left + 1; -1 when neither can light origin
+static float LightBvhLeftProbability(const Scene& scene, uint32_t left, const glm::vec3& origin, const glm::vec3& normal)
+{
+    float importanceLeft = LightBvhImportance(scene.lightBvh[left], origin, normal);
+    float importanceRight = LightBvhImportance(scene.lightBvh[left + 1], origin, normal);
+    float importance = importanceLeft + importanceRight;
+    return importance > 0.0f ? importanceLeft / importance : -1.0f;
+}
+
+// Walks the light BVH by importance, rescaling u at every node; -1 when no light can be seen from origin
+static int SampleLightBvh(const Scene& scene, const glm::vec3& origin, const glm::vec3& normal, float u, float& pmf)
+{
+    pmf = 1.0f;
+    uint32_t child = scene.lightBvh[0].child;
+    while ((child & LIGHT_BVH_LEAF) == 0) {
+        float leftProbability = LightBvhLeftProbability(scene, child, origin, normal);
+        if (leftProbability < 0.0f) return -1;
+        if (u < leftProbability) {
+            u = std::min(u / leftProbability, 0.99999994f);
+            pmf *= leftProbability;
+        } else {
+            u = std::min((u - leftProbability) / (1.0f - leftProbability), 0.99999994f);
+            pmf *= 1.0f - leftProbability;
+            child += 1;
+        }
+        child = scene.lightBvh[child].child;
+    }
+    return (int)(child & ~LIGHT_BVH_LEAF);
+}
+
+// The pmf SampleLightBvh() picks lights[light] with, by following its trail
+static float LightBvhPmf(const Scene& scene, const glm::vec3& origin, const glm::vec3& normal, uint32_t light)
+{
+    float pmf = 1.0f;
+    uint32_t child = scene.lightBvh[0].child;
+    uint32_t trail = scene.lights[light].bvhTrail;
+    while ((child & LIGHT_BVH_LEAF) == 0) {
+        float leftProbability = LightBvhLeftProbability(scene, child, origin, normal);
+        if (leftProbability < 0.0f) return 0.0f;
+        if ((trail & 1u) == 0) {
+            pmf *= leftProbability;
+        } else {
+            pmf *= 1.0f - leftProbability;
+            child += 1;
+        }
+        child = scene.lightBvh[child].child;
+        trail >>= 1;
+    }
+    return pmf;
+}
+
+// Chance that light selection at a surface at origin picks lights[light]
+static float LightSelectionPmf(const Scene& scene, const TraceSettings& settings, const glm::vec3& origin, const glm::vec3& normal, uint32_t light)
+{
+    if (settings.lightSampler == LightSampler::Power) return scene.lights[light].pmf;
+    if (settings.lightSampler == LightSampler::Bvh) return LightBvhPmf(scene, origin, normal, light);
+    return 1.0f / (float)scene.lights.size();
+}
+
+// Solid angle pdf of SampleLight() at a surface at origin producing the direction to spheres[sphere]
+static float LightPdf(const Scene& scene, const TraceSettings& settings, const glm::vec3& origin, const glm::vec3& normal, int sphere)
+{
+    if (!settings.nextEventEstimation || scene.lights.empty() || sphere < 0 || scene.sphereLights[sphere] < 0) return 0.0f;
+    float oneMinusCos = SphereConeOneMinusCos(origin, scene.spheres[sphere].positionRadius);
+    if (oneMinusCos <= 0.0f) return 0.0f;
+    return LightSelectionPmf(scene, settings, origin, normal, (uint32_t)scene.sphereLights[sphere]) / (2.0f * PI * oneMinusCos);
+}
+
+// MIS weight of emission found by a bounce direction drawn with bsdfPdf from the surface
+// at origin; camera rays pass 0 and count fully
+static float EmissionWeight(const Scene& scene, const TraceSettings& settings, float bsdfPdf, const glm::vec3& origin, const glm::vec3& normal, int sphere)
+{
+    return bsdfPdf > 0.0f ? PowerHeuristic(bsdfPdf, LightPdf(scene, settings, origin, normal, sphere)) : 1.0f;
+}
+
+// A direction SampleLight() draws towards a light, before it is weighted
+struct LightPoint {
+    int       sphere;               // spheres[] index of the light
+    glm::vec3 direction;            // from origin
+    float     dist;                 // to the sphere's surface along direction
+    float     pdf;                  // solid angle pdf of direction, light selection included
+    float     cosSurface;           // between direction and the surface normal, > 0
+};
+
+// Picks a light by settings.lightSampler with uPick and a direction uniformly in the cone
+// it subtends with u. Only call with lights in the scene; false when the sample cannot contribute.
+static bool SampleLightPoint(const Scene& scene, const TraceSettings& settings, const glm::vec3& origin, const glm::vec3& normal,
+                             const glm::vec2& u, const glm::vec2& uPick, LightPoint& lightPoint)
+{
+    const uint32_t numLights = (uint32_t)scene.lights.size();
+    uint32_t light;
+    float selectionPmf;
+    if (settings.lightSampler == LightSampler::Power) {
+        light = std::min((uint32_t)(uPick.x * (float)numLights), numLights - 1);
+        if (uPick.y >= scene.lights[light].aliasThreshold) light = scene.lights[light].alias;
+        selectionPmf = scene.lights[light].pmf;
+    } else if (settings.lightSampler == LightSampler::Bvh) {
+        int picked = SampleLightBvh(scene, origin, normal, uPick.x, selectionPmf);
+        if (picked < 0) return false;
+        light = (uint32_t)picked;
+    } else {
+        light = std::min((uint32_t)(uPick.x * (float)numLights), numLights - 1);
+        selectionPmf = 1.0f / (float)numLights;
+    }
+
+    const glm::vec4& positionRadius = scene.spheres[scene.lights[light].sphere].positionRadius;
+    float oneMinusCos = SphereConeOneMinusCos(origin, positionRadius);
+    if (oneMinusCos <= 0.0f) return false;
+
+    glm::vec3 direction = SampleCone(glm::normalize(glm::vec3(positionRadius) - origin), oneMinusCos, u);
+    float cosSurface = glm::dot(normal, direction);
+    if (cosSurface <= 0.0f) return false;
+
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    HitResult lightHit = RaySphereIntersection(ray, glm::vec3(positionRadius), positionRadius.w);
+    if (!lightHit.hit) return false;            // grazed the rim
+
+    lightPoint.sphere = (int)scene.lights[light].sphere;
+    lightPoint.direction = direction;
+    lightPoint.dist = lightHit.dist;
+    lightPoint.pdf = selectionPmf / (2.0f * PI * oneMinusCos);
+    lightPoint.cosSurface = cosSurface;
+    return true;
+}
+
+struct LightSample {
+    Ray       shadowRay;
+    float     maxDist;              // just short of the light
+    glm::vec3 radianceScale;        // emitted * cos / (PI * pdf) * MIS weight
+};
+
+// SampleLightPoint() as a shadow ray and the light it brings, MIS-weighted against the bounce direction
+static bool SampleLight(const Scene& scene, const TraceSettings& settings, const glm::vec3& origin, const glm::vec3& normal,
+                        const glm::vec2& u, const glm::vec2& uPick, LightSample& lightSample)
+{
+    LightPoint lightPoint;
+    if (!SampleLightPoint(scene, settings, origin, normal, u, uPick, lightPoint)) return false;
+
+    lightSample.shadowRay.origin = origin;
+    lightSample.shadowRay.direction = lightPoint.direction;
+    lightSample.maxDist = lightPoint.dist * 0.999f;
+
+    float bsdfPdf = lightPoint.cosSurface / PI;
+    const glm::vec4& emission = scene.spheres[lightPoint.sphere].emissionColorStrength;
+    glm::vec3 emittedLight = glm::vec3(emission) * emission.w;
+    lightSample.radianceScale = emittedLight * (bsdfPdf / lightPoint.pdf * PowerHeuristic(lightPoint.pdf, bsdfPdf));
+    return true;
+}
+
+// Whether the path sampling takes light samples at all; only paths that get a next
+// bounce do, the light sample stands in for it
+static bool TakesLightSample(const Scene& scene, const TraceSettings& settings)
+{
+    return settings.nextEventEstimation && !scene.lights.empty();
+}
+
+// Russian roulette at a bounce that is not the last, after rayColor took the surface's
+// base color. From rouletteMinDepth on, the path goes on with its largest rayColor
+// component as probability and is divided by it, so the estimate stays unbiased; paths
+// without throughput end at any depth. False when the path ends here.
+static bool SurvivesRoulette(const TraceSettings& settings, const SampleIndex& index, int bounce, glm::vec3& rayColor, uint32_t& state)
+{
+    const float survival = std::min(std::max(std::max(rayColor.r, rayColor.g), rayColor.b), 1.0f);
+    if (survival <= 0.0f) return false;
+    if (bounce < settings.rouletteMinDepth || survival >= 1.0f) return true;
+    if (SampleSquare(settings.hemisphereSampler, index, ROULETTE_DIMENSION + bounce, state).x >= survival) return false;
+    rayColor /= survival;
+    return true;
+}
+
+// ReSTIR DI, mirroring src/Shaders/restirCommon.glsl: every pixel keeps a reservoir of
+// one light sample for its camera ray hit standing for M candidates
+
+const float RESTIR_HISTORY_LIMIT  = 20.0f;  // last frame's M is capped at this many times restirCandidates
+const float RESTIR_SPATIAL_RADIUS = 30.0f;  // pixels
+const int   RESTIR_MAX_SPATIAL_SAMPLES = 16;
+
+// Whether the tracers shade camera ray hits with the reservoirs; the restir uniform
+static bool RestirEnabled(const Scene& scene, const TraceSettings& settings)
+{
+    return settings.restir && settings.nextEventEstimation && !scene.lights.empty();
+}
+
+static Reservoir EmptyReservoir(const glm::vec3& origin, const glm::vec3& normal)
+{
+    Reservoir reservoir;
+    reservoir.origin = origin;
+    reservoir.normal = normal;
+    return reservoir;
+}
+
+// cos at the light over the squared distance of lightPoint on spheres[sphere] seen from
+// origin: turns solid angle at origin into area on the light. 0 for the far side.
+static float LightAreaFactor(const Scene& scene, const glm::vec3& origin, int sphere, const glm::vec3& lightPoint)
+{
+    const glm::vec3 toLight = lightPoint - origin;
+    const float distSquared = glm::dot(toLight, toLight);
+    const float cosLight = -glm::dot(glm::normalize(lightPoint - glm::vec3(scene.spheres[sphere].positionRadius)), toLight) / std::sqrt(distSquared);
+    return cosLight > 0.0f ? cosLight / distSquared : 0.0f;
+}
+
+// Target function of the resampling: luminance of the unshadowed light from lightPoint
+// reaching the surface (origin, normal), per unit area of the light
+static float RestirTarget(const Scene& scene, const glm::vec3& origin, const glm::vec3& normal, int sphere, const glm::vec3& lightPoint)
+{
+    if (sphere < 0) return 0.0f;
+    const float cosSurface = glm::dot(normal, glm::normalize(lightPoint - origin));
+    if (cosSurface <= 0.0f) return 0.0f;
+    const glm::vec4& emission = scene.spheres[sphere].emissionColorStrength;
+    const float luminance = 0.2126f * emission.r + 0.7152f * emission.g + 0.0722f * emission.b;
+    return luminance * emission.w * cosSurface * LightAreaFactor(scene, origin, sphere, lightPoint);
+}
+
+// Whether candidates of r's surface can stand in for the surface (origin, normal) at the
+// given distance from the camera: similar normals and close to the same plane
+static bool RestirSimilar(const Reservoir& r, const glm::vec3& origin, const glm::vec3& normal, float depth)
+{
+    return glm::dot(r.normal, normal) > 0.9f && std::abs(glm::dot(r.origin - origin, normal)) < 0.05f * depth;
+}
+
+// One step of resampling reservoirs into merged at merged's surface; u picks the sample.
+// True when r's sample was taken.
+static bool RestirStream(const Scene& scene, Reservoir& merged, float& weightSum, const Reservoir& r, float u)
+{
+    const float weight = RestirTarget(scene, merged.origin, merged.normal, r.sphere, r.lightPoint) * r.W * r.M;
+    weightSum += weight;
+    merged.M += r.M;
+    if (u * weightSum < weight) {
+        merged.lightPoint = r.lightPoint;
+        merged.sphere = r.sphere;
+        return true;
+    }
+    return false;
+}
+
+// Target of merged's sample at the surface of an input r; the balance-heuristic MIS weight
+// of the sample is this for the input it came from over the sum of this times M over all inputs
+static float RestirInputTarget(const Scene& scene, const Reservoir& r, const Reservoir& merged)
+{
+    return RestirTarget(scene, r.origin, r.normal, merged.sphere, merged.lightPoint);
+}
+
+static void RestirFinish(const Scene& scene, Reservoir& merged, float weightSum, float misWeight)
+{
+    const float target = RestirTarget(scene, merged.origin, merged.normal, merged.sphere, merged.lightPoint);
+    merged.W = target > 0.0f ? weightSum * misWeight / target : 0.0f;
+}
+
+// The reservoir's sample as a shadow ray and the light it brings, like SampleLight() but
+// not MIS-weighted: the bounce leaving the camera ray hit does not count the lights it finds
+static bool RestirLightSample(const Scene& scene, const Reservoir& r, LightSample& lightSample)
+{
+    if (r.sphere < 0 || r.W <= 0.0f) return false;
+    const glm::vec3 toLight = r.lightPoint - r.origin;
+    const float dist = glm::length(toLight);
+    lightSample.shadowRay.origin = r.origin;
+    lightSample.shadowRay.direction = toLight / dist;
+    lightSample.maxDist = dist * 0.999f;
+
+    const float cosSurface = glm::dot(r.normal, lightSample.shadowRay.direction);
+    const float areaFactor = LightAreaFactor(scene, r.origin, r.sphere, r.lightPoint);
+    if (cosSurface <= 0.0f || areaFactor <= 0.0f) return false;
+    const glm::vec4& emission = scene.spheres[r.sphere].emissionColorStrength;
+    lightSample.radianceScale = glm::vec3(emission) * emission.w * (cosSurface * areaFactor / PI * r.W);
+    return true;
+}
+
+// Body of the bounce loop of the shader's Trace(): accumulates the light of hitResult,
+// including its light sample, and turns ray into the next bounce, drawn with pdf
+// bsdfPdf from the surface with the given normal. Returns false once the path ends,
+// which it counts in counters.
+// With reservoirs the camera ray hit takes its light sample from reservoirs[index.pixel].
+static bool ShadeBounce(const Scene& scene, const TraceSettings& settings, const Reservoir* reservoirs, const SampleIndex& index, int bounce, const HitResult& hitResult,
+                        Ray& ray, float& bsdfPdf, glm::vec3& normal, uint32_t& state, glm::vec3& incomingLight, glm::vec3& rayColor, Bvh8IntersectFn intersect8, TraceCounters& counters)
+{
+    if (hitResult.hit)
+    {
+        SurfaceMaterial material = hitResult.material;
+        glm::vec3 emittedLight = material.emissionColor * material.emissionStrength;
+        // With ReSTIR the camera ray hit's light sample stands for all of its direct light from
+        // the spheres; emissive meshes are never sampled and count fully
+        const float emissionWeight = reservoirs && bounce == 1 && hitResult.sphere >= 0 ? 0.0f : EmissionWeight(scene, settings, bsdfPdf, ray.origin, normal, hitResult.sphere);
+        incomingLight += emittedLight * rayColor * emissionWeight;
+        rayColor *= material.baseColor;
+
+        if (bounce + 1 >= settings.maxTraceBounces || !SurvivesRoulette(settings, index, bounce, rayColor, state)) {
+            counters.EndPath(bounce + 1 < settings.maxTraceBounces ? PathEnd::Roulette : PathEnd::BounceLimit, bounce);
+            return false;
+        }
+
+        glm::vec3 origin = hitResult.position + hitResult.normal * 0.01f;  // Offset to avoid self-intersection
+        if (TakesLightSample(scene, settings)) {
+            LightSample lightSample;
+            bool sampled;
+            if (reservoirs && bounce == 0) {
+                sampled = RestirLightSample(scene, reservoirs[index.pixel], lightSample);
+            } else {
+                const glm::vec2 u = SampleSquare(settings.hemisphereSampler, index, LIGHT_SAMPLE_DIMENSION + bounce, state);
+                const glm::vec2 uPick = SampleSquare(settings.hemisphereSampler, index, LIGHT_PICK_DIMENSION + bounce, state);
+                sampled = SampleLight(scene, settings, origin, hitResult.normal, u, uPick, lightSample);
+            }
+            if (sampled && !Occluded(scene, lightSample.shadowRay, lightSample.maxDist, intersect8, counters))
+                incomingLight += rayColor * lightSample.radianceScale;
+        }
+
+        ray.origin = origin;
+        ray.direction = SampleCosineHemisphere(hitResult.normal, SampleSquare(settings.hemisphereSampler, index, bounce, state));
+        bsdfPdf = glm::dot(hitResult.normal, ray.direction) / PI;
+        normal = hitResult.normal;
+        return true;
+    }
+
+    // Add background color when ray doesn't hit anything
+    incomingLight += glm::vec3(0.1f) * rayColor;  // Ambient light
+    counters.EndPath(PathEnd::Escaped, bounce);
+    return false;
+}
+
+static glm::vec3 Trace(const Scene& scene, const TraceSettings& settings, const Reservoir* reservoirs, Ray ray, const SampleIndex& index, uint32_t& state, Bvh8IntersectFn intersect8, TraceCounters& counters)
+{
+    glm::vec3 incomingLight = glm::vec3(0.0f);
+    glm::vec3 rayColor = glm::vec3(1.0f);
+    float bsdfPdf = 0.0f;               // pdf of ray.direction, 0 for the camera ray
+    glm::vec3 normal = glm::vec3(0.0f); // of the surface ray.origin lies on
+
+    for (int i = 0; i < settings.maxTraceBounces; i++)
+    {
+        HitResult hitResult = CalculateRayCollision(scene, ray, intersect8, counters);
+        if (!ShadeBounce(scene, settings, reservoirs, index, i, hitResult, ray, bsdfPdf, normal, state, incomingLight, rayColor, intersect8, counters)) break;
+    }
+
+    return incomingLight;
+}
+
+static Ray PrimaryRay(const TraceSettings& settings, int x, int y)
+{
+    const glm::vec2 resolution = glm::vec2((float)settings.width, (float)settings.height);
+    const float FOV = std::tan(glm::radians(settings.fov) * 0.5f);
+    const float aspectRation = resolution.x / resolution.y;
+
+    glm::vec2 uvCoords = (glm::vec2((float)x, (float)y) / resolution) * 2.0f - 1.0f;
+    uvCoords.x *= aspectRation;
+
+    Ray ray;
+    ray.origin = settings.cameraPosition;
+    ray.direction = glm::normalize(settings.cameraRotation * glm::vec3(uvCoords * FOV, 1.0f));
+    return ray;
+}
+
+// Same seed as the shader; unsigned math keeps the int overflow wrap of GLSL
+static uint32_t PixelSeed(const TraceSettings& settings, int x, int y)
+{
+    uint32_t rngState = ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u);
+    rngState ^= (uint32_t)settings.frameIndex * 2654435761u;
+    return rngState;
+}
+
+static SampleIndex PixelSampleIndex(const TraceSettings& settings, uint32_t pixel, int rayIndex)
+{
+    return { pixel, (uint32_t)settings.width, (uint32_t)settings.frameIndex, (uint32_t)rayIndex, (uint32_t)settings.maxTracePerPixel };
+}
+
+// Averages the samples of a pixel and blends them into the running average of earlier frames
+static void StorePixel(const TraceSettings& settings, int x, int y, const glm::vec3& totalIncomingLight, std::vector<glm::vec4>& pixels)
+{
+    glm::vec3 pixelColor = totalIncomingLight / (float)settings.maxTracePerPixel;
+
+    glm::vec4& pixel = pixels[(size_t)y * settings.width + x];
+    if (settings.frameIndex > 0) {
+        glm::vec3 accumulated = glm::vec3(pixel);
+        pixelColor = accumulated + (pixelColor - accumulated) / (float)(settings.frameIndex + 1);
+    }
+    pixel = glm::vec4(pixelColor, 1.0f);
+}
+
+// Pixel of the previous camera's image that position falls into, -1 if none
+static int PreviousPixel(const TraceSettings& settings, const glm::vec3& previousPosition, const glm::mat3& previousRotation, const glm::vec3& position)
+{
+    const glm::vec2 resolution = glm::vec2((float)settings.width, (float)settings.height);
+    const float FOV = std::tan(glm::radians(settings.fov) * 0.5f);
+
+    const glm::vec3 local = glm::transpose(previousRotation) * (position - previousPosition);
+    if (local.z <= 0.0f) return -1;
+    glm::vec2 uvCoords = glm::vec2(local) / (local.z * FOV);
+    uvCoords.x /= resolution.x / resolution.y;
+    const glm::ivec2 pixelCoords = glm::ivec2(glm::floor((uvCoords + 1.0f) * 0.5f * resolution + 0.5f));
+    if (pixelCoords.x < 0 || pixelCoords.y < 0 || pixelCoords.x >= settings.width || pixelCoords.y >= settings.height) return -1;
+    return pixelCoords.y * settings.width + pixelCoords.x;
+}
+
+// main() of restirCandidates.glsl: resamples settings.restirCandidates light samples of
+// the camera ray hit, keeps the pick only if the light is visible, then merges history
+// (last frame's reservoirs, seen from previousPosition / previousRotation) of the same surface
+static Reservoir ResampleCandidates(const Scene& scene, const TraceSettings& settings, int x, int y, const Reservoir* history,
+                                    const glm::vec3& previousPosition, const glm::mat3& previousRotation, Bvh8IntersectFn intersect8, TraceCounters& counters)
+{
+    const uint32_t pixel = (uint32_t)(y * settings.width + x);
+    const HitResult hitResult = CalculateRayCollision(scene, PrimaryRay(settings, x, y), intersect8, counters);
+    if (!hitResult.hit) return EmptyReservoir(glm::vec3(0.0f), glm::vec3(0.0f));
+
+    const glm::vec3 normal = hitResult.normal;
+    const glm::vec3 origin = hitResult.position + normal * 0.01f;  // Offset to avoid self-intersection, like Trace()
+    Reservoir reservoir = EmptyReservoir(origin, normal);
+
+    uint32_t state = HashUint(pixel ^ HashUint((uint32_t)settings.frameIndex ^ 0x5bd1e995u));
+    float weightSum = 0.0f;
+    for (int candidate = 0; candidate < settings.restirCandidates; candidate++) {
+        const float ux = randomValueInt(state);
+        const float uy = randomValueInt(state);
+        const float pickX = randomValueInt(state);
+        const float pickY = randomValueInt(state);
+        const float choice = randomValueInt(state);
+        reservoir.M += 1.0f;
+
+        LightPoint lightPoint;
+        if (!SampleLightPoint(scene, settings, origin, normal, glm::vec2(ux, uy), glm::vec2(pickX, pickY), lightPoint)) continue;
+        const glm::vec3 point = origin + lightPoint.direction * lightPoint.dist;
+        const float areaPdf = lightPoint.pdf * LightAreaFactor(scene, origin, lightPoint.sphere, point);
+        if (areaPdf <= 0.0f) continue;
+
+        const float weight = RestirTarget(scene, origin, normal, lightPoint.sphere, point) / areaPdf;
+        weightSum += weight;
+        if (choice * weightSum < weight) {
+            reservoir.lightPoint = point;
+            reservoir.sphere = lightPoint.sphere;
+        }
+    }
+    RestirFinish(scene, reservoir, weightSum, reservoir.M > 0.0f ? 1.0f / reservoir.M : 0.0f);
+
+    // Visibility before reuse, so neighbours don't inherit occluded samples
+    LightSample lightSample;
+    if (RestirLightSample(scene, reservoir, lightSample) && Occluded(scene, lightSample.shadowRay, lightSample.maxDist, intersect8, counters)) reservoir.W = 0.0f;
+
+    const int previous = history ? PreviousPixel(settings, previousPosition, previousRotation, origin) : -1;
+    if (previous >= 0) {
+        Reservoir past = history[previous];
+        if (RestirSimilar(past, origin, normal, glm::distance(origin, settings.cameraPosition))) {
+            past.M = std::min(past.M, RESTIR_HISTORY_LIMIT * (float)settings.restirCandidates);
+            const float currentChoice = randomValueInt(state);
+            const float pastChoice = randomValueInt(state);
+            Reservoir merged = EmptyReservoir(origin, normal);
+            float mergedWeightSum = 0.0f;
+            RestirStream(scene, merged, mergedWeightSum, reservoir, currentChoice);
+            const bool fromPast = RestirStream(scene, merged, mergedWeightSum, past, pastChoice);
+            const float currentTarget = RestirInputTarget(scene, reservoir, merged);
+            const float pastTarget = RestirInputTarget(scene, past, merged);
+            const float targetSum = currentTarget * reservoir.M + pastTarget * past.M;
+            const float chosenTarget = fromPast ? pastTarget : currentTarget;
+            RestirFinish(scene, merged, mergedWeightSum, targetSum > 0.0f ? chosenTarget / targetSum : 0.0f);
+            reservoir = merged;
+        }
+    }
+    return reservoir;
+}
+
+// main() of restirSpatial.glsl: merges the reservoirs of random neighbours on a similar
+// surface into the pixel's own
+static Reservoir ResampleNeighbours(const Scene& scene, const TraceSettings& settings, int x, int y, const Reservoir* temporalReservoirs)
+{
+    const uint32_t pixel = (uint32_t)(y * settings.width + x);
+    const Reservoir& own = temporalReservoirs[pixel];
+    if (own.normal == glm::vec3(0.0f) || settings.restirSpatialSamples <= 0) return own;
+
+    uint32_t state = HashUint(pixel ^ HashUint((uint32_t)settings.frameIndex ^ 0x27d4eb2fu));
+    const float depth = glm::distance(own.origin, settings.cameraPosition);
+
+    Reservoir merged = EmptyReservoir(own.origin, own.normal);
+    float weightSum = 0.0f;
+    RestirStream(scene, merged, weightSum, own, randomValueInt(state));
+
+    uint32_t neighbours[RESTIR_MAX_SPATIAL_SAMPLES];
+    int neighbourCount = 0;
+    int chosen = -1;                    // neighbours[] entry merged's sample came from, -1 for own
+    for (int i = 0; i < std::min(settings.restirSpatialSamples, RESTIR_MAX_SPATIAL_SAMPLES); i++) {
+        const float ux = randomValueInt(state);
+        const float uy = randomValueInt(state);
+        const float choice = randomValueInt(state);
+        const glm::ivec2 offset = glm::ivec2(glm::floor(ConcentricDisk(glm::vec2(ux, uy)) * RESTIR_SPATIAL_RADIUS + 0.5f));
+        const int nx = x + offset.x, ny = y + offset.y;
+        if (offset == glm::ivec2(0)) continue;
+        if (nx < 0 || ny < 0 || nx >= settings.width || ny >= settings.height) continue;
+
+        const uint32_t neighbour = (uint32_t)(ny * settings.width + nx);
+        const Reservoir& r = temporalReservoirs[neighbour];
+        if (!RestirSimilar(r, own.origin, own.normal, depth)) continue;
+        if (RestirStream(scene, merged, weightSum, r, choice)) chosen = neighbourCount;
+        neighbours[neighbourCount++] = neighbour;
+    }
+
+    float chosenTarget = RestirInputTarget(scene, own, merged);
+    float targetSum = chosenTarget * own.M;
+    for (int i = 0; i < neighbourCount; i++) {
+        const Reservoir& r = temporalReservoirs[neighbours[i]];
+        const float target = RestirInputTarget(scene, r, merged);
+        targetSum += target * r.M;
+        if (i == chosen) chosenTarget = target;
+    }
+    RestirFinish(scene, merged, weightSum, targetSum > 0.0f ? chosenTarget / targetSum : 0.0f);
+    return merged;
+}
+
+#if CPU_TRACER_PACKETS
+
+// 8-wide packet path. Everything up to the matching pop_options is compiled for AVX2
+// and only ever called after CpuTracer checked the CPU supports it. No FMA: lanes
+// must round exactly like the scalar functions above, so packets and single rays
+// agree on every hit distance.
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+const int PACKET_SIZE = 8;
+
+enum PacketHitKind : int32_t { PACKET_HIT_NONE = 0, PACKET_HIT_SPHERE = 1, PACKET_HIT_TRIANGLE = 2 };
+
+// SoA rays of one packet plus the interval bounds used for frustum culling
+struct alignas(32) RayPacket {
+    float   ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+    float   dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+    float   ix[PACKET_SIZE], iy[PACKET_SIZE], iz[PACKET_SIZE];
+    float   dist[PACKET_SIZE];          // closest hit so far; negative for inactive lanes
+    int32_t kind[PACKET_SIZE];          // PacketHitKind of the closest hit
+    int32_t prim[PACKET_SIZE];          // sphere or triangle index of the closest hit
+    int32_t instance[PACKET_SIZE];      // tlasInstances index of the closest triangle hit
+
+    // Frustum: only valid when all active lanes share their direction signs
+    bool    frustum;
+    float   originMin[3], originMax[3];
+    float   invDirMin[3], invDirMax[3];
+};
+
+static void SetPacketRays(RayPacket& packet, const Ray* rays, const float* dist)
+{
+    bool signsAgree = true;
+    int firstActive = -1;
+    for (int i = 0; i < 3; ++i) {
+        packet.originMin[i] = packet.invDirMin[i] =  INFINITY;
+        packet.originMax[i] = packet.invDirMax[i] = -INFINITY;
+    }
+
+    for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+        const Ray& ray = rays[lane];
+        const glm::vec3 invDir = 1.0f / ray.direction;
+        packet.ox[lane] = ray.origin.x;     packet.oy[lane] = ray.origin.y;     packet.oz[lane] = ray.origin.z;
+        packet.dx[lane] = ray.direction.x;  packet.dy[lane] = ray.direction.y;  packet.dz[lane] = ray.direction.z;
+        packet.ix[lane] = invDir.x;         packet.iy[lane] = invDir.y;         packet.iz[lane] = invDir.z;
+        packet.dist[lane] = dist[lane];
+        packet.kind[lane] = PACKET_HIT_NONE;
+        packet.prim[lane] = 0;
+        packet.instance[lane] = 0;
+        if (dist[lane] < 0.0f) continue;
+
+        if (firstActive < 0) firstActive = lane;
+        for (int i = 0; i < 3; ++i) {
+            signsAgree &= std::signbit(invDir[i]) == std::signbit(1.0f / rays[firstActive].direction[i]);
+            packet.originMin[i] = std::min(packet.originMin[i], ray.origin[i]);
+            packet.originMax[i] = std::max(packet.originMax[i], ray.origin[i]);
+            packet.invDirMin[i] = std::min(packet.invDirMin[i], invDir[i]);
+            packet.invDirMax[i] = std::max(packet.invDirMax[i], invDir[i]);
+        }
+    }
+
+    // Infinite reciprocals (axis-parallel rays) would turn the interval products into NaN
+    packet.frustum = signsAgree && firstActive >= 0;
+    for (int i = 0; i < 3; ++i) packet.frustum &= std::isfinite(packet.invDirMin[i]) && std::isfinite(packet.invDirMax[i]);
+}
+
+static float PacketMaxDist(const RayPacket& packet)
+{
+    const __m256 dist = _mm256_load_ps(packet.dist);
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(dist), _mm256_extractf128_ps(dist, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+static void IntervalMul(float a0, float a1, float b0, float b1, float& lo, float& hi)
+{
+    const float p0 = a0 * b0, p1 = a0 * b1, p2 = a1 * b0, p3 = a1 * b1;
+    lo = std::min(std::min(p0, p1), std::min(p2, p3));
+    hi = std::max(std::max(p0, p1), std::max(p2, p3));
+}
+
+// Interval-arithmetic frustum test: false only when no ray of the packet can enter
+// the box before its current closest hit. Conservative; lanes are tested afterwards.
+static bool PacketFrustumHitsBox(const RayPacket& packet, const BvhNode& node)
+{
+    if (!packet.frustum) return true;
+
+    float entry = 0.0f, exit = PacketMaxDist(packet);
+    for (int axis = 0; axis < 3; ++axis) {
+        // All lanes share the sign, so all enter through the same plane
+        const bool negative = std::signbit(packet.invDirMin[axis]);
+        const float nearPlane = negative ? node.boundsMax[axis] : node.boundsMin[axis];
+        const float farPlane  = negative ? node.boundsMin[axis] : node.boundsMax[axis];
+
+        float nearLo, nearHi, farLo, farHi;
+        IntervalMul(nearPlane - packet.originMax[axis], nearPlane - packet.originMin[axis], packet.invDirMin[axis], packet.invDirMax[axis], nearLo, nearHi);
+        IntervalMul(farPlane  - packet.originMax[axis], farPlane  - packet.originMin[axis], packet.invDirMin[axis], packet.invDirMax[axis], farLo, farHi);
+        entry = std::max(entry, nearLo);
+        exit  = std::min(exit, farHi);
+    }
+    return entry <= exit;
+}
+
+// RayAabbDistance for all lanes; returns the mask of lanes that hit and the smallest entry among them
+static int PacketHitsBox(const RayPacket& packet, const BvhNode& node, float& minEntry)
+{
+    const __m256 ox = _mm256_load_ps(packet.ox), oy = _mm256_load_ps(packet.oy), oz = _mm256_load_ps(packet.oz);
+    const __m256 ix = _mm256_load_ps(packet.ix), iy = _mm256_load_ps(packet.iy), iz = _mm256_load_ps(packet.iz);
+
+    const __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.x), ox), ix);
+    const __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.y), oy), iy);
+    const __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.z), oz), iz);
+    const __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.x), ox), ix);
+    const __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.y), oy), iy);
+    const __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.z), oz), iz);
+
+    const __m256 entry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                                       _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_setzero_ps()));
+    const __m256 exit  = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                                       _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_load_ps(packet.dist)));
+    const __m256 hit = _mm256_cmp_ps(entry, exit, _CMP_LE_OQ);
+    const int mask = _mm256_movemask_ps(hit);
+
+    alignas(32) float entries[PACKET_SIZE];
+    _mm256_store_ps(entries, _mm256_blendv_ps(_mm256_set1_ps(BVH_MISS), entry, hit));
+    minEntry = BVH_MISS;
+    for (int lane = 0; lane < PACKET_SIZE; ++lane) minEntry = std::min(minEntry, entries[lane]);
+    return mask;
+}
+
+// Closer hits (dist > 0.001 and below the lane's closest) replace the recorded ones
+static void RecordPacketHits(RayPacket& packet, __m256 dist, __m256 hit, int32_t kind, int32_t prim, int32_t instance)
+{
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, _mm256_load_ps(packet.dist), _CMP_LT_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, _mm256_set1_ps(0.001f), _CMP_GT_OQ));
+    if (_mm256_testz_ps(hit, hit)) return;
+
+    const __m256i hitMask = _mm256_castps_si256(hit);
+    _mm256_store_ps(packet.dist, _mm256_blendv_ps(_mm256_load_ps(packet.dist), dist, hit));
+    _mm256_store_si256((__m256i*)packet.kind,     _mm256_blendv_epi8(_mm256_load_si256((const __m256i*)packet.kind),     _mm256_set1_epi32(kind), hitMask));
+    _mm256_store_si256((__m256i*)packet.prim,     _mm256_blendv_epi8(_mm256_load_si256((const __m256i*)packet.prim),     _mm256_set1_epi32(prim), hitMask));
+    _mm256_store_si256((__m256i*)packet.instance, _mm256_blendv_epi8(_mm256_load_si256((const __m256i*)packet.instance), _mm256_set1_epi32(instance), hitMask));
+}
+
+// Dot products in glm's order, (x + y) + z, so lanes round like the scalar path
+static inline __m256 Dot8(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+}
+
+// RaySphereIntersection for all lanes
+static void PacketIntersectSphere(RayPacket& packet, const Sphere& sphere, int32_t sphereIndex)
+{
+    const __m256 dx = _mm256_load_ps(packet.dx), dy = _mm256_load_ps(packet.dy), dz = _mm256_load_ps(packet.dz);
+    const __m256 ocx = _mm256_sub_ps(_mm256_load_ps(packet.ox), _mm256_set1_ps(sphere.positionRadius.x));
+    const __m256 ocy = _mm256_sub_ps(_mm256_load_ps(packet.oy), _mm256_set1_ps(sphere.positionRadius.y));
+    const __m256 ocz = _mm256_sub_ps(_mm256_load_ps(packet.oz), _mm256_set1_ps(sphere.positionRadius.z));
+    const float radius = sphere.positionRadius.w;
+
+    const __m256 a = Dot8(dx, dy, dz, dx, dy, dz);
+    const __m256 b = _mm256_mul_ps(_mm256_set1_ps(2.0f), Dot8(ocx, ocy, ocz, dx, dy, dz));
+    const __m256 c = _mm256_sub_ps(Dot8(ocx, ocy, ocz, ocx, ocy, ocz), _mm256_set1_ps(radius * radius));
+    const __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), a), c));
+
+    const __m256 negB = _mm256_sub_ps(_mm256_setzero_ps(), b);
+    const __m256 dist = _mm256_div_ps(_mm256_sub_ps(negB, _mm256_sqrt_ps(discriminant)), _mm256_mul_ps(_mm256_set1_ps(2.0f), a));
+    const __m256 hit = _mm256_and_ps(_mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ),
+                                     _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_GT_OQ));
+    RecordPacketHits(packet, dist, hit, PACKET_HIT_SPHERE, sphereIndex, 0);
+}
+
+// RayTriangleIntersection for all lanes; unordered compares keep the scalar NaN behaviour
+static void PacketIntersectTriangle(RayPacket& packet, const Triangle& tri, int32_t triangleIndex, int32_t instanceIndex)
+{
+    const __m256 dx = _mm256_load_ps(packet.dx), dy = _mm256_load_ps(packet.dy), dz = _mm256_load_ps(packet.dz);
+    const glm::vec3 v0 = glm::vec3(tri.v0);
+    const glm::vec3 e1 = glm::vec3(tri.v1) - v0;
+    const glm::vec3 e2 = glm::vec3(tri.v2) - v0;
+    const __m256 e1x = _mm256_set1_ps(e1.x), e1y = _mm256_set1_ps(e1.y), e1z = _mm256_set1_ps(e1.z);
+    const __m256 e2x = _mm256_set1_ps(e2.x), e2y = _mm256_set1_ps(e2.y), e2z = _mm256_set1_ps(e2.z);
+
+    // pvec = cross(direction, edge2)
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+    const __m256 det = Dot8(e1x, e1y, e1z, px, py, pz);
+    const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 valid = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-8f), _CMP_NLT_UQ);
+
+    const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+    const __m256 tx = _mm256_sub_ps(_mm256_load_ps(packet.ox), _mm256_set1_ps(v0.x));
+    const __m256 ty = _mm256_sub_ps(_mm256_load_ps(packet.oy), _mm256_set1_ps(v0.y));
+    const __m256 tz = _mm256_sub_ps(_mm256_load_ps(packet.oz), _mm256_set1_ps(v0.z));
+    const __m256 u = _mm256_mul_ps(Dot8(tx, ty, tz, px, py, pz), invDet);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_NLT_UQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_NGT_UQ));
+    if (_mm256_testz_ps(valid, valid)) return;
+
+    // qvec = cross(tvec, edge1)
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(e1y, tz));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(e1z, tx));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(e1x, ty));
+    const __m256 v = _mm256_mul_ps(Dot8(dx, dy, dz, qx, qy, qz), invDet);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_NLT_UQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_NGT_UQ));
+
+    const __m256 dist = _mm256_mul_ps(Dot8(e2x, e2y, e2z, qx, qy, qz), invDet);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_GT_OQ));
+    RecordPacketHits(packet, dist, valid, PACKET_HIT_TRIANGLE, triangleIndex, instanceIndex);
+}
+
+// TraverseBvh for a whole packet: a node is entered when the frustum and at least one
+// lane hit it, children are ordered by the nearest lane entry
+template <typename LeafFn>
+static void TraversePacket(const BvhNode* nodes, uint32_t root, RayPacket& packet, TraceCounters& counters, LeafFn&& leafFn)
+{
+    float rootEntry;
+    counters.TouchNodes(&nodes[root], sizeof(BvhNode));
+    if (!PacketFrustumHitsBox(packet, nodes[root]) || PacketHitsBox(packet, nodes[root], rootEntry) == 0) return;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = root;
+
+    while (stackSize > 0) {
+        const BvhNode& node = nodes[stack[--stackSize]];
+        ++counters.nodeVisits;
+
+        if (node.IsLeaf()) {
+            leafFn(node);
+            continue;
+        }
+
+        uint32_t nearChild = node.leftFirst, farChild = node.leftFirst + 1;
+        float distNear = BVH_MISS, distFar = BVH_MISS;
+        counters.TouchNodes(&nodes[nearChild], 2 * sizeof(BvhNode));
+        const bool hitNear = PacketFrustumHitsBox(packet, nodes[nearChild]) && PacketHitsBox(packet, nodes[nearChild], distNear) != 0;
+        const bool hitFar  = PacketFrustumHitsBox(packet, nodes[farChild])  && PacketHitsBox(packet, nodes[farChild], distFar) != 0;
+        if (distFar < distNear) std::swap(nearChild, farChild);
+        if (hitNear && hitFar) {
+            stack[stackSize++] = farChild;
+            stack[stackSize++] = nearChild;
+        }
+        else if (hitNear || hitFar) stack[stackSize++] = hitNear ? node.leftFirst : node.leftFirst + 1;
+    }
+}
+
+// CalculateRayCollision for up to eight rays; lanes with active == false are left as misses.
+// Packet traversal only finds the closest primitive per lane, the hit itself is then
+// recomputed with the scalar functions so it is bit-identical to the single-ray path.
+static void CalculatePacketCollision(const Scene& scene, const Ray* rays, const bool* active, HitResult* hitResults, TraceCounters& counters)
+{
+    float dist[PACKET_SIZE];
+    for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+        hitResults[lane] = NoHit();
+        dist[lane] = active[lane] ? hitResults[lane].dist : -1.0f;
+        counters.rays += active[lane] ? 1 : 0;
+        counters.packetRays += active[lane] ? 1 : 0;
+    }
+
+    RayPacket packet;
+    SetPacketRays(packet, rays, dist);
+
+    if (!scene.sphereBvh.Empty()) {
+        TraversePacket(scene.sphereBvh.nodes.data(), 0, packet, counters, [&](const BvhNode& leaf) {
+            for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.primCount; ++k) {
+                const uint32_t sphereIndex = scene.sphereBvh.primIndices[k];
+                PacketIntersectSphere(packet, scene.spheres[sphereIndex], (int32_t)sphereIndex);
+            }
+        });
+    }
+
+    if (!scene.tlas.Empty()) {
+        TraversePacket(scene.tlas.nodes.data(), 0, packet, counters, [&](const BvhNode& leaf) {
+            for (uint32_t k = leaf.leftFirst; k < leaf.leftFirst + leaf.primCount; ++k) {
+                const TlasInstance& instance = scene.tlasInstances[k];
+
+                Ray objectRays[PACKET_SIZE];
+                for (int lane = 0; lane < PACKET_SIZE; ++lane) objectRays[lane] = ObjectRay(instance, rays[lane]);
+
+                RayPacket objectPacket;
+                SetPacketRays(objectPacket, objectRays, packet.dist);
+                TraversePacket(scene.blasNodes.data(), instance.blasRoot, objectPacket, counters, [&](const BvhNode& blasLeaf) {
+                    for (uint32_t t = blasLeaf.leftFirst; t < blasLeaf.leftFirst + blasLeaf.primCount; ++t)
+                        PacketIntersectTriangle(objectPacket, scene.triangles[t], (int32_t)t, (int32_t)k);
+                });
+
+                for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                    if (objectPacket.kind[lane] == PACKET_HIT_NONE) continue;
+                    packet.dist[lane] = objectPacket.dist[lane];
+                    packet.kind[lane] = objectPacket.kind[lane];
+                    packet.prim[lane] = objectPacket.prim[lane];
+                    packet.instance[lane] = objectPacket.instance[lane];
+                }
+            }
+        });
+    }
+
+    for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+        if (packet.kind[lane] == PACKET_HIT_SPHERE) {
+            hitResults[lane] = SphereHit(scene, rays[lane], (uint32_t)packet.prim[lane]);
+        }
+        else if (packet.kind[lane] == PACKET_HIT_TRIANGLE) {
+            const TlasInstance& instance = scene.tlasInstances[packet.instance[lane]];
+            hitResults[lane] = TriangleHit(scene, ObjectRay(instance, rays[lane]), (uint32_t)packet.prim[lane]);
+            InstanceHitToWorld(scene, instance, rays[lane], hitResults[lane]);
+        }
+    }
+}
+
+// Packets only pay off while the rays stay coherent: they must share direction
+// signs (the frustum test needs it) and at least half the lanes must be alive
+static bool PacketIsCoherent(const Ray* rays, const bool* alive)
+{
+    int aliveCount = 0, firstAlive = -1;
+    for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+        if (!alive[lane]) continue;
+        ++aliveCount;
+        if (firstAlive < 0) { firstAlive = lane; continue; }
+        for (int axis = 0; axis < 3; ++axis)
+            if (std::signbit(rays[lane].direction[axis]) != std::signbit(rays[firstAlive].direction[axis])) return false;
+    }
+    return aliveCount >= PACKET_SIZE / 2;
+}
+
+// Trace() for the pixels of one packet in lockstep. Every pixel consumes its own RNG
+// state in the same order as Trace(), so the result matches the single-ray path.
+// The primary hit is traced once as a packet and reused by every sample; first-bounce
+// rays go as a packet while still coherent, everything after that as single rays.
+static void TracePacket(const Scene& scene, const TraceSettings& settings, const Reservoir* reservoirs, const Ray* primaryRays, const bool* active, const uint32_t* pixelIndices,
+                        uint32_t* states, Bvh8IntersectFn intersect8, glm::vec3* totalIncomingLight, TraceCounters& counters)
+{
+    HitResult primaryHits[PACKET_SIZE];
+    CalculatePacketCollision(scene, primaryRays, active, primaryHits, counters);
+
+    for (int rayIndex = 0; rayIndex < settings.maxTracePerPixel; rayIndex++) {
+        Ray rays[PACKET_SIZE];
+        bool alive[PACKET_SIZE];
+        glm::vec3 incomingLight[PACKET_SIZE], rayColor[PACKET_SIZE];
+        float bsdfPdf[PACKET_SIZE];
+        glm::vec3 normals[PACKET_SIZE];
+        for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+            rays[lane] = primaryRays[lane];
+            bsdfPdf[lane] = 0.0f;
+            normals[lane] = glm::vec3(0.0f);
+            alive[lane] = active[lane];
+            incomingLight[lane] = glm::vec3(0.0f);
+            rayColor[lane] = glm::vec3(1.0f);
+        }
+
+        for (int i = 0; i < settings.maxTraceBounces; i++)
+        {
+            HitResult hitResults[PACKET_SIZE];
+            if (i == 0) {
+                std::copy(primaryHits, primaryHits + PACKET_SIZE, hitResults);
+            }
+            else if (i == 1 && PacketIsCoherent(rays, alive)) {
+                CalculatePacketCollision(scene, rays, alive, hitResults, counters);
+            }
+            else {
+                for (int lane = 0; lane < PACKET_SIZE; ++lane)
+                    if (alive[lane]) hitResults[lane] = CalculateRayCollision(scene, rays[lane], intersect8, counters);
+            }
+
+            bool anyAlive = false;
+            for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                if (!alive[lane]) continue;
+                alive[lane] = ShadeBounce(scene, settings, reservoirs, PixelSampleIndex(settings, pixelIndices[lane], rayIndex), i, hitResults[lane],
+                                          rays[lane], bsdfPdf[lane], normals[lane], states[lane], incomingLight[lane], rayColor[lane], intersect8, counters);
+                anyAlive |= alive[lane];
+            }
+            if (!anyAlive) break;
+        }
+
+        for (int lane = 0; lane < PACKET_SIZE; ++lane) totalIncomingLight[lane] += incomingLight[lane];
+    }
+}
+
+#pragma GCC pop_options
+
+#endif
+
+// Wavefront path tracing. Trace() runs all bounces of one path before the next
+// pixel starts, so neighbouring pixels soon sit in different BVH nodes and shading
+// branches. Here every live path of a wave advances by one bounce per pass, one
+// stage at a time over SoA queues, and dead paths are compacted away in between.
+// Paths keep their pixel order and RNG streams, so the image matches Trace().
+
+const size_t WAVEFRONT_SIZE  = 1 << 14;     // paths (pixels) in flight per wave
+const size_t WAVEFRONT_CHUNK = 1024;        // paths per pool task within a stage
+
+// SoA state of the live paths; index i of every array is the same path
+struct PathQueue {
+    std::vector<float>    ox, oy, oz;
+    std::vector<float>    dx, dy, dz;
+    std::vector<float>    bsdfPdf;                      // pdf of the direction, 0 for camera rays
+    std::vector<float>    nx, ny, nz;                   // normal of the surface the origin lies on
+    std::vector<float>    colorR, colorG, colorB;       // rayColor of Trace()
+    std::vector<float>    lightR, lightG, lightB;       // incomingLight of Trace()
+    std::vector<uint32_t> pixel;                        // index into the wave
+    size_t                size = 0;
+
+    void Reserve(size_t n)
+    {
+        for (std::vector<float>* v : { &ox, &oy, &oz, &dx, &dy, &dz, &bsdfPdf, &nx, &ny, &nz, &colorR, &colorG, &colorB, &lightR, &lightG, &lightB }) v->resize(n);
+        pixel.resize(n);
+    }
+};
+
+// Output of the extension stage, parallel to PathQueue
+struct HitQueue {
+    std::vector<uint8_t>  hit;
+    std::vector<float>    px, py, pz;
+    std::vector<float>    nx, ny, nz;
+    std::vector<float>    baseR, baseG, baseB;
+    std::vector<float>    emitR, emitG, emitB;          // emissionColor * emissionStrength
+    std::vector<int32_t>  sphere;                       // HitResult::sphere
+
+    void Reserve(size_t n)
+    {
+        for (std::vector<float>* v : { &px, &py, &pz, &nx, &ny, &nz, &baseR, &baseG, &baseB, &emitR, &emitG, &emitB }) v->resize(n);
+        hit.resize(n);
+        sphere.resize(n);
+    }
+};
+
+// Light samples taken by the shade stage, parallel to PathQueue
+struct ShadowQueue {
+    std::vector<float>    ox, oy, oz;
+    std::vector<float>    dx, dy, dz;
+    std::vector<float>    maxDist;                      // 0: no light sample
+    std::vector<float>    lightR, lightG, lightB;       // rayColor * radianceScale, added when unoccluded
+
+    void Reserve(size_t n)
+    {
+        for (std::vector<float>* v : { &ox, &oy, &oz, &dx, &dy, &dz, &maxDist, &lightR, &lightG, &lightB }) v->resize(n);
+    }
+};
+
+// Per-pixel state of one wave
+struct WaveState {
+    const uint32_t*        pixels = nullptr;            // image index (row-major) of every wave pixel
+    size_t                 pixelCount = 0;
+    std::vector<uint32_t>  rngStates;
+    std::vector<glm::vec3> totalIncomingLight;
+    std::vector<uint8_t>   alive;                       // written by the shade stage: the path goes on
+    std::vector<float>     emissionWeights;             // MIS weights of the emission hits, shade stage only
+    std::vector<uint32_t>  chunkAlive;                  // compaction prefix sums
+    std::vector<uint64_t>  sortKeys;
+    std::vector<uint32_t>  sortOrder;
+};
+
+template <typename Fn>
+static void ForEachChunk(ThreadPool& pool, size_t count, Fn&& fn)
+{
+    const size_t chunks = (count + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+    pool.ParallelFor(chunks, [&](size_t chunk) {
+        const size_t begin = chunk * WAVEFRONT_CHUNK;
+        fn(chunk, begin, std::min(begin + WAVEFRONT_CHUNK, count));
+    });
+}
+
+// Camera rays for every pixel of the wave
+static void GenerateStage(ThreadPool& pool, const TraceSettings& settings, const WaveState& wave, PathQueue& paths)
+{
+    paths.size = wave.pixelCount;
+    ForEachChunk(pool, paths.size, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const uint32_t pixel = wave.pixels[i];
+            const Ray ray = PrimaryRay(settings, (int)(pixel % settings.width), (int)(pixel / settings.width));
+            paths.ox[i] = ray.origin.x;     paths.oy[i] = ray.origin.y;     paths.oz[i] = ray.origin.z;
+            paths.dx[i] = ray.direction.x;  paths.dy[i] = ray.direction.y;  paths.dz[i] = ray.direction.z;
+            paths.bsdfPdf[i] = 0.0f;
+            paths.nx[i] = paths.ny[i] = paths.nz[i] = 0.0f;
+            paths.colorR[i] = paths.colorG[i] = paths.colorB[i] = 1.0f;
+            paths.lightR[i] = paths.lightG[i] = paths.lightB[i] = 0.0f;
+            paths.pixel[i] = (uint32_t)i;
+        }
+    });
+}
+
+static void StoreHit(HitQueue& hits, size_t i, const HitResult& hit)
+{
+    const glm::vec3 emitted = hit.material.emissionColor * hit.material.emissionStrength;
+    hits.hit[i] = hit.hit ? 1 : 0;
+    hits.sphere[i] = hit.sphere;
+    hits.px[i] = hit.position.x;                hits.py[i] = hit.position.y;                hits.pz[i] = hit.position.z;
+    hits.nx[i] = hit.normal.x;                  hits.ny[i] = hit.normal.y;                  hits.nz[i] = hit.normal.z;
+    hits.baseR[i] = hit.material.baseColor.r;   hits.baseG[i] = hit.material.baseColor.g;   hits.baseB[i] = hit.material.baseColor.b;
+    hits.emitR[i] = emitted.r;                  hits.emitG[i] = emitted.g;                  hits.emitB[i] = emitted.b;
+}
+
+static Ray QueuedRay(const PathQueue& paths, size_t i)
+{
+    Ray ray;
+    ray.origin = glm::vec3(paths.ox[i], paths.oy[i], paths.oz[i]);
+    ray.direction = glm::vec3(paths.dx[i], paths.dy[i], paths.dz[i]);
+    return ray;
+}
+
+// Closest hit of every live path. With packets, runs of eight queued rays that are
+// still coherent (camera rays of one tile row, mostly) are traced as one packet.
+static void ExtendStage(ThreadPool& pool, const Scene& scene, Bvh8IntersectFn intersect8, bool packets, bool cacheModel, const PathQueue& paths, HitQueue& hits, TraceStats& stats)
+{
+    ForEachChunk(pool, paths.size, [&](size_t, size_t begin, size_t end) {
+        TraceCounters counters;
+        std::unique_ptr<NodeCacheModel> cache(cacheModel ? new NodeCacheModel() : nullptr);
+        counters.cache = cache.get();
+        size_t i = begin;
+#if CPU_TRACER_PACKETS
+        for (; packets && i + PACKET_SIZE <= end; i += PACKET_SIZE) {
+            Ray rays[PACKET_SIZE];
+            bool active[PACKET_SIZE];
+            for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                rays[lane] = QueuedRay(paths, i + lane);
+                active[lane] = true;
+            }
+            if (!PacketIsCoherent(rays, active)) {
+                for (int lane = 0; lane < PACKET_SIZE; ++lane) StoreHit(hits, i + lane, CalculateRayCollision(scene, rays[lane], intersect8, counters));
+                continue;
+            }
+
+            HitResult hitResults[PACKET_SIZE];
+            CalculatePacketCollision(scene, rays, active, hitResults, counters);
+            for (int lane = 0; lane < PACKET_SIZE; ++lane) StoreHit(hits, i + lane, hitResults[lane]);
+        }
+#endif
+        for (; i < end; ++i) StoreHit(hits, i, CalculateRayCollision(scene, QueuedRay(paths, i), intersect8, counters));
+
+        stats.Add(counters);
+    });
+}
+
+// ShadeBounce() up to the shadow ray, split in loops: the light / rayColor update is
+// branch-free arithmetic over contiguous arrays and vectorizes, the MIS weights it
+// uses, the roulette, the light sample and the bounce direction need scene lookups or
+// the per-pixel RNG and stay scalar. Light samples go to shadows for ShadowStage(),
+// wave.alive marks the paths that go on.
+static void ShadeStage(ThreadPool& pool, const Scene& scene, const TraceSettings& settings, const Reservoir* reservoirs, int rayIndex, int bounce, bool lastBounce,
+                       PathQueue& paths, const HitQueue& hits, ShadowQueue& shadows, WaveState& wave)
+{
+    ForEachChunk(pool, paths.size, [&](size_t, size_t begin, size_t end) {
+        float* weights = wave.emissionWeights.data();
+        for (size_t i = begin; i < end; ++i) {
+            const glm::vec3 origin = glm::vec3(paths.ox[i], paths.oy[i], paths.oz[i]);
+            const glm::vec3 normal = glm::vec3(paths.nx[i], paths.ny[i], paths.nz[i]);
+            if (!hits.hit[i]) weights[i] = 1.0f;
+            else weights[i] = reservoirs && bounce == 1 && hits.sphere[i] >= 0 ? 0.0f : EmissionWeight(scene, settings, paths.bsdfPdf[i], origin, normal, hits.sphere[i]);
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            // Misses add the ambient light and keep their color, the path ends anyway
+            const bool hit = hits.hit[i] != 0;
+            const float emitR = hit ? hits.emitR[i] : 0.1f, baseR = hit ? hits.baseR[i] : 1.0f;
+            const float emitG = hit ? hits.emitG[i] : 0.1f, baseG = hit ? hits.baseG[i] : 1.0f;
+            const float emitB = hit ? hits.emitB[i] : 0.1f, baseB = hit ? hits.baseB[i] : 1.0f;
+            paths.lightR[i] += emitR * paths.colorR[i] * weights[i];
+            paths.lightG[i] += emitG * paths.colorG[i] * weights[i];
+            paths.lightB[i] += emitB * paths.colorB[i] * weights[i];
+            paths.colorR[i] *= baseR;
+            paths.colorG[i] *= baseG;
+            paths.colorB[i] *= baseB;
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            shadows.maxDist[i] = 0.0f;
+            wave.alive[i] = 0;
+            if (!hits.hit[i]) continue;
+            const glm::vec3 normal = glm::vec3(hits.nx[i], hits.ny[i], hits.nz[i]);
+            const glm::vec3 origin = glm::vec3(hits.px[i], hits.py[i], hits.pz[i]) + normal * 0.01f;  // Offset to avoid self-intersection
+            const SampleIndex index = PixelSampleIndex(settings, wave.pixels[paths.pixel[i]], rayIndex);
+            uint32_t& state = wave.rngStates[paths.pixel[i]];
+
+            glm::vec3 rayColor = glm::vec3(paths.colorR[i], paths.colorG[i], paths.colorB[i]);
+            if (lastBounce || !SurvivesRoulette(settings, index, bounce, rayColor, state)) continue;
+            wave.alive[i] = 1;
+            paths.colorR[i] = rayColor.r;   paths.colorG[i] = rayColor.g;   paths.colorB[i] = rayColor.b;
+
+            if (TakesLightSample(scene, settings)) {
+                LightSample lightSample;
+                bool sampled;
+                if (reservoirs && bounce == 0) {
+                    sampled = RestirLightSample(scene, reservoirs[index.pixel], lightSample);
+                } else {
+                    const glm::vec2 u = SampleSquare(settings.hemisphereSampler, index, LIGHT_SAMPLE_DIMENSION + bounce, state);
+                    const glm::vec2 uPick = SampleSquare(settings.hemisphereSampler, index, LIGHT_PICK_DIMENSION + bounce, state);
+                    sampled = SampleLight(scene, settings, origin, normal, u, uPick, lightSample);
+                }
+                if (sampled) {
+                    const glm::vec3 light = rayColor * lightSample.radianceScale;
+                    shadows.ox[i] = origin.x;                           shadows.oy[i] = origin.y;                           shadows.oz[i] = origin.z;
+                    shadows.dx[i] = lightSample.shadowRay.direction.x;  shadows.dy[i] = lightSample.shadowRay.direction.y;  shadows.dz[i] = lightSample.shadowRay.direction.z;
+                    shadows.maxDist[i] = lightSample.maxDist;
+                    shadows.lightR[i] = light.r;                        shadows.lightG[i] = light.g;                        shadows.lightB[i] = light.b;
+                }
+            }
+
+            const glm::vec3 direction = SampleCosineHemisphere(normal, SampleSquare(settings.hemisphereSampler, index, bounce, state));
+            paths.ox[i] = origin.x;     paths.oy[i] = origin.y;     paths.oz[i] = origin.z;
+            paths.dx[i] = direction.x;  paths.dy[i] = direction.y;  paths.dz[i] = direction.z;
+            paths.bsdfPdf[i] = glm::dot(normal, direction) / PI;
+            paths.nx[i] = normal.x;     paths.ny[i] = normal.y;     paths.nz[i] = normal.z;
+        }
+    });
+}
+
+// Traces the light samples of the shade stage; unoccluded ones add their light to the path
+static void ShadowStage(ThreadPool& pool, const Scene& scene, Bvh8IntersectFn intersect8, const ShadowQueue& shadows, PathQueue& paths, TraceStats& stats)
+{
+    ForEachChunk(pool, paths.size, [&](size_t, size_t begin, size_t end) {
+        TraceCounters counters;
+        for (size_t i = begin; i < end; ++i) {
+            if (shadows.maxDist[i] <= 0.0f) continue;
+            Ray ray;
+            ray.origin = glm::vec3(shadows.ox[i], shadows.oy[i], shadows.oz[i]);
+            ray.direction = glm::vec3(shadows.dx[i], shadows.dy[i], shadows.dz[i]);
+            if (Occluded(scene, ray, shadows.maxDist[i], intersect8, counters)) continue;
+            paths.lightR[i] += shadows.lightR[i];
+            paths.lightG[i] += shadows.lightG[i];
+            paths.lightB[i] += shadows.lightB[i];
+        }
+        stats.Add(counters);
+    });
+}
+
+// Paths the shade stage ended hand their light to the pixel and are counted like
+// ShadeBounce() counts them. On the last bounce every path finishes.
+static void TerminateStage(ThreadPool& pool, const PathQueue& paths, const HitQueue& hits, int bounce, bool lastBounce, WaveState& wave, TraceStats& stats)
+{
+    ForEachChunk(pool, paths.size, [&](size_t, size_t begin, size_t end) {
+        TraceCounters counters;
+        for (size_t i = begin; i < end; ++i) {
+            if (wave.alive[i]) continue;
+            wave.totalIncomingLight[paths.pixel[i]] += glm::vec3(paths.lightR[i], paths.lightG[i], paths.lightB[i]);
+            counters.EndPath(!hits.hit[i] ? PathEnd::Escaped : lastBounce ? PathEnd::BounceLimit : PathEnd::Roulette, bounce);
+        }
+        stats.Add(counters);
+    });
+}
+
+// 21-bit Morton code of the origin (7 bits per axis) above 3 direction octant bits
+const int RAY_SORT_KEY_BITS = 24;
+
+static void CopyPath(const PathQueue& from, size_t i, PathQueue& to, size_t j)
+{
+    to.ox[j] = from.ox[i];            to.oy[j] = from.oy[i];            to.oz[j] = from.oz[i];
+    to.dx[j] = from.dx[i];            to.dy[j] = from.dy[i];            to.dz[j] = from.dz[i];
+    to.bsdfPdf[j] = from.bsdfPdf[i];
+    to.nx[j] = from.nx[i];            to.ny[j] = from.ny[i];            to.nz[j] = from.nz[i];
+    to.colorR[j] = from.colorR[i];    to.colorG[j] = from.colorG[i];    to.colorB[j] = from.colorB[i];
+    to.lightR[j] = from.lightR[i];    to.lightG[j] = from.lightG[i];    to.lightB[j] = from.lightB[i];
+    to.pixel[j] = from.pixel[i];
+}
+
+// Reorders the queue by origin cell, then by direction octant, so rays that leave
+// the same region in the same general direction are traced back to back. Origin
+// first keeps most of the screen-space locality the queue already had; octant
+// first measured worse. Paths carry their pixel index, so the image is unchanged.
+static void SortStage(ThreadPool& pool, const Aabb& sceneBounds, PathQueue& paths, WaveState& wave, PathQueue& scratch)
+{
+    const glm::vec3 extent = sceneBounds.max - sceneBounds.min;
+    const glm::vec3 invExtent = glm::vec3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                                          extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                                          extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    wave.sortKeys.resize(paths.size);
+    wave.sortOrder.resize(paths.size);
+    ForEachChunk(pool, paths.size, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const uint64_t octant = (std::signbit(paths.dx[i]) ? 4 : 0) | (std::signbit(paths.dy[i]) ? 2 : 0) | (std::signbit(paths.dz[i]) ? 1 : 0);
+            const glm::vec3 origin = (glm::vec3(paths.ox[i], paths.oy[i], paths.oz[i]) - sceneBounds.min) * invExtent;
+            wave.sortKeys[i] = ((MortonCode(origin, 30) >> 9) << 3) | octant;
+            wave.sortOrder[i] = (uint32_t)i;
+        }
+    });
+    ParallelRadixSort(wave.sortKeys, wave.sortOrder, RAY_SORT_KEY_BITS, pool);
+
+    ForEachChunk(pool, paths.size, [&](size_t, size_t begin, size_t end) {
+        for (size_t j = begin; j < end; ++j) CopyPath(paths, wave.sortOrder[j], scratch, j);
+    });
+    scratch.size = paths.size;
+    std::swap(paths, scratch);
+}
+
+// Stable compaction of the live paths into out: per-chunk counts, an exclusive
+// scan over the chunks, then every chunk scatters into its own output range
+static void CompactStage(ThreadPool& pool, const PathQueue& paths, WaveState& wave, PathQueue& out)
+{
+    const size_t chunks = (paths.size + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+    wave.chunkAlive.assign(chunks + 1, 0);
+    ForEachChunk(pool, paths.size, [&](size_t chunk, size_t begin, size_t end) {
+        uint32_t count = 0;
+        for (size_t i = begin; i < end; ++i) count += wave.alive[i];
+        wave.chunkAlive[chunk + 1] = count;
+    });
+    for (size_t chunk = 0; chunk < chunks; ++chunk) wave.chunkAlive[chunk + 1] += wave.chunkAlive[chunk];
+
+    ForEachChunk(pool, paths.size, [&](size_t chunk, size_t begin, size_t end) {
+        size_t j = wave.chunkAlive[chunk];
+        for (size_t i = begin; i < end; ++i)
+            if (wave.alive[i]) CopyPath(paths, i, out, j++);
+    });
+    out.size = wave.chunkAlive[chunks];
+}
+
+glm::mat3 CameraRotationFromYawPitch(float yaw, float pitch)
+{
+    const glm::vec3 worldUp = glm::vec3(0.0f, 1.0f, 0.0f);
+
+    glm::vec3 orientation;
+    orientation.x = std::cos(glm::radians(yaw)) * std::cos(glm::radians(pitch));
+    orientation.y = std::sin(glm::radians(pitch));
+    orientation.z = std::sin(glm::radians(yaw)) * std::cos(glm::radians(pitch));
+    orientation = glm::normalize(orientation);
+
+    glm::vec3 right = glm::normalize(glm::cross(orientation, worldUp));
+    glm::vec3 up = glm::cross(right, orientation);
+    return glm::mat3(right, up, orientation);
+}
+
+void CpuTracer::RenderTile(const Scene& scene, const TraceSettings& settings, int tileX, int tileY, std::vector<glm::vec4>& pixels)
+{
+    TraceCounters counters;
+    std::unique_ptr<NodeCacheModel> cache(cacheModel ? new NodeCacheModel() : nullptr);
+    counters.cache = cache.get();
+
+    const int x0 = tileX * TRACE_TILE_SIZE;
+    const int y0 = tileY * TRACE_TILE_SIZE;
+    const int x1 = std::min(x0 + TRACE_TILE_SIZE, settings.width);
+    const int y1 = std::min(y0 + TRACE_TILE_SIZE, settings.height);
+    const Reservoir* reservoirs = ShadingReservoirs(scene, settings);
+
+#if CPU_TRACER_PACKETS
+    if (packetTracing) {
+        // 4x2 pixel packets; lanes outside the image stay inactive
+        for (int py = y0; py < y1; py += 2) {
+            for (int px = x0; px < x1; px += 4) {
+                Ray rays[PACKET_SIZE];
+                bool active[PACKET_SIZE];
+                uint32_t states[PACKET_SIZE];
+                uint32_t pixelIndices[PACKET_SIZE];
+                glm::vec3 totalIncomingLight[PACKET_SIZE];
+                for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                    const int x = px + lane % 4, y = py + lane / 4;
+                    active[lane] = x < x1 && y < y1;
+                    rays[lane] = PrimaryRay(settings, active[lane] ? x : px, active[lane] ? y : py);
+                    states[lane] = PixelSeed(settings, active[lane] ? x : px, active[lane] ? y : py);
+                    pixelIndices[lane] = active[lane] ? (uint32_t)(y * settings.width + x) : 0;
+                    totalIncomingLight[lane] = glm::vec3(0.0f);
+                }
+
+                TracePacket(scene, settings, reservoirs, rays, active, pixelIndices, states, intersect8, totalIncomingLight, counters);
+
+                for (int lane = 0; lane < PACKET_SIZE; ++lane)
+                    if (active[lane]) StorePixel(settings, px + lane % 4, py + lane / 4, totalIncomingLight[lane], pixels);
+            }
+        }
+
+        stats.Add(counters);
+        return;
+    }
+#endif
+
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            const Ray ray = PrimaryRay(settings, x, y);
+            uint32_t rngState = PixelSeed(settings, x, y);
+
+            glm::vec3 totalIncomingLight = glm::vec3(0.0f);
+            for (int rayIndex = 0; rayIndex < settings.maxTracePerPixel; rayIndex++)
+                totalIncomingLight += Trace(scene, settings, reservoirs, ray, PixelSampleIndex(settings, (uint32_t)(y * settings.width + x), rayIndex), rngState, intersect8, counters);
+
+            StorePixel(settings, x, y, totalIncomingLight, pixels);
+        }
+    }
+
+    stats.Add(counters);
+}
+
+const Reservoir* CpuTracer::ShadingReservoirs(const Scene& scene, const TraceSettings& settings) const
+{
+    const bool current = settings.width == reservoirWidth && settings.height == reservoirHeight;
+    return RestirEnabled(scene, settings) && current ? reservoirs.data() : nullptr;
+}
+
+void CpuTracer::ResampleReservoirs(const Scene& scene, const TraceSettings& settings)
+{
+    // Reservoirs belong to pixels, so a new resolution also ends the history
+    if (settings.width != reservoirWidth || settings.height != reservoirHeight) {
+        reservoirWidth = settings.width;
+        reservoirHeight = settings.height;
+        reservoirs.assign((size_t)settings.width * settings.height, Reservoir());
+        temporalReservoirs.assign(reservoirs.size(), Reservoir());
+        restirHistory = false;
+    }
+
+    const Reservoir* history = restirHistory ? reservoirs.data() : nullptr;
+    pool.ParallelFor((size_t)settings.height, [&](size_t y) {
+        TraceCounters counters;
+        for (int x = 0; x < settings.width; ++x)
+            temporalReservoirs[y * settings.width + x] = ResampleCandidates(scene, settings, x, (int)y, history,
+                                                                            previousCameraPosition, previousCameraRotation, intersect8, counters);
+        stats.Add(counters);
+    });
+    pool.ParallelFor((size_t)settings.height, [&](size_t y) {
+        for (int x = 0; x < settings.width; ++x)
+            reservoirs[y * settings.width + x] = ResampleNeighbours(scene, settings, x, (int)y, temporalReservoirs.data());
+    });
+
+    // Same pixels as the stats buffer of restirSpatial.glsl
+    uint64_t sampleCountSum = 0, sampledPixels = 0;
+    for (int y = 0; y < settings.height; y += 4) {
+        for (int x = 0; x < settings.width; x += 4) {
+            const Reservoir& r = reservoirs[(size_t)y * settings.width + x];
+            if (r.normal == glm::vec3(0.0f)) continue;
+            sampleCountSum += (uint64_t)r.M;
+            ++sampledPixels;
+        }
+    }
+    restirSampleCount = sampledPixels > 0 ? (float)sampleCountSum / (float)sampledPixels : 0.0f;
+
+    restirHistory = true;
+    previousCameraPosition = settings.cameraPosition;
+    previousCameraRotation = settings.cameraRotation;
+}
+
+void CpuTracer::Render(const Scene& scene, const TraceSettings& settings, std::vector<glm::vec4>& pixels)
+{
+    pixels.resize((size_t)settings.width * settings.height);
+    if (RestirEnabled(scene, settings)) ResampleReservoirs(scene, settings);
+    if (wavefront) {
+        RenderWavefront(scene, settings, pixels);
+        return;
+    }
+
+    const int tilesX = (settings.width  + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+    const int tilesY = (settings.height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+
+    pool.ParallelFor((size_t)tilesX * tilesY, [&](size_t tile) {
+        RenderTile(scene, settings, (int)(tile % tilesX), (int)(tile / tilesX), pixels);
+    });
+}
+
+void CpuTracer::RenderWavefront(const Scene& scene, const TraceSettings& settings, std::vector<glm::vec4>& pixels)
+{
+    // Pixels enter the waves tile by tile, so neighbouring paths start out coherent like in RenderTile()
+    std::vector<uint32_t> pixelOrder;
+    pixelOrder.reserve((size_t)settings.width * settings.height);
+    for (int tileY = 0; tileY < settings.height; tileY += TRACE_TILE_SIZE)
+        for (int tileX = 0; tileX < settings.width; tileX += TRACE_TILE_SIZE)
+            for (int y = tileY; y < std::min(tileY + TRACE_TILE_SIZE, settings.height); ++y)
+                for (int x = tileX; x < std::min(tileX + TRACE_TILE_SIZE, settings.width); ++x)
+                    pixelOrder.push_back((uint32_t)y * settings.width + x);
+
+    const size_t capacity = std::min(pixelOrder.size(), WAVEFRONT_SIZE);
+    const Reservoir* reservoirs = ShadingReservoirs(scene, settings);
+
+    // Ray origins are binned into Morton cells over everything that can be hit
+    Aabb sceneBounds;
+    for (const Bvh* bvh : { &scene.sphereBvh, &scene.tlas }) {
+        if (bvh->Empty()) continue;
+        sceneBounds.min = glm::min(sceneBounds.min, bvh->nodes[0].boundsMin);
+        sceneBounds.max = glm::max(sceneBounds.max, bvh->nodes[0].boundsMax);
+    }
+
+    PathQueue paths, compacted;
+    HitQueue hits;
+    ShadowQueue shadows;
+    WaveState wave;
+    paths.Reserve(capacity);
+    compacted.Reserve(capacity);
+    hits.Reserve(capacity);
+    shadows.Reserve(capacity);
+    wave.alive.resize(capacity);
+    wave.emissionWeights.resize(capacity);
+
+    for (size_t firstPixel = 0; firstPixel < pixelOrder.size(); firstPixel += capacity) {
+        wave.pixels = pixelOrder.data() + firstPixel;
+        wave.pixelCount = std::min(capacity, pixelOrder.size() - firstPixel);
+        wave.rngStates.resize(wave.pixelCount);
+        wave.totalIncomingLight.assign(wave.pixelCount, glm::vec3(0.0f));
+        for (size_t i = 0; i < wave.pixelCount; ++i)
+            wave.rngStates[i] = PixelSeed(settings, (int)(wave.pixels[i] % settings.width), (int)(wave.pixels[i] / settings.width));
+
+        // Samples run one after the other, like Trace() consumes each pixel's RNG stream
+        for (int rayIndex = 0; rayIndex < settings.maxTracePerPixel; rayIndex++) {
+            GenerateStage(pool, settings, wave, paths);
+
+            for (int i = 0; i < settings.maxTraceBounces && paths.size > 0; i++) {
+                if (raySorting && i > 0) SortStage(pool, sceneBounds, paths, wave, compacted);
+                ExtendStage(pool, scene, intersect8, packetTracing, cacheModel, paths, hits, stats);
+                const bool lastBounce = i + 1 == settings.maxTraceBounces;
+                ShadeStage(pool, scene, settings, reservoirs, rayIndex, i, lastBounce, paths, hits, shadows, wave);
+                ShadowStage(pool, scene, intersect8, shadows, paths, stats);
+                TerminateStage(pool, paths, hits, i, lastBounce, wave, stats);
+                CompactStage(pool, paths, wave, compacted);
+                std::swap(paths, compacted);
+            }
+        }
+
+        for (size_t i = 0; i < wave.pixelCount; ++i)
+            StorePixel(settings, (int)(wave.pixels[i] % settings.width), (int)(wave.pixels[i] / settings.width), wave.totalIncomingLight[i], pixels);
+    }
+}
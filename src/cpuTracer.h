@@ -0,0 +1,163 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "sampling.h"
+#include "scene.h"
+#include "threadPool.h"
+
+// Same tiling as the compute dispatch (local_size_x/y = 16)
+const int TRACE_TILE_SIZE = 16;
+
+// How next-event estimation picks the light; values match the lightSampler uniform
+enum class LightSampler {
+    Uniform = 0,            // every light equally likely
+    Power = 1,              // by emitted power, through the alias table
+    Bvh = 2                 // by estimated contribution at the shading point, walking the light BVH
+};
+
+// CPU mirror of the uniforms of computeRayTracing.glsl
+struct TraceSettings {
+    int       width  = 960;
+    int       height = 540;
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    glm::mat3 cameraRotation = glm::mat3(1.0f);
+    float     fov = 90.0f;
+    int       maxTraceBounces  = 1;
+    int       maxTracePerPixel = 1;
+    int       frameIndex = 0;           // > 0 blends into pixels as a running average
+    HemisphereSampler hemisphereSampler = HemisphereSampler::Random;
+    bool      nextEventEstimation = true;   // light sample per bounce from Scene::lights, MIS-weighted
+    LightSampler lightSampler = LightSampler::Bvh;
+    bool      restir = false;           // camera ray hits take their light sample from reservoirs (ReSTIR DI); needs nextEventEstimation
+    int       restirCandidates = 8;     // light samples resampled per pixel
+    int       restirSpatialSamples = 5; // neighbours merged per pixel, at most 16
+    int       rouletteMinDepth = 2;     // bounces every path gets before Russian roulette may end it
+};
+
+// Light sample of a pixel's camera ray hit standing for M candidates; mirrors Reservoir
+// in src/Shaders/restirCommon.glsl
+struct Reservoir {
+    glm::vec3 lightPoint = glm::vec3(0.0f);     // the sample: a point on spheres[sphere]
+    int       sphere = -1;                      // -1: no sample
+    glm::vec3 origin = glm::vec3(0.0f);         // shading point: the camera ray hit, offset along the normal
+    float     W = 0.0f;                         // contribution weight of lightPoint, 0 when it is not seen
+    glm::vec3 normal = glm::vec3(0.0f);         // of the surface; 0 when the camera ray missed
+    float     M = 0.0f;                         // candidates the reservoir stands for
+};
+
+// Why a path ended; values match the PATH_* constants of rayTracingCommon.glsl
+enum class PathEnd {
+    Escaped = 0,            // missed the scene
+    Roulette = 1,           // Russian roulette, or no throughput left
+    BounceLimit = 2         // reached maxTraceBounces
+};
+const int PATH_END_REASONS = 3;
+const int PATH_DEPTH_BINS  = 32;        // paths ending at bounce PATH_DEPTH_BINS - 1 or later share the last bin
+
+struct TraceCounters;
+
+// Totals of the per-tile TraceCounters, shared by all worker threads
+struct TraceStats {
+    std::atomic<uint64_t> rays{0};
+    std::atomic<uint64_t> packetRays{0};
+    std::atomic<uint64_t> shadowRays{0};
+    std::atomic<uint64_t> nodeVisits{0};
+    std::atomic<uint64_t> nodeCacheAccesses{0};     // 64-byte node lines fetched, cache model only
+    std::atomic<uint64_t> nodeCacheMisses{0};
+    std::atomic<uint64_t> pathEnds[PATH_END_REASONS][PATH_DEPTH_BINS] = {};  // paths by PathEnd and bounce they ended at
+
+    void Add(const TraceCounters& counters);
+    void Reset();
+};
+
+// Camera basis the way Camera::ProcessInputs builds it from yaw/pitch (degrees)
+glm::mat3 CameraRotationFromYawPitch(float yaw, float pitch);
+
+// Reference implementation of the compute shader on the CPU.
+// Output is RGBA32F with row 0 at the bottom, exactly like screenTex.
+class CpuTracer
+{
+    public:
+        explicit CpuTracer(ThreadPool& pool) : pool(pool) { SetSimdLevel(DetectSimdLevel()); }
+
+        // Node test kernel for the 8-wide BVHs; clamped to what the CPU supports
+        void SetSimdLevel(SimdLevel level) { simdLevel = std::min(level, DetectSimdLevel()); intersect8 = Bvh8IntersectFor(simdLevel); }
+        SimdLevel GetSimdLevel() const { return simdLevel; }
+
+        // Traces primary and coherent first-bounce rays as 8-wide packets (4x2 pixels)
+        // over the binary BVHs. Needs AVX2; ignored on CPUs without it.
+        void SetPacketTracing(bool enabled) { packetTracing = enabled && DetectSimdLevel() >= SimdLevel::Avx2; }
+        bool GetPacketTracing() const { return packetTracing; }
+
+        // Renders in waves of paths that advance one bounce per pass instead of one pixel
+        // at a time; same image. With packet tracing on, coherent runs of queued rays go as packets.
+        void SetWavefront(bool enabled) { wavefront = enabled; }
+        bool GetWavefront() const { return wavefront; }
+
+        // Bins secondary rays by origin cell (Morton order) and direction octant before
+        // every extension stage so neighbouring rays walk the same nodes. Wavefront only.
+        void SetRaySorting(bool enabled) { raySorting = enabled; }
+        bool GetRaySorting() const { return raySorting; }
+
+        // Runs node fetches through a software model of a 32 KiB L1 cache (see
+        // NodeCacheMisses()); slows tracing down, meant for comparing ray orders
+        void SetCacheModel(bool enabled) { cacheModel = enabled; }
+        bool GetCacheModel() const { return cacheModel; }
+
+        // Renders every 16x16 tile on the thread pool; with settings.restir on, resamples
+        // the reservoirs first, reusing the previous Render()'s where the surface matches
+        void Render(const Scene& scene, const TraceSettings& settings, std::vector<glm::vec4>& pixels);
+
+        // Renders one tile; pixels must already hold width * height entries. Shades with
+        // the reservoirs of the last Render() when settings.restir is on.
+        void RenderTile(const Scene& scene, const TraceSettings& settings, int tileX, int tileY, std::vector<glm::vec4>& pixels);
+
+        // Drops the reservoirs of earlier frames, e.g. when the scene changed under them
+        void ResetReservoirs() { restirHistory = false; }
+
+        // Candidates the reservoirs of the last Render() stand for, on average over every
+        // 4th pixel in x and y that hit something; what GpuRestir::EffectiveSampleCount() reports
+        float RestirEffectiveSampleCount() const { return restirSampleCount; }
+
+        // Number of ray/scene queries since the last ResetStats()
+        uint64_t RaysTraced() const { return stats.rays.load(std::memory_order_relaxed); }
+        uint64_t PacketRaysTraced() const { return stats.packetRays.load(std::memory_order_relaxed); }
+        uint64_t ShadowRaysTraced() const { return stats.shadowRays.load(std::memory_order_relaxed); }
+        uint64_t NodeVisits() const { return stats.nodeVisits.load(std::memory_order_relaxed); }
+        uint64_t NodeCacheAccesses() const { return stats.nodeCacheAccesses.load(std::memory_order_relaxed); }
+        uint64_t NodeCacheMisses() const { return stats.nodeCacheMisses.load(std::memory_order_relaxed); }
+        // Paths that ended for reason at the given bounce (the last bin also counts deeper ones)
+        uint64_t PathsEnded(PathEnd reason, int bounce) const { return stats.pathEnds[(int)reason][std::min(bounce, PATH_DEPTH_BINS - 1)].load(std::memory_order_relaxed); }
+        void ResetStats() { stats.Reset(); }
+
+    private:
+        void RenderWavefront(const Scene& scene, const TraceSettings& settings, std::vector<glm::vec4>& pixels);
+
+        // Candidate and spatial pass of restirCandidates.glsl / restirSpatial.glsl into reservoirs
+        void ResampleReservoirs(const Scene& scene, const TraceSettings& settings);
+
+        // Reservoirs the tracers shade with, nullptr when ReSTIR is off
+        const Reservoir* ShadingReservoirs(const Scene& scene, const TraceSettings& settings) const;
+
+        ThreadPool& pool;
+        SimdLevel       simdLevel = SimdLevel::Scalar;
+        Bvh8IntersectFn intersect8 = nullptr;
+        bool            packetTracing = false;
+        bool            wavefront = false;
+        bool            raySorting = false;
+        bool            cacheModel = false;
+        TraceStats      stats;
+
+        std::vector<Reservoir> reservoirs;          // final, per pixel
+        std::vector<Reservoir> temporalReservoirs;  // after temporal reuse, input of the spatial pass
+        int             reservoirWidth = 0;
+        int             reservoirHeight = 0;
+        bool            restirHistory = false;      // reservoirs hold the previous frame's, seen from previousCamera*
+        glm::vec3       previousCameraPosition = glm::vec3(0.0f);
+        glm::mat3       previousCameraRotation = glm::mat3(1.0f);
+        float           restirSampleCount = 0.0f;
+};
@@ -1,137 +1,677 @@
 #include "glTFLoader.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <string>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #ifdef _WIN32
-  #include <io.h>
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+#else
   #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+  #define GLTF_X86_KERNELS 1
+  #include <immintrin.h>
+#else
+  #define GLTF_X86_KERNELS 0
+#endif
+
+// Images stay encoded until DecodeGltfImages: tinygltf must not even open external
+// image files, and DeferImage below replaces its stb_image decoding
+#define TINYGLTF_NO_EXTERNAL_IMAGE
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "tiny_gltf.h"
 
+// Read-only mapping of a whole file: its pages come straight from the OS file cache
+// on first touch instead of being read into a heap copy
+class MappedFile
+{
+    public:
+        explicit MappedFile(const std::string& path)
+        {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            LARGE_INTEGER fileSize = {};
+            if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize)) Fail(path);
+            size = (size_t)fileSize.QuadPart;
+            if (size == 0) return;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping == nullptr) Fail(path);
+            data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            if (data == nullptr) Fail(path);
+#else
+            file = open(path.c_str(), O_RDONLY);
+            struct stat info;
+            if (file < 0 || fstat(file, &info) != 0) Fail(path);
+            size = (size_t)info.st_size;
+            if (size == 0) return;
+            void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (view == MAP_FAILED) Fail(path);
+            data = static_cast<const unsigned char*>(view);
+            madvise(view, size, MADV_WILLNEED);
+#endif
+        }
+
+        ~MappedFile() { Close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const unsigned char* Data() const { return data; }
+        size_t Size() const { return size; }
+
+    private:
+        void Close()
+        {
+#ifdef _WIN32
+            if (data) UnmapViewOfFile(data);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+            mapping = nullptr;
+#else
+            if (data) munmap(const_cast<unsigned char*>(data), size);
+            if (file >= 0) close(file);
+            file = -1;
+#endif
+            data = nullptr;
+        }
+
+        [[noreturn]] void Fail(const std::string& path)
+        {
+            Close();
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#else
+        int file = -1;
+#endif
+};
+
+// A parsed glTF and where its buffer bytes live. The BIN chunk of a .glb stays in the
+// mapped file and binBuffer's tinygltf::Buffer::data is empty; every other buffer
+// (external .bin, data URI, any buffer of a .gltf) is in its data as usual.
+struct GltfModel {
+    tinygltf::Model             model;
+    std::string                 baseDir;       // external buffers and images are relative to it
+    std::unique_ptr<MappedFile> file;
+    int                         binBuffer = -1;
+    const unsigned char*        binData = nullptr;
+    size_t                      binSize = 0;
+
+    const unsigned char* BufferData(int buffer, size_t* outSize) const
+    {
+        if (buffer == binBuffer) {
+            *outSize = binSize;
+            return binData;
+        }
+        const tinygltf::Buffer& buf = model.buffers.at(buffer);
+        *outSize = buf.data.size();
+        return buf.data.data();
+    }
+};
+
+// Start of the accessor's first element in its buffer. Throws when the elements run
+// past the end of the buffer, which for a mapped file would fault instead.
 static const unsigned char* GetBufferDataPtr(
-    const tinygltf::Model& model,
+    const GltfModel& gltf,
     const tinygltf::Accessor& accessor,
     size_t* outStrideBytes)
 {
-    const tinygltf::BufferView& view = model.bufferViews.at(accessor.bufferView);
-    const tinygltf::Buffer& buf = model.buffers.at(view.buffer);
+    if (accessor.bufferView < 0)
+        throw std::runtime_error("Accessor without bufferView (sparse or zero-filled) is not supported.");
 
-    const size_t viewOffset = view.byteOffset;
-    const size_t accOffset  = accessor.byteOffset;
-    const unsigned char* base = buf.data.data() + viewOffset + accOffset;
+    const tinygltf::BufferView& view = gltf.model.bufferViews.at(accessor.bufferView);
+    size_t bufferSize = 0;
+    const unsigned char* bufferData = gltf.BufferData(view.buffer, &bufferSize);
+
+    const int componentBytes = tinygltf::GetComponentSizeInBytes((uint32_t)accessor.componentType);
+    const int components = tinygltf::GetNumComponentsInType((uint32_t)accessor.type);
+    if (componentBytes <= 0 || components <= 0)
+        throw std::runtime_error("Accessor has an invalid componentType or type.");
+    const size_t elementBytes = (size_t)componentBytes * (size_t)components;
 
     // Stride: if 0, tightly packed based on accessor type
-    size_t stride = view.byteStride;
-    if (stride == 0) {
-        // Only handle vec3 float positions in this simple loader.
-        // vec3 float = 12 bytes
-        stride = 12;
-    }
+    const size_t stride = view.byteStride != 0 ? view.byteStride : elementBytes;
+    if (stride < elementBytes)
+        throw std::runtime_error("bufferView byteStride is smaller than its accessor's elements.");
+
+    const size_t offset = view.byteOffset + accessor.byteOffset;
+    const size_t end = accessor.count == 0 ? offset : offset + (accessor.count - 1) * stride + elementBytes;
+    if (end > view.byteOffset + view.byteLength || end > bufferSize)
+        throw std::runtime_error("Accessor reaches past the end of its bufferView.");
+
     if (outStrideBytes) *outStrideBytes = stride;
-    return base;
+    return bufferData + offset;
 }
 
-static void CopyNormalsVec3Float(
-    const tinygltf::Model& model,
-    const tinygltf::Accessor& normAcc,
-    std::vector<float>& outNormals)
+// glTF component value as float: normalized unsigned integers map to [0, 1], signed
+// ones to [-1, 1]; everything else converts as is
+template <typename Component, bool Normalized>
+static inline float ComponentToFloat(Component value)
 {
-    if (normAcc.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT)
-        throw std::runtime_error("NORMAL is not float.");
+    if constexpr (!Normalized || std::is_floating_point<Component>::value) {
+        return (float)value;
+    } else if constexpr (std::is_signed<Component>::value) {
+        return std::max((float)value / (float)std::numeric_limits<Component>::max(), -1.0f);
+    } else {
+        return (float)value / (float)std::numeric_limits<Component>::max();
+    }
+}
 
-    if (normAcc.type != TINYGLTF_TYPE_VEC3)
-        throw std::runtime_error("NORMAL is not VEC3.");
+#if GLTF_X86_KERNELS
 
-    size_t stride = 0;
-    const unsigned char* base = GetBufferDataPtr(model, normAcc, &stride);
+static bool HasAvx2()
+{
+    static const bool avx2 = [] { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }();
+    return avx2;
+}
 
-    outNormals.resize(normAcc.count * 3);
+// float3 elements stride (> 12) bytes apart, e.g. positions interleaved with normals:
+// one unaligned 4-float load and store per element, the next store overwrites the
+// extra lane. Every load but the last ends inside the following element, so only the
+// last element is copied on its own.
+static void DeinterleaveFloat3Sse(const unsigned char* base, size_t stride, size_t count, float* out)
+{
+    if (count == 0) return;
+    for (size_t i = 0; i + 1 < count; i++)
+        _mm_storeu_ps(out + i * 3, _mm_loadu_ps(reinterpret_cast<const float*>(base + i * stride)));
+    std::memcpy(out + (count - 1) * 3, base + (count - 1) * stride, 3 * sizeof(float));
+}
 
-    for (size_t i = 0; i < normAcc.count; i++) {
-        const float* n = reinterpret_cast<const float*>(base + i * stride);
-        outNormals[i * 3 + 0] = n[0];
-        outNormals[i * 3 + 1] = n[1];
-        outNormals[i * 3 + 2] = n[2];
+// Tightly packed u16 / u8 indices widened to u32, 8 per instruction
+__attribute__((target("avx2")))
+static void WidenU16Avx2(const unsigned char* src, size_t count, uint32_t* out)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2))));
+    _mm256_zeroupper();     // the rest of the loader is SSE code; GCC omits this for target() functions
+    for (; i < count; i++) {
+        uint16_t value;
+        std::memcpy(&value, src + i * 2, sizeof(value));
+        out[i] = value;
     }
 }
 
-static void CopyPositionsVec3Float(
-    const tinygltf::Model& model,
-    const tinygltf::Accessor& posAcc,
-    std::vector<float>& outPositions)
+__attribute__((target("avx2")))
+static void WidenU8Avx2(const unsigned char* src, size_t count, uint32_t* out)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i))));
+    _mm256_zeroupper();
+    for (; i < count; i++) out[i] = src[i];
+}
+
+// SSE2 fallback for the u16 widening
+static void WidenU16Sse(const unsigned char* src, size_t count, uint32_t* out)
 {
-    if (posAcc.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT)
-        throw std::runtime_error("POSITION is not float.");
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),     _mm_unpacklo_epi16(values, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(values, zero));
+    }
+    for (; i < count; i++) {
+        uint16_t value;
+        std::memcpy(&value, src + i * 2, sizeof(value));
+        out[i] = value;
+    }
+}
 
-    if (posAcc.type != TINYGLTF_TYPE_VEC3)
-        throw std::runtime_error("POSITION is not VEC3.");
+#endif
 
-    size_t stride = 0;
-    const unsigned char* base = GetBufferDataPtr(model, posAcc, &stride);
+// count elements of Count components stride bytes apart into out, Count values per
+// element. Instantiated per component type and normalization, so the inner loop has a
+// fixed shape; formats that need no conversion take a block copy or a SIMD kernel.
+template <typename Component, int Count, bool Normalized, typename Out>
+static void ReadElements(const unsigned char* base, size_t stride, size_t count, Out* out)
+{
+    const bool packed = stride == sizeof(Component) * Count;
+    if constexpr (std::is_same<Component, Out>::value && !Normalized) {
+        if (packed) {
+            std::memcpy(out, base, count * Count * sizeof(Out));
+            return;
+        }
+    }
+#if GLTF_X86_KERNELS
+    if constexpr (std::is_same<Component, float>::value && std::is_same<Out, float>::value && Count == 3) {
+        DeinterleaveFloat3Sse(base, stride, count, out);
+        return;
+    }
+    if constexpr (std::is_same<Component, uint16_t>::value && std::is_same<Out, uint32_t>::value && Count == 1) {
+        if (packed) {
+            if (HasAvx2()) WidenU16Avx2(base, count, out);
+            else           WidenU16Sse(base, count, out);
+            return;
+        }
+    }
+    if constexpr (std::is_same<Component, uint8_t>::value && std::is_same<Out, uint32_t>::value && Count == 1) {
+        if (packed && HasAvx2()) {
+            WidenU8Avx2(base, count, out);
+            return;
+        }
+    }
+#endif
 
-    outPositions.resize(posAcc.count * 3);
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* element = base + i * stride;
+        for (int c = 0; c < Count; c++) {
+            Component value;
+            std::memcpy(&value, element + c * sizeof(Component), sizeof(Component));   // elements need not be aligned
+            if constexpr (std::is_same<Out, float>::value) out[i * Count + c] = ComponentToFloat<Component, Normalized>(value);
+            else                                           out[i * Count + c] = (Out)value;
+        }
+    }
+}
 
-    for (size_t i = 0; i < posAcc.count; i++) {
-        const float* p = reinterpret_cast<const float*>(base + i * stride);
-        outPositions[i * 3 + 0] = p[0];
-        outPositions[i * 3 + 1] = p[1];
-        outPositions[i * 3 + 2] = p[2];
+template <typename Component, int Count, bool Normalized, typename Out>
+static void DecodeElements(const unsigned char* base, size_t stride, size_t count, void* out)
+{
+    ReadElements<Component, Count, Normalized, Out>(base, stride, count, static_cast<Out*>(out));
+}
+
+// One accessor to decode into a SimpleMeshData array. Preparing it validates the
+// accessor and picks the ReadElements instantiation; decoding only converts, so any
+// element range of it can run on any thread.
+struct AccessorJob {
+    const unsigned char*   base = nullptr;
+    size_t                 stride = 0;
+    size_t                 count = 0;          // elements
+    size_t                 outElementBytes = 0;
+    std::vector<float>*    floats = nullptr;   // destination, one of the two
+    std::vector<uint32_t>* indices = nullptr;
+    size_t                 vertexCount = 0;    // indices only: every index must be below it
+    void (*decode)(const unsigned char* base, size_t stride, size_t count, void* out) = nullptr;
+};
+
+// Elements per decode task: big enough to amortize the task, small enough that one
+// large accessor still spreads over every core
+static const size_t DECODE_CHUNK_ELEMENTS = 1 << 16;
+
+// Float attribute of Count components per element, whatever its component type,
+// normalization and stride (quantized attributes come out as floats)
+template <int Count>
+static AccessorJob PrepareAccessor(const GltfModel& gltf, const tinygltf::Accessor& acc, const char* name, std::vector<float>& out)
+{
+    if (tinygltf::GetNumComponentsInType((uint32_t)acc.type) != Count)
+        throw std::runtime_error(std::string(name) + " has " + std::to_string(tinygltf::GetNumComponentsInType((uint32_t)acc.type)) +
+                                 " components, expected " + std::to_string(Count) + ".");
+
+    AccessorJob job;
+    job.base = GetBufferDataPtr(gltf, acc, &job.stride);
+    job.count = acc.count;
+    job.outElementBytes = Count * sizeof(float);
+    job.floats = &out;
+
+    const bool normalized = acc.normalized;
+    switch (acc.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+            job.decode = DecodeElements<float, Count, false, float>; break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            job.decode = normalized ? DecodeElements<uint8_t, Count, true, float> : DecodeElements<uint8_t, Count, false, float>; break;
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+            job.decode = normalized ? DecodeElements<int8_t, Count, true, float> : DecodeElements<int8_t, Count, false, float>; break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            job.decode = normalized ? DecodeElements<uint16_t, Count, true, float> : DecodeElements<uint16_t, Count, false, float>; break;
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+            job.decode = normalized ? DecodeElements<int16_t, Count, true, float> : DecodeElements<int16_t, Count, false, float>; break;
+        default:
+            throw std::runtime_error(std::string(name) + " has an unsupported componentType.");
     }
+    return job;
 }
 
-static void CopyIndicesToU32(
-    const tinygltf::Model& model,
-    const tinygltf::Accessor& idxAcc,
-    std::vector<uint32_t>& outIndices)
+// Indices widened to u32, checked against vertexCount once decoded
+static AccessorJob PrepareIndices(const GltfModel& gltf, const tinygltf::Accessor& idxAcc, size_t vertexCount, std::vector<uint32_t>& outIndices)
 {
     if (idxAcc.type != TINYGLTF_TYPE_SCALAR)
         throw std::runtime_error("Indices accessor is not SCALAR.");
 
-    const tinygltf::BufferView& view = model.bufferViews.at(idxAcc.bufferView);
-    const tinygltf::Buffer& buf = model.buffers.at(view.buffer);
-
-    const unsigned char* data = buf.data.data() + view.byteOffset + idxAcc.byteOffset;
-
-    outIndices.resize(idxAcc.count);
+    AccessorJob job;
+    job.base = GetBufferDataPtr(gltf, idxAcc, &job.stride);
+    job.count = idxAcc.count;
+    job.outElementBytes = sizeof(uint32_t);
+    job.indices = &outIndices;
+    job.vertexCount = vertexCount;
 
     switch (idxAcc.componentType) {
-        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
-            auto src = reinterpret_cast<const uint8_t*>(data);
-            for (size_t i = 0; i < idxAcc.count; i++) outIndices[i] = src[i];
-        } break;
-        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
-            auto src = reinterpret_cast<const uint16_t*>(data);
-            for (size_t i = 0; i < idxAcc.count; i++) outIndices[i] = src[i];
-        } break;
-        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
-            auto src = reinterpret_cast<const uint32_t*>(data);
-            for (size_t i = 0; i < idxAcc.count; i++) outIndices[i] = src[i];
-        } break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  job.decode = DecodeElements<uint8_t, 1, false, uint32_t>; break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: job.decode = DecodeElements<uint16_t, 1, false, uint32_t>; break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   job.decode = DecodeElements<uint32_t, 1, false, uint32_t>; break;
         default:
             throw std::runtime_error("Unsupported index componentType (need U8/U16/U32).");
     }
+    return job;
 }
 
-SimpleMeshData LoadFirstMeshPositions(const std::string& path)
+static void DecodeChunk(const AccessorJob& job, size_t begin, size_t end)
 {
-    tinygltf::Model model;
-    tinygltf::TinyGLTF loader;
-    std::string err, warn;
+    unsigned char* out = job.floats ? reinterpret_cast<unsigned char*>(job.floats->data()) : reinterpret_cast<unsigned char*>(job.indices->data());
+    job.decode(job.base + begin * job.stride, job.stride, end - begin, out + begin * job.outElementBytes);
+}
 
-    bool ok = false;
-    const bool isGlb = path.size() >= 4 && (path.substr(path.size()-4) == ".glb");
-    if (isGlb) ok = loader.LoadBinaryFromFile(&model, &err, &warn, path);
-    else       ok = loader.LoadASCIIFromFile(&model, &err, &warn, path);
+// Sizes every destination, one accessor per task so the page faults of the fresh
+// arrays spread too, then decodes all accessors in DECODE_CHUNK_ELEMENTS pieces.
+// Chunks of one accessor write disjoint ranges; the SIMD kernels never store past
+// their own last element.
+static void DecodeAccessors(const std::vector<AccessorJob>& jobs, ThreadPool& pool)
+{
+    pool.ParallelFor(jobs.size(), [&](size_t j) {
+        const AccessorJob& job = jobs[j];
+        const size_t values = job.count * job.outElementBytes / (job.floats ? sizeof(float) : sizeof(uint32_t));
+        if (job.floats) job.floats->resize(values);
+        else            job.indices->resize(values);
+    });
+
+    struct Chunk { size_t job, begin, end; };
+    std::vector<Chunk> chunks;
+    for (size_t j = 0; j < jobs.size(); j++)
+        for (size_t begin = 0; begin < jobs[j].count; begin += DECODE_CHUNK_ELEMENTS)
+            chunks.push_back({ j, begin, std::min(begin + DECODE_CHUNK_ELEMENTS, jobs[j].count) });
+
+    pool.ParallelFor(chunks.size(), [&](size_t c) {
+        const Chunk& chunk = chunks[c];
+        const AccessorJob& job = jobs[chunk.job];
+        DecodeChunk(job, chunk.begin, chunk.end);
+        if (!job.indices) return;
+        const uint32_t maxIndex = *std::max_element(job.indices->begin() + chunk.begin, job.indices->begin() + chunk.end);
+        if (maxIndex >= job.vertexCount)
+            throw std::runtime_error("Index " + std::to_string(maxIndex) + " is past the primitive's " + std::to_string(job.vertexCount) + " vertices.");
+    });
+}
 
+static void ReportLoad(bool ok, const std::string& path, const std::string& err, const std::string& warn)
+{
     if (!warn.empty()) std::fprintf(stderr, "glTF warn: %s\n", warn.c_str());
     if (!err.empty())  std::fprintf(stderr, "glTF err:  %s\n", err.c_str());
     if (!ok) throw std::runtime_error("Failed to load glTF file: " + path);
+}
+
+// tinygltf image hook: keeps every image encoded. Only data-URI images need their bytes
+// kept here (as_is), nothing else holds them after parsing; bufferView images are
+// copied out of their buffer later, and only when a used material needs them.
+static bool DeferImage(tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void*)
+{
+    if (image->bufferView < 0) {
+        image->image.assign(bytes, bytes + size);
+        image->as_is = true;
+    }
+    return true;
+}
+
+static uint32_t ReadU32(const unsigned char* p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// .glb without copying the BIN chunk: tinygltf only ever sees the JSON chunk. The
+// buffer backed by the BIN chunk is handed to it as a one-byte data URI and pointed
+// back at the mapping afterwards. Images are left out of the JSON (tinygltf would read
+// BIN-chunk images from the stand-in buffer) and come back as undecoded entries.
+static void LoadGlbMapped(const std::string& path, GltfModel& gltf)
+{
+    gltf.file.reset(new MappedFile(path));
+    const unsigned char* bytes = gltf.file->Data();
+    const size_t size = gltf.file->Size();
+
+    const uint32_t GLB_MAGIC = 0x46546C67u;        // "glTF"
+    const uint32_t CHUNK_JSON = 0x4E4F534Au;       // "JSON"
+    const uint32_t CHUNK_BIN = 0x004E4942u;        // "BIN\0"
+    if (size < 20 || ReadU32(bytes) != GLB_MAGIC || ReadU32(bytes + 4) != 2)
+        throw std::runtime_error("Not a glTF 2.0 binary file: " + path);
+    const size_t length = std::min<size_t>(ReadU32(bytes + 8), size);
+
+    const size_t jsonLength = ReadU32(bytes + 12);
+    if (ReadU32(bytes + 16) != CHUNK_JSON || 20 + jsonLength > length)
+        throw std::runtime_error("glb has no valid JSON chunk: " + path);
+    const char* jsonText = reinterpret_cast<const char*>(bytes + 20);
+
+    const size_t binHeader = 20 + ((jsonLength + 3) & ~(size_t)3);
+    if (binHeader + 8 <= length && ReadU32(bytes + binHeader + 4) == CHUNK_BIN) {
+        gltf.binData = bytes + binHeader + 8;
+        gltf.binSize = std::min<size_t>(ReadU32(bytes + binHeader), length - binHeader - 8);
+    }
+
+    nlohmann::json json = nlohmann::json::parse(jsonText, jsonText + jsonLength, nullptr, false);
+    if (json.is_discarded() || !json.is_object())
+        throw std::runtime_error("glb JSON chunk does not parse: " + path);
+
+    // Only buffer 0 may live in the BIN chunk; it is the one without a uri
+    if (json.contains("buffers") && json["buffers"].is_array()) {
+        nlohmann::json& buffers = json["buffers"];
+        for (size_t i = 0; i < buffers.size(); i++) {
+            if (!buffers[i].is_object() || buffers[i].contains("uri")) continue;
+            const size_t byteLength = buffers[i].value("byteLength", (size_t)0);
+            if (gltf.binData == nullptr || byteLength > gltf.binSize)
+                throw std::runtime_error("glb buffer is larger than its BIN chunk: " + path);
+            gltf.binBuffer = (int)i;
+            gltf.binSize = byteLength;
+            buffers[i]["uri"] = "data:application/octet-stream;base64,AA==";
+            buffers[i]["byteLength"] = 1;
+            break;
+        }
+    }
+
+    nlohmann::json images = nlohmann::json::array();
+    if (json.contains("images")) {
+        images = json["images"];
+        json.erase("images");
+    }
+
+    const std::string text = json.dump();
+    tinygltf::TinyGLTF loader;
+    loader.SetImageLoader(DeferImage, nullptr);
+    std::string err, warn;
+    const bool ok = loader.LoadASCIIFromString(&gltf.model, &err, &warn, text.c_str(), (unsigned int)text.size(), gltf.baseDir);
+    ReportLoad(ok, path, err, warn);
+
+    if (gltf.binBuffer >= 0) {
+        tinygltf::Buffer& buffer = gltf.model.buffers.at(gltf.binBuffer);
+        buffer.uri.clear();
+        buffer.data.clear();
+        buffer.data.shrink_to_fit();
+    }
+
+    for (const nlohmann::json& entry : images) {
+        tinygltf::Image image;
+        if (entry.is_object()) {
+            image.name = entry.value("name", std::string());
+            image.uri = entry.value("uri", std::string());
+            image.mimeType = entry.value("mimeType", std::string());
+            image.bufferView = entry.value("bufferView", -1);
+        }
+        gltf.model.images.push_back(image);
+    }
+}
+
+static void LoadModel(const std::string& path, GltfModel& gltf)
+{
+    gltf.baseDir = tinygltf::GetBaseDir(path);
+    const bool isGlb = path.size() >= 4 && (path.substr(path.size()-4) == ".glb");
+    if (isGlb) {
+        LoadGlbMapped(path, gltf);
+        return;
+    }
+
+    tinygltf::TinyGLTF loader;
+    loader.SetImageLoader(DeferImage, nullptr);
+    std::string err, warn;
+    const bool ok = loader.LoadASCIIFromFile(&gltf.model, &err, &warn, path);
+    ReportLoad(ok, path, err, warn);
+}
+
+// Validates the primitive's accessors and queues their decoding into out
+static void PreparePrimitive(const GltfModel& gltf, const tinygltf::Primitive& prim, SimpleMeshData& out, std::vector<AccessorJob>& jobs)
+{
+    const tinygltf::Model& model = gltf.model;
+
+    // POSITION attribute is required for our loader
+    auto itPos = prim.attributes.find("POSITION");
+    if (itPos == prim.attributes.end())
+        throw std::runtime_error("Primitive has no POSITION attribute.");
+
+    const tinygltf::Accessor& posAcc = model.accessors.at(itPos->second);
+    jobs.push_back(PrepareAccessor<3>(gltf, posAcc, "POSITION", out.positions));
+
+    // The other attributes are optional
+    auto itNorm = prim.attributes.find("NORMAL");
+    if (itNorm != prim.attributes.end()) jobs.push_back(PrepareAccessor<3>(gltf, model.accessors.at(itNorm->second), "NORMAL", out.normals));
+
+    auto itUv = prim.attributes.find("TEXCOORD_0");
+    if (itUv != prim.attributes.end()) jobs.push_back(PrepareAccessor<2>(gltf, model.accessors.at(itUv->second), "TEXCOORD_0", out.texcoords));
+
+    auto itTangent = prim.attributes.find("TANGENT");
+    if (itTangent != prim.attributes.end()) jobs.push_back(PrepareAccessor<4>(gltf, model.accessors.at(itTangent->second), "TANGENT", out.tangents));
+
+    if (prim.indices >= 0) jobs.push_back(PrepareIndices(gltf, model.accessors.at(prim.indices), posAcc.count, out.indices));
+
+    if (prim.material >= 0 && prim.material < (int)model.materials.size()) out.material = prim.material;
+}
+
+static GltfMaterial LoadMaterial(const tinygltf::Material& material)
+{
+    GltfMaterial out;
+    const std::vector<double>& baseColor = material.pbrMetallicRoughness.baseColorFactor;
+    if (baseColor.size() == 4)
+        out.baseColorFactor = glm::vec4((float)baseColor[0], (float)baseColor[1], (float)baseColor[2], (float)baseColor[3]);
+    if (material.emissiveFactor.size() == 3)
+        out.emissiveFactor = glm::vec3((float)material.emissiveFactor[0], (float)material.emissiveFactor[1], (float)material.emissiveFactor[2]);
+
+    auto itStrength = material.extensions.find("KHR_materials_emissive_strength");
+    if (itStrength != material.extensions.end() && itStrength->second.Has("emissiveStrength"))
+        out.emissiveStrength = (float)itStrength->second.Get("emissiveStrength").GetNumberAsDouble();
+    return out;
+}
+
+// Image behind a texture of a used material, located once per image; -1 when the
+// texture has none. Embedded bytes are copied out now since the model and the mapped
+// file go away with the loader; external files are only read when decoded.
+static int32_t LocateImage(const GltfModel& gltf, int textureIndex, std::vector<int32_t>& imageSlots, std::vector<GltfImage>& images)
+{
+    const tinygltf::Model& model = gltf.model;
+    if (textureIndex < 0 || textureIndex >= (int)model.textures.size()) return -1;
+    const int source = model.textures[textureIndex].source;
+    if (source < 0 || source >= (int)model.images.size()) return -1;
+    int32_t& slot = imageSlots[source];
+    if (slot >= 0) return slot;
+
+    const tinygltf::Image& image = model.images[source];
+    GltfImage out;
+    out.name = !image.name.empty() ? image.name
+             : !image.uri.empty() && !tinygltf::IsDataURI(image.uri) ? image.uri
+             : "image " + std::to_string(source);
+    if (!image.image.empty()) {
+        out.encoded = image.image;
+    } else if (image.bufferView >= 0) {
+        const tinygltf::BufferView& view = model.bufferViews.at(image.bufferView);
+        size_t bufferSize = 0;
+        const unsigned char* data = gltf.BufferData(view.buffer, &bufferSize);
+        if (view.byteOffset + view.byteLength > bufferSize)
+            throw std::runtime_error("Image bufferView reaches past the end of its buffer.");
+        out.encoded.assign(data + view.byteOffset, data + view.byteOffset + view.byteLength);
+    } else if (tinygltf::IsDataURI(image.uri)) {
+        std::string mimeType;
+        tinygltf::DecodeDataURI(&out.encoded, mimeType, image.uri, 0, false);   // left empty on failure, reported when decoded
+    } else {
+        std::string decodedUri;
+        tinygltf::URIDecode(image.uri, &decodedUri, nullptr);
+        out.path = tinygltf::JoinPath(gltf.baseDir, decodedUri);
+    }
+
+    slot = (int32_t)images.size();
+    images.push_back(std::move(out));
+    return slot;
+}
+
+// Node local transform: either the matrix or T * R * S
+static glm::mat4 NodeTransform(const tinygltf::Node& node)
+{
+    if (node.matrix.size() == 16) {
+        glm::mat4 m;
+        for (int i = 0; i < 16; i++) m[i / 4][i % 4] = (float)node.matrix[i];   // column-major like glTF
+        return m;
+    }
+
+    glm::mat4 m(1.0f);
+    if (node.translation.size() == 3)
+        m = glm::translate(m, glm::vec3((float)node.translation[0], (float)node.translation[1], (float)node.translation[2]));
+    if (node.rotation.size() == 4)
+        m *= glm::mat4_cast(glm::quat((float)node.rotation[3], (float)node.rotation[0], (float)node.rotation[1], (float)node.rotation[2]));
+    if (node.scale.size() == 3)
+        m = glm::scale(m, glm::vec3((float)node.scale[0], (float)node.scale[1], (float)node.scale[2]));
+    return m;
+}
+
+struct NodeWalker {
+    const tinygltf::Model& model;
+    GltfSceneMeshes& out;
+    std::vector<std::vector<int>> primitiveSlots;   // [mesh][primitive] -> out.meshes index, -1 = not seen yet
+    std::vector<const tinygltf::Primitive*> slotPrimitives;   // per out.meshes entry, decoded once the walk is done
+
+    void Visit(int nodeIndex, const glm::mat4& parentTransform, int depth)
+    {
+        // glTF forbids cycles, but a broken file should not hang the loader
+        if (depth > 256) throw std::runtime_error("glTF node hierarchy too deep (cycle?).");
+
+        const tinygltf::Node& node = model.nodes.at(nodeIndex);
+        const glm::mat4 transform = parentTransform * NodeTransform(node);
+
+        if (node.mesh >= 0) {
+            const tinygltf::Mesh& mesh = model.meshes.at(node.mesh);
+            for (size_t p = 0; p < mesh.primitives.size(); p++) {
+                const tinygltf::Primitive& prim = mesh.primitives[p];
+                if (prim.mode != TINYGLTF_MODE_TRIANGLES) continue;
+
+                int& slot = primitiveSlots[node.mesh][p];
+                if (slot < 0) {
+                    slot = (int)out.meshes.size();
+                    out.meshes.emplace_back();
+                    slotPrimitives.push_back(&prim);
+                }
+                out.instances.push_back({ (uint32_t)slot, transform });
+            }
+        }
+
+        for (int child : node.children) Visit(child, transform, depth + 1);
+    }
+};
+
+SimpleMeshData LoadFirstMeshPositions(const std::string& path)
+{
+    GltfModel gltf;
+    LoadModel(path, gltf);
+    const tinygltf::Model& model = gltf.model;
 
     if (model.meshes.empty())
         throw std::runtime_error("glTF has no meshes.");
@@ -146,28 +686,100 @@ SimpleMeshData LoadFirstMeshPositions(const std::string& path)
     if (prim.mode != TINYGLTF_MODE_TRIANGLES)
         throw std::runtime_error("Primitive is not TRIANGLES (only TRIANGLES supported in simple loader).");
 
-    // POSITION attribute is required for our loader
-    auto itPos = prim.attributes.find("POSITION");
-    if (itPos == prim.attributes.end())
-        throw std::runtime_error("Primitive has no POSITION attribute.");
-
-    const tinygltf::Accessor& posAcc = model.accessors.at(itPos->second);   
-
     SimpleMeshData out;
-    CopyPositionsVec3Float(model, posAcc, out.positions);
+    std::vector<AccessorJob> jobs;
+    PreparePrimitive(gltf, prim, out, jobs);
+    ThreadPool pool(1);                 // just the calling thread
+    DecodeAccessors(jobs, pool);
+    return out;
+}
 
-    // Load normals if available
-    auto itNorm = prim.attributes.find("NORMAL");
-    if (itNorm != prim.attributes.end()) {
-        const tinygltf::Accessor& normAcc = model.accessors.at(itNorm->second);
-        CopyNormalsVec3Float(model, normAcc, out.normals);
+GltfSceneMeshes LoadGltfSceneMeshes(const std::string& path, ThreadPool& pool)
+{
+    GltfModel gltf;
+    LoadModel(path, gltf);
+    const tinygltf::Model& model = gltf.model;
+
+    GltfSceneMeshes out;
+    NodeWalker walker{ model, out, {}, {} };
+    for (const tinygltf::Mesh& mesh : model.meshes) walker.primitiveSlots.emplace_back(mesh.primitives.size(), -1);
+
+    // Roots of the default scene; files without scenes get every node that is nobody's child
+    std::vector<int> roots;
+    if (!model.scenes.empty()) {
+        const int sceneIndex = (model.defaultScene >= 0 && model.defaultScene < (int)model.scenes.size()) ? model.defaultScene : 0;
+        roots = model.scenes[sceneIndex].nodes;
+    } else {
+        std::vector<bool> isChild(model.nodes.size(), false);
+        for (const tinygltf::Node& node : model.nodes)
+            for (int child : node.children) isChild.at(child) = true;
+        for (size_t i = 0; i < model.nodes.size(); i++)
+            if (!isChild[i]) roots.push_back((int)i);
     }
 
-    // Indices are optional
-    if (prim.indices >= 0) {
-        const tinygltf::Accessor& idxAcc = model.accessors.at(prim.indices);
-        CopyIndicesToU32(model, idxAcc, out.indices);
+    for (int root : roots) walker.Visit(root, glm::mat4(1.0f), 0);
+
+    if (out.instances.empty())
+        throw std::runtime_error("glTF scene has no triangle mesh instances.");
+
+    // Every primitive's accessors at once, so many small primitives and a few huge ones
+    // both keep the pool busy
+    std::vector<AccessorJob> jobs;
+    for (size_t i = 0; i < out.meshes.size(); i++) PreparePrimitive(gltf, *walker.slotPrimitives[i], out.meshes[i], jobs);
+    DecodeAccessors(jobs, pool);
+
+    for (const tinygltf::Material& material : model.materials) out.materials.push_back(LoadMaterial(material));
+
+    // Textures only of the materials a loaded primitive uses
+    std::vector<bool> materialUsed(model.materials.size(), false);
+    for (const SimpleMeshData& mesh : out.meshes)
+        if (mesh.material >= 0) materialUsed[mesh.material] = true;
+    std::vector<int32_t> imageSlots(model.images.size(), -1);
+    for (size_t m = 0; m < model.materials.size(); m++) {
+        if (!materialUsed[m]) continue;
+        const tinygltf::Material& material = model.materials[m];
+        GltfMaterial& target = out.materials[m];
+        target.baseColorTexture         = LocateImage(gltf, material.pbrMetallicRoughness.baseColorTexture.index, imageSlots, out.images);
+        target.metallicRoughnessTexture = LocateImage(gltf, material.pbrMetallicRoughness.metallicRoughnessTexture.index, imageSlots, out.images);
+        target.normalTexture            = LocateImage(gltf, material.normalTexture.index, imageSlots, out.images);
+        target.occlusionTexture         = LocateImage(gltf, material.occlusionTexture.index, imageSlots, out.images);
+        target.emissiveTexture          = LocateImage(gltf, material.emissiveTexture.index, imageSlots, out.images);
     }
 
     return out;
-}
\ No newline at end of file
+}
+
+void DecodeGltfImages(std::vector<GltfImage>& images, ThreadPool& pool)
+{
+    std::vector<std::string> errors(images.size());
+    pool.ParallelFor(images.size(), [&](size_t i) {
+        GltfImage& image = images[i];
+        if (image.Decoded()) return;
+
+        std::vector<unsigned char> fileBytes;
+        if (!image.path.empty()) {
+            std::ifstream file(image.path, std::ios::binary);
+            if (!file) {
+                errors[i] = "file not found: " + image.path;
+                return;
+            }
+            fileBytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        const std::vector<unsigned char>& bytes = image.path.empty() ? image.encoded : fileBytes;
+
+        int width = 0, height = 0, channels = 0;
+        unsigned char* pixels = bytes.empty() ? nullptr : stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 4);
+        if (pixels == nullptr) {
+            errors[i] = "cannot decode image";
+            return;
+        }
+        image.width = width;
+        image.height = height;
+        image.pixels.assign(pixels, pixels + (size_t)width * height * 4);
+        stbi_image_free(pixels);
+        std::vector<unsigned char>().swap(image.encoded);
+    });
+
+    for (size_t i = 0; i < images.size(); i++)
+        if (!errors[i].empty()) std::fprintf(stderr, "glTF warn: image \"%s\": %s\n", images[i].name.c_str(), errors[i].c_str());
+}
@@ -2,11 +2,17 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <glm/glm.hpp>
+
+#include "threadPool.h"
 
 struct SimpleMeshData {
     std::vector<float> positions;      // xyz xyz xyz ...
     std::vector<float> normals;        // xyz xyz xyz ... (optional)
+    std::vector<float> texcoords;      // uv uv uv ... (optional, TEXCOORD_0)
+    std::vector<float> tangents;       // xyzw xyzw ... (optional, w = bitangent sign)
     std::vector<uint32_t> indices;     // if empty -> draw arrays
+    int32_t material = -1;             // GltfSceneMeshes::materials index, -1 = glTF default material
     bool hasIndices() const { return !indices.empty(); }
     bool hasNormals() const { return !normals.empty(); }
 };
@@ -14,3 +20,55 @@ struct SimpleMeshData {
 // Loads first mesh/first primitive from .glb/.gltf
 // Throws std::runtime_error on failure.
 SimpleMeshData LoadFirstMeshPositions(const std::string& path);
+
+
+// One node that references a loaded mesh primitive
+struct GltfMeshInstance {
+    uint32_t  mesh;                    // index into GltfSceneMeshes::meshes
+    glm::mat4 transform;               // node world transform
+};
+
+// Constant factors of a metallic-roughness material and its textures
+struct GltfMaterial {
+    glm::vec4 baseColorFactor = glm::vec4(1.0f);
+    glm::vec3 emissiveFactor = glm::vec3(0.0f);
+    float     emissiveStrength = 1.0f; // KHR_materials_emissive_strength
+
+    // GltfSceneMeshes::images indices, -1 = none; only set for materials a primitive uses
+    int32_t   baseColorTexture = -1;
+    int32_t   metallicRoughnessTexture = -1;
+    int32_t   normalTexture = -1;
+    int32_t   occlusionTexture = -1;
+    int32_t   emissiveTexture = -1;
+};
+
+// Texture image of a used material. Loading only locates it; the pixels come from
+// DecodeGltfImages, so scenes whose textures are never sampled never decode them.
+struct GltfImage {
+    std::string                name;
+    std::string                path;        // external file, read when decoded; empty when embedded
+    std::vector<unsigned char> encoded;     // embedded PNG/JPEG bytes, freed once decoded
+    int                        width = 0;
+    int                        height = 0;
+    std::vector<unsigned char> pixels;      // RGBA8, row by row
+    bool Decoded() const { return !pixels.empty(); }
+};
+
+// Every TRIANGLES primitive referenced by the scene, loaded once each, plus
+// one instance per node that uses it and the materials of the primitives
+struct GltfSceneMeshes {
+    std::vector<SimpleMeshData>   meshes;
+    std::vector<GltfMeshInstance> instances;
+    std::vector<GltfMaterial>     materials;   // model.materials, in file order
+    std::vector<GltfImage>        images;      // textures of the used materials, still encoded
+};
+
+// Walks the node hierarchy of the default scene (scene 0 when unset). A .glb is
+// memory-mapped and its BIN chunk read in place. The accessors of all primitives are
+// decoded in parallel on pool; images are only located, see DecodeGltfImages.
+// Throws std::runtime_error on failure or when no triangle primitive is instanced.
+GltfSceneMeshes LoadGltfSceneMeshes(const std::string& path, ThreadPool& pool);
+
+// Decodes the images not decoded yet in parallel on pool, one task per image.
+// Images that cannot be read or decoded are reported on stderr and stay undecoded.
+void DecodeGltfImages(std::vector<GltfImage>& images, ThreadPool& pool);
@@ -0,0 +1,95 @@
+#include "gpuRestir.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+// Size of the std430 Reservoir struct in restirCommon.glsl
+static const GLsizeiptr RESERVOIR_BYTES = 48;
+
+void GpuRestir::Resize(int newWidth, int newHeight)
+{
+    if (statsBuffer == 0) {
+        glCreateBuffers(1, &statsBuffer);
+        glCreateBuffers(1, &statsReadback);
+        glNamedBufferData(statsBuffer, 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glNamedBufferData(statsReadback, 2 * sizeof(GLuint), nullptr, GL_STREAM_READ);
+    }
+    if (newWidth == width && newHeight == height) return;
+
+    // Reservoirs belong to pixels, so a new resolution also ends the history
+    width = newWidth;
+    height = newHeight;
+    history = false;
+    const GLsizeiptr pixelCount = (GLsizeiptr)width * height;
+    glDeleteBuffers(1, &temporalBuffer);
+    glDeleteBuffers(1, &reservoirBuffer);
+    glCreateBuffers(1, &temporalBuffer);
+    glCreateBuffers(1, &reservoirBuffer);
+    glNamedBufferData(temporalBuffer,  pixelCount * RESERVOIR_BYTES, nullptr, GL_DYNAMIC_COPY);
+    glNamedBufferData(reservoirBuffer, pixelCount * RESERVOIR_BYTES, nullptr, GL_DYNAMIC_COPY);
+}
+
+void GpuRestir::Render(const RestirFrame& frame)
+{
+    if (frame.width <= 0 || frame.height <= 0) return;
+    Resize(frame.width, frame.height);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, temporalBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, reservoirBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, statsBuffer);
+    const GLuint zero[2] = {0u, 0u};
+    glNamedBufferSubData(statsBuffer, 0, sizeof(zero), zero);
+
+    const GLuint groupsX = (GLuint)(frame.width + 15) / 16;
+    const GLuint groupsY = (GLuint)(frame.height + 15) / 16;
+
+    GLuint program = programs.candidates;
+    glUseProgram(program);
+    glUniform2f(glGetUniformLocation(program, "resolution"), (float)frame.width, (float)frame.height);
+    glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(frame.cameraPosition));
+    glUniformMatrix3fv(glGetUniformLocation(program, "cameraRotation"), 1, GL_FALSE, glm::value_ptr(frame.cameraRotation));
+    glUniform1f(glGetUniformLocation(program, "fov"), frame.fov);
+    glUniform1i(glGetUniformLocation(program, "frameIndex"), frame.frameIndex);
+    glUniform1i(glGetUniformLocation(program, "numSphereNodes"), frame.numSphereNodes);
+    glUniform1i(glGetUniformLocation(program, "numTlasNodes"), frame.numTlasNodes);
+    glUniform3fv(glGetUniformLocation(program, "meshBaseColor"), 1, glm::value_ptr(frame.meshBaseColor));
+    glUniform1i(glGetUniformLocation(program, "numLights"), frame.numLights);
+    glUniform1i(glGetUniformLocation(program, "lightSampler"), frame.lightSampler);
+    glUniform1i(glGetUniformLocation(program, "restirCandidates"), frame.candidates);
+    glUniform1i(glGetUniformLocation(program, "restirHistory"), history ? 1 : 0);
+    glUniform3fv(glGetUniformLocation(program, "previousCameraPosition"), 1, glm::value_ptr(previousCameraPosition));
+    glUniformMatrix3fv(glGetUniformLocation(program, "previousCameraRotation"), 1, GL_FALSE, glm::value_ptr(previousCameraRotation));
+    glDispatchCompute(groupsX, groupsY, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    program = programs.spatial;
+    glUseProgram(program);
+    glUniform2f(glGetUniformLocation(program, "resolution"), (float)frame.width, (float)frame.height);
+    glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(frame.cameraPosition));
+    glUniform1i(glGetUniformLocation(program, "frameIndex"), frame.frameIndex);
+    glUniform1i(glGetUniformLocation(program, "restirSpatialSamples"), frame.spatialSamples);
+    glDispatchCompute(groupsX, groupsY, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // At most one copy in flight, so the one EffectiveSampleCount() reads is never overwritten
+    if (statsFence == nullptr) {
+        glCopyNamedBufferSubData(statsBuffer, statsReadback, 0, 0, 2 * sizeof(GLuint));
+        statsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    history = true;
+    previousCameraPosition = frame.cameraPosition;
+    previousCameraRotation = frame.cameraRotation;
+}
+
+float GpuRestir::EffectiveSampleCount()
+{
+    // A zero timeout only polls the fence; the read below then finds the copy complete
+    if (statsFence != nullptr && glClientWaitSync(statsFence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+        glDeleteSync(statsFence);
+        statsFence = nullptr;
+        GLuint stats[2] = {0u, 0u};
+        glGetNamedBufferSubData(statsReadback, 0, sizeof(stats), stats);
+        effectiveSampleCount = stats[1] > 0u ? (float)stats[0] / (float)stats[1] : 0.0f;
+    }
+    return effectiveSampleCount;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Linked programs of the ReSTIR passes (src/Shaders/restir*.glsl);
+// compiled by the caller so this file only needs a current GL 4.5 context
+struct RestirPrograms {
+    GLuint candidates = 0;
+    GLuint spatial    = 0;
+};
+
+// Uniforms of one frame; the camera ray and scene match what the tracers get
+struct RestirFrame {
+    int       width  = 0;
+    int       height = 0;
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    glm::mat3 cameraRotation = glm::mat3(1.0f);
+    float     fov = 90.0f;
+    int       frameIndex = 0;           // seeds the candidates: unlike the accumulation's, must not restart when the camera moves
+    int       numSphereNodes = 0;
+    int       numTlasNodes = 0;
+    glm::vec3 meshBaseColor = glm::vec3(0.8f);
+    int       numLights = 0;            // Scene::lights, uploaded to binding 13
+    int       lightSampler = 0;         // LightSampler
+    int       candidates = 8;           // light samples resampled per pixel
+    int       spatialSamples = 5;       // neighbours merged per pixel
+};
+
+// Reservoir-based spatiotemporal resampling of the camera ray hit's light sample
+// (ReSTIR DI). Candidates resamples light samples per pixel and merges last frame's
+// reservoir of the same surface, spatial merges random neighbours'; the result is left
+// on binding 18 for the tracers, which shade with it when their restir uniform is 1.
+// Expects the scene SSBOs on bindings 0-6, 13, 15 and 16; uses bindings 17-19.
+// Like the scene SSBOs its buffers live as long as the GL context.
+class GpuRestir
+{
+    public:
+        explicit GpuRestir(const RestirPrograms& programs) : programs(programs) {}
+
+        GpuRestir(const GpuRestir&) = delete;
+        GpuRestir& operator=(const GpuRestir&) = delete;
+
+        // Runs both passes; call before the tracer, every frame ReSTIR is on
+        void Render(const RestirFrame& frame);
+
+        // Drops the reservoirs of earlier frames, e.g. when the scene changed under them
+        void Reset() { history = false; }
+
+        // Candidates the final reservoirs stand for, on average over every 4th pixel in x and
+        // y that hit something. Never waits for the GPU: the value is that of the latest
+        // Render() whose counters have arrived, usually a frame or two old.
+        float EffectiveSampleCount();
+
+    private:
+        // Sizes the reservoir buffers to exactly one reservoir per pixel
+        void Resize(int newWidth, int newHeight);
+
+        RestirPrograms programs;
+        GLuint temporalBuffer = 0;
+        GLuint reservoirBuffer = 0;
+        GLuint statsBuffer = 0;
+        GLuint statsReadback = 0;       // statsBuffer copied at the end of a Render(), read once statsFence passed
+        GLsync statsFence = nullptr;    // pending copy into statsReadback, nullptr when none
+        float  effectiveSampleCount = 0.0f;
+        int width = 0;
+        int height = 0;
+        bool history = false;           // reservoirBuffer holds last frame's, seen from previousCamera*
+        glm::vec3 previousCameraPosition = glm::vec3(0.0f);
+        glm::mat3 previousCameraRotation = glm::mat3(1.0f);
+};
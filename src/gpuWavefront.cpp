@@ -0,0 +1,142 @@
+#include "gpuWavefront.h"
+
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+
+// Sizes of the std430 structs in wavefrontCommon.glsl
+static const GLsizeiptr PATH_STATE_BYTES  = 80;
+static const GLsizeiptr PATH_HIT_BYTES    = 64;
+static const GLsizeiptr SHADOW_RAY_BYTES  = 48;
+static const GLsizeiptr PIXEL_STATE_BYTES = 16;
+
+static const GLintptr   DISPATCH_ARGS_OFFSET = 2 * sizeof(GLuint);     // dispatchArgs after queueCount[2]
+static const GLintptr   PATH_ENDS_OFFSET     = 5 * sizeof(GLuint);     // pathEnds[] after dispatchArgs[3]
+static const GLsizeiptr PATH_ENDS_BYTES      = 3 * 32 * sizeof(GLuint); // PATH_END_REASONS * PATH_DEPTH_BINS counters
+
+void GpuWavefront::Reserve(size_t pathCount)
+{
+    if (counterBuffer == 0) {
+        glCreateBuffers(1, &counterBuffer);
+        glNamedBufferData(counterBuffer, PATH_ENDS_OFFSET + PATH_ENDS_BYTES, nullptr, GL_DYNAMIC_COPY);
+    }
+    if (pathCount <= capacity) return;
+
+    // Same doubling as the scene buffers, so window resizes don't reallocate every frame
+    capacity = std::max(pathCount, 2 * capacity);
+    glDeleteBuffers(2, pathBuffers);
+    glDeleteBuffers(1, &hitBuffer);
+    glDeleteBuffers(1, &shadowRayBuffer);
+    glDeleteBuffers(1, &pixelBuffer);
+    glCreateBuffers(2, pathBuffers);
+    glCreateBuffers(1, &hitBuffer);
+    glCreateBuffers(1, &shadowRayBuffer);
+    glCreateBuffers(1, &pixelBuffer);
+    for (GLuint buffer : pathBuffers) glNamedBufferData(buffer, capacity * PATH_STATE_BYTES, nullptr, GL_DYNAMIC_COPY);
+    glNamedBufferData(hitBuffer,   capacity * PATH_HIT_BYTES,    nullptr, GL_DYNAMIC_COPY);
+    glNamedBufferData(shadowRayBuffer, capacity * SHADOW_RAY_BYTES, nullptr, GL_DYNAMIC_COPY);
+    glNamedBufferData(pixelBuffer, capacity * PIXEL_STATE_BYTES, nullptr, GL_DYNAMIC_COPY);
+}
+
+void GpuWavefront::Render(const WavefrontFrame& frame)
+{
+    const size_t pixelCount = (size_t)frame.width * frame.height;
+    if (pixelCount == 0) return;
+    Reserve(pixelCount);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9,  hitBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, pixelBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, counterBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, shadowRayBuffer);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, counterBuffer);
+    const GLuint zero = 0;
+    glClearNamedBufferSubData(counterBuffer, GL_R32UI, PATH_ENDS_OFFSET, PATH_ENDS_BYTES, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    const GLbitfield passBarrier = GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT;
+    const GLuint groupsX = (GLuint)(frame.width + 15) / 16;
+    const GLuint groupsY = (GLuint)(frame.height + 15) / 16;
+
+    glUseProgram(programs.extend);
+    glUniform1i(glGetUniformLocation(programs.extend, "numSphereNodes"), frame.numSphereNodes);
+    glUniform1i(glGetUniformLocation(programs.extend, "numTlasNodes"), frame.numTlasNodes);
+    glUniform3fv(glGetUniformLocation(programs.extend, "meshBaseColor"), 1, glm::value_ptr(frame.meshBaseColor));
+
+    glUseProgram(programs.shade);
+    glUniform1i(glGetUniformLocation(programs.shade, "imageWidth"), frame.width);
+    glUniform1i(glGetUniformLocation(programs.shade, "frameIndex"), frame.frameIndex);
+    glUniform1i(glGetUniformLocation(programs.shade, "MAX_TRACE_PER_PIXEL"), frame.maxTracePerPixel);
+    glUniform1i(glGetUniformLocation(programs.shade, "hemisphereSampler"), frame.hemisphereSampler);
+    glUniform1i(glGetUniformLocation(programs.shade, "numLights"), frame.numLights);
+    glUniform1i(glGetUniformLocation(programs.shade, "nextEventEstimation"), frame.nextEventEstimation);
+    glUniform1i(glGetUniformLocation(programs.shade, "lightSampler"), frame.lightSampler);
+    glUniform1i(glGetUniformLocation(programs.shade, "restir"), frame.restir);
+    glUniform1i(glGetUniformLocation(programs.shade, "rouletteMinDepth"), frame.rouletteMinDepth);
+
+    glUseProgram(programs.connect);
+    glUniform1i(glGetUniformLocation(programs.connect, "numSphereNodes"), frame.numSphereNodes);
+    glUniform1i(glGetUniformLocation(programs.connect, "numTlasNodes"), frame.numTlasNodes);
+    glUniform1i(glGetUniformLocation(programs.connect, "imageWidth"), frame.width);
+
+    glUseProgram(programs.generate);
+    glUniform2f(glGetUniformLocation(programs.generate, "resolution"), (float)frame.width, (float)frame.height);
+    glUniform3fv(glGetUniformLocation(programs.generate, "cameraPosition"), 1, glm::value_ptr(frame.cameraPosition));
+    glUniformMatrix3fv(glGetUniformLocation(programs.generate, "cameraRotation"), 1, GL_FALSE, glm::value_ptr(frame.cameraRotation));
+    glUniform1f(glGetUniformLocation(programs.generate, "fov"), frame.fov);
+    glUniform1i(glGetUniformLocation(programs.generate, "frameIndex"), frame.frameIndex);
+
+    // The queue roles swap every bounce; the shaders get the input's counter index
+    int inQueue = 0;
+    auto bindQueues = [&]() {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, pathBuffers[inQueue]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, pathBuffers[1 - inQueue]);
+    };
+    bindQueues();
+
+    for (int rayIndex = 0; rayIndex < frame.maxTracePerPixel; rayIndex++) {
+        glUseProgram(programs.generate);
+        glUniform1i(glGetUniformLocation(programs.generate, "inQueue"), inQueue);
+        glUniform1i(glGetUniformLocation(programs.generate, "rayIndex"), rayIndex);
+        glDispatchCompute(groupsX, groupsY, 1);
+        glMemoryBarrier(passBarrier);
+
+        for (int bounce = 0; bounce < frame.maxTraceBounces; bounce++) {
+            glUseProgram(programs.extend);
+            glUniform1i(glGetUniformLocation(programs.extend, "inQueue"), inQueue);
+            glDispatchComputeIndirect(DISPATCH_ARGS_OFFSET);
+            glMemoryBarrier(passBarrier);
+
+            glUseProgram(programs.shade);
+            glUniform1i(glGetUniformLocation(programs.shade, "inQueue"), inQueue);
+            glUniform1i(glGetUniformLocation(programs.shade, "rayIndex"), rayIndex);
+            glUniform1i(glGetUniformLocation(programs.shade, "bounce"), bounce);
+            glUniform1i(glGetUniformLocation(programs.shade, "lastBounce"), bounce + 1 == frame.maxTraceBounces ? 1 : 0);
+            glDispatchComputeIndirect(DISPATCH_ARGS_OFFSET);
+            glMemoryBarrier(passBarrier);
+
+            glUseProgram(programs.connect);
+            glUniform1i(glGetUniformLocation(programs.connect, "inQueue"), inQueue);
+            glUniform1i(glGetUniformLocation(programs.connect, "bounce"), bounce);
+            glDispatchComputeIndirect(DISPATCH_ARGS_OFFSET);
+            glMemoryBarrier(passBarrier);
+
+            glUseProgram(programs.queue);
+            glUniform1i(glGetUniformLocation(programs.queue, "inQueue"), inQueue);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(passBarrier);
+
+            inQueue = 1 - inQueue;
+            bindQueues();
+        }
+    }
+
+    glUseProgram(programs.resolve);
+    glUniform2f(glGetUniformLocation(programs.resolve, "resolution"), (float)frame.width, (float)frame.height);
+    glUniform1i(glGetUniformLocation(programs.resolve, "MAX_TRACE_PER_PIXEL"), frame.maxTracePerPixel);
+    glUniform1i(glGetUniformLocation(programs.resolve, "frameIndex"), frame.frameIndex);
+    glDispatchCompute(groupsX, groupsY, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // Hand the path end counters over where the megakernel leaves its own
+    GLint pathEndBuffer = 0;
+    glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 20, &pathEndBuffer);
+    if (pathEndBuffer != 0) glCopyNamedBufferSubData(counterBuffer, (GLuint)pathEndBuffer, PATH_ENDS_OFFSET, 0, PATH_ENDS_BYTES);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Linked programs of the wavefront passes (src/Shaders/wavefront*.glsl);
+// compiled by the caller so this file only needs a current GL 4.5 context
+struct WavefrontPrograms {
+    GLuint generate = 0;
+    GLuint extend   = 0;
+    GLuint shade    = 0;
+    GLuint connect  = 0;
+    GLuint queue    = 0;
+    GLuint resolve  = 0;
+};
+
+// Uniforms of one frame; mirrors what the megakernel reads
+struct WavefrontFrame {
+    int       width  = 0;
+    int       height = 0;
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    glm::mat3 cameraRotation = glm::mat3(1.0f);
+    float     fov = 90.0f;
+    int       maxTraceBounces  = 1;
+    int       maxTracePerPixel = 1;
+    int       frameIndex = 0;
+    int       numSphereNodes = 0;
+    int       numTlasNodes = 0;
+    glm::vec3 meshBaseColor = glm::vec3(0.8f);
+    int       hemisphereSampler = 0;    // HemisphereSampler
+    int       numLights = 0;            // Scene::lights, uploaded to binding 13
+    int       nextEventEstimation = 1;
+    int       lightSampler = 0;         // LightSampler
+    int       restir = 0;               // 1: the camera ray hit shades with the reservoirs GpuRestir left on binding 18
+    int       rouletteMinDepth = 2;     // bounces every path gets before Russian roulette may end it
+};
+
+// Multi-pass alternative to computeRayTracing.glsl. Every sample runs generate once,
+// then extend + shade + connect + queue per bounce: those are dispatched indirectly
+// over the paths still alive, which connect compacts into the other queue with an
+// atomic counter after tracing the shadow rays shade set up. Resolve finally averages
+// into screenTex. Expects the scene SSBOs on bindings 0-6, 13, 15 and 16 (and 18 with
+// restir on) and screenTex on image unit 0 like the megakernel; uses bindings 7-11 and 14.
+// The path end counters are collected in the counter buffer and copied to the buffer
+// bound to binding 20 at the end, if any, so they read back like the megakernel's.
+// Like the scene SSBOs its buffers live as long as the GL context.
+class GpuWavefront
+{
+    public:
+        explicit GpuWavefront(const WavefrontPrograms& programs) : programs(programs) {}
+
+        GpuWavefront(const GpuWavefront&) = delete;
+        GpuWavefront& operator=(const GpuWavefront&) = delete;
+
+        void Render(const WavefrontFrame& frame);
+
+    private:
+        // Grows the path, hit, shadow ray and pixel buffers to hold pathCount paths
+        void Reserve(size_t pathCount);
+
+        WavefrontPrograms programs;
+        GLuint pathBuffers[2] = {};
+        GLuint hitBuffer = 0;
+        GLuint shadowRayBuffer = 0;
+        GLuint pixelBuffer = 0;
+        GLuint counterBuffer = 0;
+        size_t capacity = 0;
+};
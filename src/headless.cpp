@@ -0,0 +1,422 @@
+// Headless batch renderer: traces one frame on the CPU backend and writes it
+// to disk without ever opening a window or a GL context.
+//
+//   headless --spheres scene.txt --pos 0,0,-5 --yaw 90 --size 1920x1080 --spp 64 --out frame.png
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpuTracer.h"
+#include "glTFLoader.h"
+#include "scene.h"
+#include "stb_image_write.h"
+
+struct HeadlessOptions {
+    std::string spheresPath;
+    std::string gltfPath;
+    bool        decodeTextures = false; // decode the textures of the used glTF materials after loading
+    std::string outPath = "render.png";
+    glm::vec3   cameraPosition = glm::vec3(0.0f, 0.0f, -5.0f);
+    float       yaw   = 90.0f;          // 90 deg looks down +z, towards the default sphere
+    float       pitch = 0.0f;
+    int         width  = 960;
+    int         height = 540;
+    int         bounces = 1;
+    int         spp = 1;
+    int         frames = 1;             // accumulated like the interactive view, frameIndex 0..frames-1
+    float       fov = 90.0f;
+    unsigned    threads = 0;
+    BvhBuilder  builder = BvhBuilder::Sah;
+    int         mortonBits = 30;
+    bool        wideBvh = true;         // collapse into BVH8 for traversal
+    SimdLevel   simd = DetectSimdLevel();
+    bool        packets = false;        // 8-wide packets for primary / first-bounce rays
+    bool        wavefront = false;      // stage-by-stage wavefront instead of the per-pixel megakernel
+    bool        sortRays = false;       // reorder secondary rays before each wavefront extension
+    bool        cacheModel = false;     // count node cache misses in a software cache model
+    HemisphereSampler sampler = HemisphereSampler::Random;
+    bool        nextEventEstimation = true; // sample the emissive spheres at every bounce
+    LightSampler lightSampler = LightSampler::Bvh;
+    bool        restir = false;         // resample the camera ray hit's light sample with spatiotemporal reuse
+    int         rouletteMinDepth = 2;   // bounces before Russian roulette may end a path
+};
+
+static void PrintUsage()
+{
+    std::cerr <<
+        "Usage: headless [options]\n"
+        "  --spheres <file>    sphere list, one per line: x y z radius  r g b  er eg eb strength\n"
+        "  --gltf <file>       trace every mesh instance of a .gltf/.glb scene\n"
+        "  --decode-textures on|off  decode the textures of its used materials, timed; not sampled yet (default off)\n"
+        "  --pos x,y,z         camera position            (default 0,0,-5)\n"
+        "  --yaw <deg>         camera yaw                 (default 90)\n"
+        "  --pitch <deg>       camera pitch               (default 0)\n"
+        "  --size WxH          resolution                 (default 960x540)\n"
+        "  --bounces <n>       max trace bounces          (default 1)\n"
+        "  --spp <n>           samples per pixel          (default 1)\n"
+        "  --frames <n>        frames to accumulate       (default 1)\n"
+        "  --fov <deg>         vertical field of view     (default 90)\n"
+        "  --threads <n>       worker threads, 0 = all    (default 0)\n"
+        "  --builder <name>    BVH builder: sah | lbvh     (default sah)\n"
+        "  --morton <bits>     LBVH Morton code bits: 30 | 63 (default 30)\n"
+        "  --bvh <layout>      traversal: binary | wide    (default wide)\n"
+        "  --simd <level>      BVH8 kernel: auto | scalar | avx2 | avx512 (default auto)\n"
+        "  --packets on|off    trace coherent rays as 8-wide packets (default off)\n"
+        "  --wavefront on|off  wavefront path tracing      (default off)\n"
+        "  --sort-rays on|off  sort secondary rays by octant and origin, implies --wavefront on (default off)\n"
+        "  --cache-model on|off count BVH node misses in a 32 KiB L1 model (default off)\n"
+        "  --sampler <name>    bounce directions: random | stratified | r2 | sobol | sobol-bluenoise (default random)\n"
+        "  --nee on|off        next-event estimation with MIS (default on)\n"
+        "  --light-sampler <name>  light choice of NEE: uniform | power | bvh (default bvh)\n"
+        "  --restir on|off     ReSTIR light sample for camera ray hits, reused across frames and pixels (default off)\n"
+        "  --roulette <n>      bounces before Russian roulette may end a path (default 2)\n"
+        "  --out <file>        .png or .hdr output        (default render.png)\n";
+}
+
+// Termination histogram: share of the paths that ended at each bounce, by reason
+static void PrintPathEnds(const CpuTracer& tracer, const TraceSettings& settings)
+{
+    const int depths = std::min(settings.maxTraceBounces, PATH_DEPTH_BINS);
+    uint64_t paths = 0, segments = 0;
+    for (int bounce = 0; bounce < depths; ++bounce) {
+        for (int reason = 0; reason < PATH_END_REASONS; ++reason) {
+            const uint64_t ended = tracer.PathsEnded((PathEnd)reason, bounce);
+            paths += ended;
+            segments += ended * (bounce + 1);
+        }
+    }
+    std::printf("Paths:      %llu, %.2f rays per path without shadow rays, roulette from bounce %d\n", (unsigned long long)paths,
+                (double)segments / std::max<uint64_t>(paths, 1), settings.rouletteMinDepth);
+    std::printf("Path ends:  bounce  escaped  roulette  limit\n");
+    for (int bounce = 0; bounce < depths; ++bounce) {
+        double share[PATH_END_REASONS];
+        for (int reason = 0; reason < PATH_END_REASONS; ++reason)
+            share[reason] = 100.0 * tracer.PathsEnded((PathEnd)reason, bounce) / std::max<uint64_t>(paths, 1);
+        std::printf("            %2d%s    %6.2f%%  %6.2f%%   %6.2f%%\n", bounce, bounce + 1 == PATH_DEPTH_BINS ? "+" : " ",
+                    share[(int)PathEnd::Escaped], share[(int)PathEnd::Roulette], share[(int)PathEnd::BounceLimit]);
+    }
+}
+
+static bool EndsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static HeadlessOptions ParseOptions(int argc, char** argv)
+{
+    HeadlessOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if      (arg == "--spheres") options.spheresPath = value();
+        else if (arg == "--gltf")    options.gltfPath = value();
+        else if (arg == "--out")     options.outPath = value();
+        else if (arg == "--yaw")     options.yaw = std::stof(value());
+        else if (arg == "--pitch")   options.pitch = std::stof(value());
+        else if (arg == "--bounces") options.bounces = std::stoi(value());
+        else if (arg == "--spp")     options.spp = std::stoi(value());
+        else if (arg == "--frames")  options.frames = std::stoi(value());
+        else if (arg == "--roulette") options.rouletteMinDepth = std::stoi(value());
+        else if (arg == "--fov")     options.fov = std::stof(value());
+        else if (arg == "--threads") options.threads = (unsigned)std::stoul(value());
+        else if (arg == "--builder") {
+            std::string name = value();
+            if      (name == "sah")  options.builder = BvhBuilder::Sah;
+            else if (name == "lbvh") options.builder = BvhBuilder::Lbvh;
+            else throw std::runtime_error("--builder expects sah or lbvh");
+        }
+        else if (arg == "--morton") {
+            options.mortonBits = std::stoi(value());
+            if (options.mortonBits != 30 && options.mortonBits != 63) throw std::runtime_error("--morton expects 30 or 63");
+        }
+        else if (arg == "--bvh") {
+            std::string layout = value();
+            if      (layout == "binary") options.wideBvh = false;
+            else if (layout == "wide")   options.wideBvh = true;
+            else throw std::runtime_error("--bvh expects binary or wide");
+        }
+        else if (arg == "--simd") {
+            std::string level = value();
+            if      (level == "auto")   options.simd = DetectSimdLevel();
+            else if (level == "scalar") options.simd = SimdLevel::Scalar;
+            else if (level == "avx2")   options.simd = SimdLevel::Avx2;
+            else if (level == "avx512") options.simd = SimdLevel::Avx512;
+            else throw std::runtime_error("--simd expects auto, scalar, avx2 or avx512");
+        }
+        else if (arg == "--packets") {
+            std::string mode = value();
+            if      (mode == "on")  options.packets = true;
+            else if (mode == "off") options.packets = false;
+            else throw std::runtime_error("--packets expects on or off");
+        }
+        else if (arg == "--wavefront") {
+            std::string mode = value();
+            if      (mode == "on")  options.wavefront = true;
+            else if (mode == "off") options.wavefront = false;
+            else throw std::runtime_error("--wavefront expects on or off");
+        }
+        else if (arg == "--sort-rays") {
+            std::string mode = value();
+            if      (mode == "on")  options.sortRays = true;
+            else if (mode == "off") options.sortRays = false;
+            else throw std::runtime_error("--sort-rays expects on or off");
+        }
+        else if (arg == "--cache-model") {
+            std::string mode = value();
+            if      (mode == "on")  options.cacheModel = true;
+            else if (mode == "off") options.cacheModel = false;
+            else throw std::runtime_error("--cache-model expects on or off");
+        }
+        else if (arg == "--sampler") {
+            std::string name = value();
+            if      (name == "random")     options.sampler = HemisphereSampler::Random;
+            else if (name == "stratified") options.sampler = HemisphereSampler::Stratified;
+            else if (name == "r2")         options.sampler = HemisphereSampler::R2;
+            else if (name == "sobol")      options.sampler = HemisphereSampler::Sobol;
+            else if (name == "sobol-bluenoise") options.sampler = HemisphereSampler::SobolBlueNoise;
+            else throw std::runtime_error("--sampler expects random, stratified, r2, sobol or sobol-bluenoise");
+        }
+        else if (arg == "--nee") {
+            std::string mode = value();
+            if      (mode == "on")  options.nextEventEstimation = true;
+            else if (mode == "off") options.nextEventEstimation = false;
+            else throw std::runtime_error("--nee expects on or off");
+        }
+        else if (arg == "--light-sampler") {
+            std::string name = value();
+            if      (name == "uniform") options.lightSampler = LightSampler::Uniform;
+            else if (name == "power")   options.lightSampler = LightSampler::Power;
+            else if (name == "bvh")     options.lightSampler = LightSampler::Bvh;
+            else throw std::runtime_error("--light-sampler expects uniform, power or bvh");
+        }
+        else if (arg == "--restir") {
+            std::string mode = value();
+            if      (mode == "on")  options.restir = true;
+            else if (mode == "off") options.restir = false;
+            else throw std::runtime_error("--restir expects on or off");
+        }
+        else if (arg == "--decode-textures") {
+            std::string mode = value();
+            if      (mode == "on")  options.decodeTextures = true;
+            else if (mode == "off") options.decodeTextures = false;
+            else throw std::runtime_error("--decode-textures expects on or off");
+        }
+        else if (arg == "--pos") {
+            glm::vec3& p = options.cameraPosition;
+            if (std::sscanf(value().c_str(), "%f,%f,%f", &p.x, &p.y, &p.z) != 3)
+                throw std::runtime_error("--pos expects x,y,z");
+        }
+        else if (arg == "--size") {
+            if (std::sscanf(value().c_str(), "%dx%d", &options.width, &options.height) != 2)
+                throw std::runtime_error("--size expects WxH");
+        }
+        else if (arg == "--help" || arg == "-h") {
+            PrintUsage();
+            std::exit(0);
+        }
+        else throw std::runtime_error("Unknown option: " + arg);
+    }
+
+    if (options.width <= 0 || options.height <= 0) throw std::runtime_error("Resolution must be positive.");
+    if (options.bounces < 1 || options.spp < 1 || options.frames < 1) throw std::runtime_error("--bounces, --spp and --frames must be >= 1.");
+    if (options.rouletteMinDepth < 0) throw std::runtime_error("--roulette must be >= 0.");
+    if (!EndsWith(options.outPath, ".png") && !EndsWith(options.outPath, ".hdr"))
+        throw std::runtime_error("Output must be .png or .hdr: " + options.outPath);
+
+    return options;
+}
+
+static std::vector<Sphere> LoadSpheres(const std::string& path)
+{
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) throw std::runtime_error("Could not open sphere list: " + path);
+
+    std::vector<Sphere> spheres;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        std::istringstream in(line);
+        Sphere s;
+        s.baseColor.w = 1.0f;
+        in >> s.positionRadius.x >> s.positionRadius.y >> s.positionRadius.z >> s.positionRadius.w
+           >> s.baseColor.x >> s.baseColor.y >> s.baseColor.z
+           >> s.emissionColorStrength.x >> s.emissionColorStrength.y >> s.emissionColorStrength.z >> s.emissionColorStrength.w;
+        if (!in) throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected 11 numbers");
+        spheres.push_back(s);
+    }
+    return spheres;
+}
+
+static void WriteImage(const std::string& path, int width, int height, const std::vector<glm::vec4>& pixels)
+{
+    // screenTex has row 0 at the bottom, image files at the top
+    stbi_flip_vertically_on_write(1);
+
+    bool ok;
+    if (EndsWith(path, ".hdr")) {
+        std::vector<float> rgb(pixels.size() * 3);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            rgb[i * 3 + 0] = pixels[i].r;
+            rgb[i * 3 + 1] = pixels[i].g;
+            rgb[i * 3 + 2] = pixels[i].b;
+        }
+        ok = stbi_write_hdr(path.c_str(), width, height, 3, rgb.data()) != 0;
+    } else {
+        // Same clamp the fullscreen quad applies when presenting to an 8-bit framebuffer
+        std::vector<unsigned char> rgb(pixels.size() * 3);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            glm::vec3 c = glm::clamp(glm::vec3(pixels[i]), 0.0f, 1.0f);
+            rgb[i * 3 + 0] = (unsigned char)(c.r * 255.0f + 0.5f);
+            rgb[i * 3 + 1] = (unsigned char)(c.g * 255.0f + 0.5f);
+            rgb[i * 3 + 2] = (unsigned char)(c.b * 255.0f + 0.5f);
+        }
+        ok = stbi_write_png(path.c_str(), width, height, 3, rgb.data(), width * 3) != 0;
+    }
+    if (!ok) throw std::runtime_error("Failed to write image: " + path);
+}
+
+int main(int argc, char** argv)
+{
+    using Clock = std::chrono::steady_clock;
+
+    HeadlessOptions options;
+    try {
+        options = ParseOptions(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        PrintUsage();
+        return 1;
+    }
+
+    try {
+        const Clock::time_point startTime = Clock::now();
+
+        ThreadPool pool(options.threads);
+
+        Scene scene;
+        scene.bvhBuilder = options.builder;
+        scene.mortonBits = options.mortonBits;
+        double bvhSeconds = 0.0;
+        size_t textureCount = 0, texturesDecoded = 0, textureBytes = 0;
+        double textureSeconds = 0.0;
+        if (!options.spheresPath.empty()) scene.spheres = LoadSpheres(options.spheresPath);
+        if (!options.gltfPath.empty()) {
+            GltfSceneMeshes gltf = LoadGltfSceneMeshes(options.gltfPath, pool);
+            AddGltfMeshes(scene, gltf, glm::mat4(1.0f));
+
+            if (options.decodeTextures) {
+                const Clock::time_point decodeStart = Clock::now();
+                DecodeGltfImages(gltf.images, pool);
+                textureSeconds = std::chrono::duration<double>(Clock::now() - decodeStart).count();
+                textureCount = gltf.images.size();
+                for (const GltfImage& image : gltf.images) {
+                    if (!image.Decoded()) continue;
+                    texturesDecoded++;
+                    textureBytes += image.pixels.size();
+                }
+            }
+        }
+        if (options.spheresPath.empty() && options.gltfPath.empty()) {
+            // Same default test sphere as the interactive app
+            scene.spheres.push_back({
+                glm::vec4(0.0f, 0.0f, 5.0f, 1.0f),           // positionRadius
+                glm::vec4(0.8f, 0.2f, 0.2f, 1.0f),           // baseColor
+                glm::vec4(1.0f, 1.0f, 1.0f, 2.0f)            // emissionColorStrength
+            });
+        }
+
+        const Clock::time_point bvhStart = Clock::now();
+        BuildMeshBvh(scene, pool);
+        BuildSphereBvh(scene, pool);
+        BuildLights(scene);
+        if (options.wideBvh) BuildWideBvhs(scene);
+        bvhSeconds = std::chrono::duration<double>(Clock::now() - bvhStart).count();
+
+        TraceSettings settings;
+        settings.width = options.width;
+        settings.height = options.height;
+        settings.cameraPosition = options.cameraPosition;
+        settings.cameraRotation = CameraRotationFromYawPitch(options.yaw, options.pitch);
+        settings.fov = options.fov;
+        settings.maxTraceBounces = options.bounces;
+        settings.maxTracePerPixel = options.spp;
+        settings.hemisphereSampler = options.sampler;
+        settings.nextEventEstimation = options.nextEventEstimation;
+        settings.lightSampler = options.lightSampler;
+        settings.restir = options.restir;
+        settings.rouletteMinDepth = options.rouletteMinDepth;
+
+        CpuTracer tracer(pool);
+        tracer.SetSimdLevel(options.simd);
+        tracer.SetPacketTracing(options.packets);
+        tracer.SetWavefront(options.wavefront || options.sortRays);
+        tracer.SetRaySorting(options.sortRays);
+        tracer.SetCacheModel(options.cacheModel);
+        std::vector<glm::vec4> pixels;
+
+        const Clock::time_point renderStart = Clock::now();
+        for (int frame = 0; frame < options.frames; ++frame) {
+            settings.frameIndex = frame;
+            tracer.Render(scene, settings, pixels);
+        }
+        const double renderSeconds = std::chrono::duration<double>(Clock::now() - renderStart).count();
+
+        WriteImage(options.outPath, options.width, options.height, pixels);
+        const double wallSeconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+        std::printf("Scene:      %zu spheres, %zu triangles in %zu meshes, %zu mesh instances\n", scene.spheres.size(), scene.triangles.size(),
+                    scene.meshBlases.size(), scene.meshInstances.size());
+        if (options.decodeTextures)
+            std::printf("Textures:   %zu of %zu decoded in %.3f s (%.1f MiB RGBA8)\n", texturesDecoded, textureCount, textureSeconds,
+                        textureBytes / (1024.0 * 1024.0));
+        std::printf("Threads:    %u\n", pool.ThreadCount());
+        std::printf("BVH build:  %zu BLAS + %zu TLAS + %zu sphere nodes in %.3f s (%s)\n", scene.blasNodes.size(), scene.tlas.nodes.size(), scene.sphereBvh.nodes.size(),
+                    bvhSeconds, scene.bvhBuilder == BvhBuilder::Sah ? "SAH" : "LBVH");
+        if (options.wideBvh) std::printf("Traversal:  BVH8, %s node test\n", SimdLevelName(tracer.GetSimdLevel()));
+        else                 std::printf("Traversal:  binary BVH\n");
+        std::printf("Kernel:     %s\n", !tracer.GetWavefront() ? "megakernel" : tracer.GetRaySorting() ? "wavefront, sorted rays" : "wavefront");
+        static const char* samplerNames[] = { "random", "stratified", "R2 sequence", "Owen-scrambled Sobol", "Sobol, blue-noise shifted" };
+        std::printf("Sampler:    cosine-weighted, %s\n", samplerNames[(int)options.sampler]);
+        static const char* lightSamplerNames[] = { "uniform", "by power", "light BVH" };
+        if (options.nextEventEstimation) std::printf("Lights:     %zu emissive spheres, picked %s, %llu shadow rays\n", scene.lights.size(),
+                                                     lightSamplerNames[(int)options.lightSampler], (unsigned long long)tracer.ShadowRaysTraced());
+        else                             std::printf("Lights:     next-event estimation off\n");
+        if (options.restir && options.nextEventEstimation && !scene.lights.empty())
+            std::printf("ReSTIR:     %d candidates, %d neighbours, %.1f effective samples per pixel\n", settings.restirCandidates,
+                        settings.restirSpatialSamples, tracer.RestirEffectiveSampleCount());
+        if (tracer.GetPacketTracing()) std::printf("Packets:    %llu of the rays in 8-wide packets\n", (unsigned long long)tracer.PacketRaysTraced());
+        PrintPathEnds(tracer, settings);
+        std::printf("Rays:       %llu (%.1f nodes/ray)\n", (unsigned long long)tracer.RaysTraced(), (double)tracer.NodeVisits() / std::max<uint64_t>(tracer.RaysTraced(), 1));
+        if (tracer.GetCacheModel())
+            std::printf("Node cache: %llu misses of %llu line fetches (%.1f%%, %.2f misses/ray)\n", (unsigned long long)tracer.NodeCacheMisses(),
+                        (unsigned long long)tracer.NodeCacheAccesses(), 100.0 * tracer.NodeCacheMisses() / std::max<uint64_t>(tracer.NodeCacheAccesses(), 1),
+                        (double)tracer.NodeCacheMisses() / std::max<uint64_t>(tracer.RaysTraced(), 1));
+        std::printf("Render:     %.3f s (%.2f Mrays/s)\n", renderSeconds, tracer.RaysTraced() / renderSeconds * 1e-6);
+        std::printf("Wall time:  %.3f s\n", wallSeconds);
+        std::printf("Wrote %s\n", options.outPath.c_str());
+    }
+    catch (const std::exception& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
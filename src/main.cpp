@@ -18,10 +18,17 @@ extern "C"
 #include <glm/glm.hpp>
 #include <algorithm>
 #include <ctime>
+#include <chrono>
+#include <cstring>
 
 #include "camera.h"
 #include "camera.cpp"
+#include "blueNoise.h"
 #include "glTFLoader.h"
+#include "scene.h"
+#include "gpuRestir.h"
+#include "gpuWavefront.h"
+#include "threadPool.h"
 #include <imgui/imgui.h>
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl3.h>
@@ -38,19 +45,101 @@ int s_height = INIT_HEIGHT;
 
 int MAX_TRACE_BOUNCES = 1;
 int MAX_TRACE_PER_PIXEL = 1;
+int frameIndex = 0;                     // Frames accumulated since the last reset
+bool useWavefront = false;              // Trace with the multi-pass wavefront pipeline instead of the megakernel
+bool usePersistentThreads = false;      // Megakernel only: persistentGroups groups pull 16x16 tiles from an atomic counter
+int  persistentGroups = 256;            // Enough to fill the GPU; more only adds counter traffic
+int  hemisphereSampler = 0;             // Bounce direction sampler, values of HemisphereSampler
+bool nextEventEstimation = true;        // Sample the emissive spheres at every bounce, MIS-weighted with the bounce direction
+int  lightSampler = 2;                  // How that sample picks the sphere, values of LightSampler
+bool useRestir = false;                 // Camera ray hits take their light sample from reservoirs reused across frames and pixels
+int  restirCandidates = 8;              // Light samples resampled per pixel and frame
+int  restirSpatialSamples = 5;          // Neighbours merged per pixel
+int  rouletteMinDepth = 2;              // Bounces every path gets before Russian roulette may end it
+
+// pathEnds[] layout of rayTracingCommon.glsl: PATH_DEPTH_BINS counters per reason
+const int PATH_END_REASONS = 3;         // escaped, Russian roulette, bounce limit
+const int PATH_DEPTH_BINS  = 32;
 
 int   disp_fps = 0;
 float disp_ms  = 0.0f;
 
 string exeDir;
 
-struct Sphere {
-    glm::vec4  positionRadius;      // position (xyz) + radius (w)
-    glm::vec4  baseColor;           // baseColor (xyz) + padding (w)
-    glm::vec4  emissionColorStrength; // emissionColor (xyz) + emissionStrength (w)
+Scene scene;
+bool  sceneChanged = false;             // Set by UI edits of scene contents, restarts accumulation
+
+// Everything the accumulated image depends on besides the scene contents; a difference restarts accumulation
+struct FrameState {
+    glm::vec3 cameraPosition;
+    glm::mat3 cameraRotation;
+    glm::vec3 meshBaseColor;
+    int width, height;
+    int bounces, perPixel;
+    int sampler;
+    bool nextEventEstimation;
+    int lightSampler;
+    bool restir;
+    int restirCandidates, restirSpatialSamples;
+    int rouletteMinDepth;
 };
 
-std::vector<Sphere> spheres;
+// SSBO that reallocates (doubling) when its contents no longer fit
+struct GrowableBuffer {
+    GLuint     id = 0;
+    GLsizeiptr capacity = 0;
+};
+
+bool FrameStateChanged(const FrameState& a, const FrameState& b)
+{
+    if (a.cameraPosition != b.cameraPosition || a.cameraRotation != b.cameraRotation) return true;
+    if (a.meshBaseColor != b.meshBaseColor) return true;
+    if (a.width != b.width || a.height != b.height) return true;
+    if (a.nextEventEstimation != b.nextEventEstimation || a.lightSampler != b.lightSampler) return true;
+    if (a.restir != b.restir || a.restirCandidates != b.restirCandidates || a.restirSpatialSamples != b.restirSpatialSamples) return true;
+    return a.bounces != b.bounces || a.perPixel != b.perPixel || a.sampler != b.sampler || a.rouletteMinDepth != b.rouletteMinDepth;
+}
+
+void UploadGrowableBuffer(GrowableBuffer& buffer, GLuint binding, const void* data, GLsizeiptr size)
+{
+    if (buffer.id == 0) glCreateBuffers(1, &buffer.id);
+    if (buffer.capacity == 0 || size > buffer.capacity) {
+        buffer.capacity = max<GLsizeiptr>(max<GLsizeiptr>(size, 2 * buffer.capacity), 256);
+        glNamedBufferData(buffer.id, buffer.capacity, nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer.id);
+    }
+    if (size > 0) glNamedBufferSubData(buffer.id, 0, size, data);
+}
+
+// Triangles and BLAS nodes only change when meshes are loaded or their BVHs rebuilt
+void UploadMesh(GrowableBuffer& triangleSSBO, GrowableBuffer& blasSSBO)
+{
+    UploadGrowableBuffer(triangleSSBO, 1, scene.triangles.data(), scene.triangles.size() * sizeof(Triangle));
+    UploadGrowableBuffer(blasSSBO,     2, scene.blasNodes.data(), scene.blasNodes.size() * sizeof(BvhNode));
+}
+
+// The top level is all that changes when instances move
+void UploadTlas(GrowableBuffer& tlasSSBO, GrowableBuffer& tlasInstanceSSBO)
+{
+    UploadGrowableBuffer(tlasSSBO,         5, scene.tlas.nodes.data(),     scene.tlas.nodes.size() * sizeof(BvhNode));
+    UploadGrowableBuffer(tlasInstanceSSBO, 6, scene.tlasInstances.data(), scene.tlasInstances.size() * sizeof(TlasInstance));
+}
+
+// Full upload of the spheres and their BVH, after spheres were added or removed
+void UploadSpheres(GrowableBuffer& sphereSSBO, GrowableBuffer& sphereBvhSSBO, GrowableBuffer& sphereIndexSSBO)
+{
+    UploadGrowableBuffer(sphereSSBO,      0, scene.spheres.data(),               scene.spheres.size() * sizeof(Sphere));
+    UploadGrowableBuffer(sphereBvhSSBO,   3, scene.sphereBvh.nodes.data(),       scene.sphereBvh.nodes.size() * sizeof(BvhNode));
+    UploadGrowableBuffer(sphereIndexSSBO, 4, scene.sphereBvh.primIndices.data(), scene.sphereBvh.primIndices.size() * sizeof(uint32_t));
+}
+
+// Light list, its alias table and BVH; sphereLights only changes with the light list
+void UploadLights(GrowableBuffer& lightSSBO, GrowableBuffer& sphereLightSSBO, GrowableBuffer& lightBvhSSBO)
+{
+    UploadGrowableBuffer(lightSSBO,       13, scene.lights.data(),       scene.lights.size() * sizeof(Light));
+    UploadGrowableBuffer(sphereLightSSBO, 15, scene.sphereLights.data(), scene.sphereLights.size() * sizeof(int32_t));
+    UploadGrowableBuffer(lightBvhSSBO,    16, scene.lightBvh.data(),     scene.lightBvh.size() * sizeof(LightBvhNode));
+}
 
 GLfloat vertices[] =
 {
@@ -186,6 +275,11 @@ GLuint linkShaderProgram(std::initializer_list<GLuint> shaders)
     return shaderProg;
 }
 
+GLuint LoadComputeProgram(const string& filename)
+{
+    string source = LoadShaderWithIncludes(filename);
+    return linkShaderProgram({ compileShader(GL_COMPUTE_SHADER, source.c_str()) });
+}
 
 
 int main()
@@ -206,6 +300,12 @@ int main()
         return -1;
     }
 
+    // llvmpipe ends every loop of an invocation once 65535 iterations were spent across all its
+    // loops, and runs the groups of a dispatch one after another per thread, so the first
+    // persistent group drains the whole tile counter and its loops get cut off mid-frame. The
+    // software renderer sticks to one invocation per pixel.
+    const bool softwareRenderer = strstr((const char*)glGetString(GL_RENDERER), "llvmpipe") != nullptr;
+
     // Setup ImGui
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -240,6 +340,33 @@ int main()
 
     GLuint computeShader = compileShader(GL_COMPUTE_SHADER, computeShaderSource);
     GLuint computeProgram = linkShaderProgram({ computeShader });
+
+    WavefrontPrograms wavefrontPrograms;
+    wavefrontPrograms.generate = LoadComputeProgram(exeDir + "/src/Shaders/wavefrontGenerate.glsl");
+    wavefrontPrograms.extend   = LoadComputeProgram(exeDir + "/src/Shaders/wavefrontExtend.glsl");
+    wavefrontPrograms.shade    = LoadComputeProgram(exeDir + "/src/Shaders/wavefrontShade.glsl");
+    wavefrontPrograms.connect  = LoadComputeProgram(exeDir + "/src/Shaders/wavefrontConnect.glsl");
+    wavefrontPrograms.queue    = LoadComputeProgram(exeDir + "/src/Shaders/wavefrontQueue.glsl");
+    wavefrontPrograms.resolve  = LoadComputeProgram(exeDir + "/src/Shaders/wavefrontResolve.glsl");
+    GpuWavefront gpuWavefront(wavefrontPrograms);
+
+    RestirPrograms restirPrograms;
+    restirPrograms.candidates = LoadComputeProgram(exeDir + "/src/Shaders/restirCandidates.glsl");
+    restirPrograms.spatial    = LoadComputeProgram(exeDir + "/src/Shaders/restirSpatial.glsl");
+    GpuRestir gpuRestir(restirPrograms);
+    float restirSampleCount = 0.0f;     // GpuRestir::EffectiveSampleCount(), a frame or two behind
+    int   restirFrameIndex = 0;         // Frames GpuRestir ran, fresh candidates every frame
+
+    GLuint workCounterSSBO;
+    glCreateBuffers(1, &workCounterSSBO);
+    glNamedBufferData(workCounterSSBO, sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, workCounterSSBO);
+
+    // How the paths of every 4th pixel in x and y ended, filled by both pipelines
+    GLuint pathEndSSBO;
+    glCreateBuffers(1, &pathEndSSBO);
+    glNamedBufferData(pathEndSSBO, PATH_END_REASONS * PATH_DEPTH_BINS * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, pathEndSSBO);
     
 //////////////////////////////////// Create Texture for Compute shader ////////////////////////////////////
 
@@ -250,17 +377,48 @@ int main()
     glTextureParameteri (screenTex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTextureParameteri (screenTex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTextureStorage2D  (screenTex, 1, GL_RGBA32F, s_width, s_height);
-    glBindImageTexture  (0, screenTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glBindImageTexture  (0, screenTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);  // Also the accumulation target
+
+    // Rank tile of the "Sobol + Blue Noise" sampler; unit 0 is left to the fullscreen pass and ImGui
+    GLuint blueNoiseTex;
+    glCreateTextures    (GL_TEXTURE_2D, 1, &blueNoiseTex);
+    glTextureParameteri (blueNoiseTex, GL_TEXTURE_MIN_FILTER, GL_NEAREST);     // integer textures cannot filter
+    glTextureParameteri (blueNoiseTex, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureStorage2D  (blueNoiseTex, 1, GL_RG16UI, BLUE_NOISE_SIZE, BLUE_NOISE_SIZE);
+    glTextureSubImage2D (blueNoiseTex, 0, 0, 0, BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, GL_RG_INTEGER, GL_UNSIGNED_SHORT, BlueNoiseTile().data());
+    glBindTextureUnit   (1, blueNoiseTex);
 
 //////////////////////////////////// Create SSBO for Sphere Data ////////////////////////////////////
 
-    GLuint sphereSSBO;
-    glGenBuffers(1, &sphereSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sphereSSBO);
-    // Initial allocation (can hold up to 256 spheres)
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 256 * sizeof(Sphere), nullptr, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sphereSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    // Grown on demand; edits refit the sphere BVH and upload only what changed
+    GrowableBuffer sphereSSBO, sphereBvhSSBO, sphereIndexSSBO;
+    GrowableBuffer lightSSBO, sphereLightSSBO, lightBvhSSBO;
+    bool sphereListChanged = true;          // Spheres added/removed: full BVH rebuild + upload
+    std::vector<uint32_t> dirtySpheres;     // Spheres edited this frame
+    std::vector<uint32_t> dirtySphereNodes; // BVH nodes rewritten by refits this frame
+    std::vector<uint32_t> dirtyLightNodes;  // Light BVH nodes rewritten by UpdateLight this frame
+    int selectedSphere = 0;
+    float lastBvhBuildMs = 0.0f;
+
+/////////////////////////////// Load Meshes & Create SSBOs for Triangles + BLAS/TLAS //////////////////////////////
+
+    ThreadPool threadPool;
+    try {
+        GltfSceneMeshes gltf = LoadGltfSceneMeshes(exeDir + "/src/Assets/scene.gltf", threadPool);
+        // The dragon is ~140 units wide; shrink it next to the default sphere
+        glm::mat4 meshTransform = glm::translate(glm::mat4(1.0f), glm::vec3(2.5f, -1.0f, 7.0f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.02f));
+        AddGltfMeshes(scene, gltf, meshTransform);
+        BuildMeshBvh(scene, threadPool);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Mesh not loaded: " << e.what() << std::endl;
+    }
+
+    GrowableBuffer triangleSSBO, blasSSBO, tlasSSBO, tlasInstanceSSBO;
+    UploadMesh(triangleSSBO, blasSSBO);
+    UploadTlas(tlasSSBO, tlasInstanceSSBO);
+    bool instancesChanged = false;          // Instances moved/added: rebuild + upload only the TLAS
+    int selectedInstance = 0;
 
 /////////////////////////////////////// SETUP FULLSCREEN QUAD FOR DISPLAY ///////////////////////////////////////
 
@@ -293,12 +451,14 @@ int main()
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
     // Add a default test sphere for debugging
-    spheres.push_back({
+    scene.spheres.push_back({
         glm::vec4(0.0f, 0.0f, 5.0f, 1.0f),           // positionRadius
         glm::vec4(0.8f, 0.2f, 0.2f, 1.0f),           // baseColor
         glm::vec4(1.0f, 1.0f, 1.0f, 2.0f)            // emissionColorStrength
     });
 
+    FrameState lastFrameState = {};
+
     while(!glfwWindowShouldClose(window))
     {
         glfwGetFramebufferSize(window, &s_width, &s_height);
@@ -310,28 +470,129 @@ int main()
         // Process camera inputs (WASD for movement, Right mouse for look)
         camera.ProcessInputs(window, s_width, s_height);
 
-        // Run compute shader
-        glUseProgram(computeProgram);
-        
-        // Update sphere SSBO
-        if (!spheres.empty()) {
-            glBindBuffer(GL_SHADER_STORAGE_BUFFER, sphereSSBO);
-            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, spheres.size() * sizeof(Sphere), spheres.data());
-            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        // Update sphere SSBOs: full rebuild when the list changed, otherwise only the edited spheres and refit nodes
+        if (sphereListChanged) {
+            BuildSphereBvh(scene, threadPool);
+            UploadSpheres(sphereSSBO, sphereBvhSSBO, sphereIndexSSBO);
+        } else {
+            for (uint32_t i : dirtySpheres)
+                glNamedBufferSubData(sphereSSBO.id, i * sizeof(Sphere), sizeof(Sphere), &scene.spheres[i]);
+            for (uint32_t n : dirtySphereNodes)
+                glNamedBufferSubData(sphereBvhSSBO.id, n * sizeof(BvhNode), sizeof(BvhNode), &scene.sphereBvh.nodes[n]);
+        }
+
+        // Lights: edits of an emitter refit its light BVH path, turning a sphere into a light or back rebuilds
+        bool lightListChanged = sphereListChanged;
+        for (uint32_t i : dirtySpheres)
+            if (!lightListChanged && !UpdateLight(scene, i, &dirtyLightNodes)) lightListChanged = true;
+        if (lightListChanged) {
+            BuildLights(scene);
+            UploadLights(lightSSBO, sphereLightSSBO, lightBvhSSBO);
+        } else if (!dirtyLightNodes.empty()) {
+            glNamedBufferSubData(lightSSBO.id, 0, scene.lights.size() * sizeof(Light), scene.lights.data());   // alias table
+            for (uint32_t n : dirtyLightNodes)
+                glNamedBufferSubData(lightBvhSSBO.id, n * sizeof(LightBvhNode), sizeof(LightBvhNode), &scene.lightBvh[n]);
         }
+        dirtyLightNodes.clear();
+        sceneChanged |= sphereListChanged || !dirtySpheres.empty();
+        sphereListChanged = false;
+        dirtySpheres.clear();
+        dirtySphereNodes.clear();
+
+        if (instancesChanged) {
+            BuildTlas(scene, threadPool);
+            UploadTlas(tlasSSBO, tlasInstanceSSBO);
+            sceneChanged = true;
+            instancesChanged = false;
+        }
+
+        // Restart accumulation when the camera, the scene or the trace settings changed
+        FrameState frameState = { camera.Position, camera.CameraToWorld, glm::vec3(scene.meshBaseColor), s_width, s_height, MAX_TRACE_BOUNCES, MAX_TRACE_PER_PIXEL, hemisphereSampler, nextEventEstimation, lightSampler,
+                                  useRestir, restirCandidates, restirSpatialSamples, rouletteMinDepth };
+        if (sceneChanged) gpuRestir.Reset();    // camera moves keep the reservoirs, they are reprojected
+        if (sceneChanged || FrameStateChanged(frameState, lastFrameState)) {
+            frameIndex = 0;
+            lastFrameState = frameState;
+            sceneChanged = false;
+        }
+
+        // Reservoirs for the camera ray hits, shared by both pipelines
+        const bool restir = useRestir && nextEventEstimation && !scene.lights.empty();
+        if (restir) {
+            RestirFrame frame;
+            frame.width = s_width;
+            frame.height = s_height;
+            frame.cameraPosition = camera.Position;
+            frame.cameraRotation = camera.CameraToWorld;
+            frame.frameIndex = restirFrameIndex++;
+            frame.numSphereNodes = (int)scene.sphereBvh.nodes.size();
+            frame.numTlasNodes = (int)scene.tlas.nodes.size();
+            frame.meshBaseColor = glm::vec3(scene.meshBaseColor);
+            frame.numLights = (int)scene.lights.size();
+            frame.lightSampler = lightSampler;
+            frame.candidates = restirCandidates;
+            frame.spatialSamples = restirSpatialSamples;
+            gpuRestir.Render(frame);
+            restirSampleCount = gpuRestir.EffectiveSampleCount();
+        }
+
+        const GLuint zero = 0;
+        glClearNamedBufferData(pathEndSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+        // Both pipelines produce the same image, so switching keeps the accumulation
+        if (useWavefront) {
+            WavefrontFrame frame;
+            frame.width = s_width;
+            frame.height = s_height;
+            frame.cameraPosition = camera.Position;
+            frame.cameraRotation = camera.CameraToWorld;
+            frame.maxTraceBounces = MAX_TRACE_BOUNCES;
+            frame.maxTracePerPixel = MAX_TRACE_PER_PIXEL;
+            frame.frameIndex = frameIndex;
+            frame.hemisphereSampler = hemisphereSampler;
+            frame.numLights = (int)scene.lights.size();
+            frame.nextEventEstimation = nextEventEstimation ? 1 : 0;
+            frame.lightSampler = lightSampler;
+            frame.restir = restir ? 1 : 0;
+            frame.rouletteMinDepth = rouletteMinDepth;
+            frame.numSphereNodes = (int)scene.sphereBvh.nodes.size();
+            frame.numTlasNodes = (int)scene.tlas.nodes.size();
+            frame.meshBaseColor = glm::vec3(scene.meshBaseColor);
+            gpuWavefront.Render(frame);
+        } else {
+            // Run compute shader
+            glUseProgram(computeProgram);
         
-        // Set all uniforms BEFORE dispatch
-        glUniform2f(glGetUniformLocation(computeProgram, "resolution"), (float)s_width, (float)s_height);
-        glUniform3f(glGetUniformLocation(computeProgram, "cameraPosition"), camera.Position.x, camera.Position.y, camera.Position.z);
-        glUniformMatrix3fv(glGetUniformLocation(computeProgram, "cameraRotation"), 1, GL_FALSE, glm::value_ptr(camera.CameraToWorld));
-        glUniform1f(glGetUniformLocation(computeProgram, "fov"), 90.0f);
-        glUniform1i(glGetUniformLocation(computeProgram, "numSpheres"), (int)spheres.size());
-        glUniform1i(glGetUniformLocation(computeProgram, "MAX_TRACE_BOUNCES"), MAX_TRACE_BOUNCES);
-        glUniform1i(glGetUniformLocation(computeProgram, "MAX_TRACE_PER_PIXEL"), MAX_TRACE_PER_PIXEL);
+            // Set all uniforms BEFORE dispatch
+            glUniform2f(glGetUniformLocation(computeProgram, "resolution"), (float)s_width, (float)s_height);
+            glUniform3f(glGetUniformLocation(computeProgram, "cameraPosition"), camera.Position.x, camera.Position.y, camera.Position.z);
+            glUniformMatrix3fv(glGetUniformLocation(computeProgram, "cameraRotation"), 1, GL_FALSE, glm::value_ptr(camera.CameraToWorld));
+            glUniform1f(glGetUniformLocation(computeProgram, "fov"), 90.0f);
+            glUniform1i(glGetUniformLocation(computeProgram, "numSphereNodes"), (int)scene.sphereBvh.nodes.size());
+            glUniform1i(glGetUniformLocation(computeProgram, "MAX_TRACE_BOUNCES"), MAX_TRACE_BOUNCES);
+            glUniform1i(glGetUniformLocation(computeProgram, "MAX_TRACE_PER_PIXEL"), MAX_TRACE_PER_PIXEL);
+            glUniform1i(glGetUniformLocation(computeProgram, "frameIndex"), frameIndex);
+            glUniform1i(glGetUniformLocation(computeProgram, "hemisphereSampler"), hemisphereSampler);
+            glUniform1i(glGetUniformLocation(computeProgram, "numLights"), (int)scene.lights.size());
+            glUniform1i(glGetUniformLocation(computeProgram, "nextEventEstimation"), nextEventEstimation ? 1 : 0);
+            glUniform1i(glGetUniformLocation(computeProgram, "lightSampler"), lightSampler);
+            glUniform1i(glGetUniformLocation(computeProgram, "restir"), restir ? 1 : 0);
+            glUniform1i(glGetUniformLocation(computeProgram, "rouletteMinDepth"), rouletteMinDepth);
+            glUniform1i(glGetUniformLocation(computeProgram, "numTlasNodes"), (int)scene.tlas.nodes.size());
+            glUniform3fv(glGetUniformLocation(computeProgram, "meshBaseColor"), 1, glm::value_ptr(scene.meshBaseColor));
+            glUniform1i(glGetUniformLocation(computeProgram, "persistentThreads"), usePersistentThreads ? 1 : 0);
         
-        // Now dispatch the compute shader
-        glDispatchCompute((GLuint)(s_width + 15) / 16, (GLuint)(s_height + 15) / 16, 1);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            // Now dispatch the compute shader
+            if (usePersistentThreads) {
+                glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);     // last frame's atomics
+                glClearNamedBufferData(workCounterSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+                glDispatchCompute((GLuint)persistentGroups, 1, 1);
+            } else {
+                glDispatchCompute((GLuint)(s_width + 15) / 16, (GLuint)(s_height + 15) / 16, 1);
+            }
+        }
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        ++frameIndex;
 
         // Render fullscreen quad with the result texture
         glUseProgram(shaderProgram);
@@ -355,34 +616,165 @@ int main()
         ImGui::DragFloat("Camera Speed", &camera.speed, 0.01f, 0.01f, 1.0f);
         ImGui::DragInt("Max Trace Bounces", &MAX_TRACE_BOUNCES, 1, 1, 200);
         ImGui::DragInt("Max Traces Per Pixel", &MAX_TRACE_PER_PIXEL, 1, 1, 200);
+        ImGui::DragInt("Roulette Min Depth", &rouletteMinDepth, 1, 0, 200);
+        if (ImGui::CollapsingHeader("Path Terminations")) {
+            // Reads back this frame's counters, which waits for the GPU
+            GLuint pathEnds[PATH_END_REASONS * PATH_DEPTH_BINS];
+            glGetNamedBufferSubData(pathEndSSBO, 0, sizeof(pathEnds), pathEnds);
+            const int depths = std::min(MAX_TRACE_BOUNCES, PATH_DEPTH_BINS);
+            float endsPerDepth[PATH_DEPTH_BINS] = {};
+            double reasonTotals[PATH_END_REASONS] = {};
+            double paths = 0.0, rays = 0.0;
+            for (int reason = 0; reason < PATH_END_REASONS; ++reason) {
+                for (int bounce = 0; bounce < depths; ++bounce) {
+                    const GLuint ended = pathEnds[reason * PATH_DEPTH_BINS + bounce];
+                    endsPerDepth[bounce] += (float)ended;
+                    reasonTotals[reason] += ended;
+                    paths += ended;
+                    rays += (double)ended * (bounce + 1);
+                }
+            }
+            ImGui::PlotHistogram("Ends per Bounce", endsPerDepth, depths, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+            // Every path of the counted pixels (every 4th in x and y) ends exactly once; the
+            // settings above may have changed since the dispatch, lastFrameState has its own
+            const double expectedPaths = (double)((lastFrameState.width + 3) / 4) * ((lastFrameState.height + 3) / 4) * lastFrameState.perPixel;
+            if (paths != expectedPaths)
+                ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Counted %.0f paths, expected %.0f", paths, expectedPaths);
+            paths = std::max(paths, 1.0);
+            ImGui::Text("Rays per path: %.2f", rays / paths);
+            ImGui::Text("Escaped %.1f%%, roulette %.1f%%, bounce limit %.1f%%", 100.0 * reasonTotals[0] / paths, 100.0 * reasonTotals[1] / paths, 100.0 * reasonTotals[2] / paths);
+        }
+        const char* samplerNames[] = { "Random", "Stratified", "R2 Sequence", "Sobol", "Sobol + Blue Noise" };
+        ImGui::Combo("Hemisphere Sampler", &hemisphereSampler, samplerNames, IM_ARRAYSIZE(samplerNames));
+        ImGui::Checkbox("Next Event Estimation", &nextEventEstimation);
+        if (nextEventEstimation) {
+            const char* lightSamplerNames[] = { "Uniform", "Power", "Light BVH" };
+            ImGui::Combo("Light Sampler", &lightSampler, lightSamplerNames, IM_ARRAYSIZE(lightSamplerNames));
+            ImGui::Checkbox("ReSTIR", &useRestir);
+            if (useRestir) {
+                ImGui::DragInt("ReSTIR Candidates", &restirCandidates, 1, 1, 64);
+                ImGui::DragInt("ReSTIR Neighbours", &restirSpatialSamples, 1, 0, 16);
+                ImGui::Text("ReSTIR Effective Samples: %.1f", restirSampleCount);
+            }
+        }
+        ImGui::Checkbox("Wavefront Pipeline", &useWavefront);
+        if (!useWavefront) {
+            ImGui::BeginDisabled(softwareRenderer);
+            ImGui::Checkbox("Persistent Threads", &usePersistentThreads);
+            ImGui::EndDisabled();
+            if (usePersistentThreads) ImGui::DragInt("Persistent Groups", &persistentGroups, 1, 1, 4096);
+        }
+        ImGui::Text("Mesh: %zu triangles in %zu BLASes, %zu BLAS nodes", scene.triangles.size(), scene.meshBlases.size(), scene.blasNodes.size());
+
+        // Switching builders rebuilds both BVHs right away
+        const char* builderNames[] = { "SAH", "LBVH 30-bit", "LBVH 63-bit" };
+        int builderIndex = scene.bvhBuilder == BvhBuilder::Sah ? 0 : (scene.mortonBits > 30 ? 2 : 1);
+        if (ImGui::Combo("BVH Builder", &builderIndex, builderNames, IM_ARRAYSIZE(builderNames))) {
+            scene.bvhBuilder = builderIndex == 0 ? BvhBuilder::Sah : BvhBuilder::Lbvh;
+            scene.mortonBits = builderIndex == 2 ? 63 : 30;
+
+            auto buildStart = std::chrono::steady_clock::now();
+            BuildMeshBvh(scene, threadPool);
+            BuildSphereBvh(scene, threadPool);
+            lastBvhBuildMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+
+            UploadMesh(triangleSSBO, blasSSBO);
+            UploadTlas(tlasSSBO, tlasInstanceSSBO);
+            UploadSpheres(sphereSSBO, sphereBvhSSBO, sphereIndexSSBO);
+            sceneChanged = true;
+        }
+        ImGui::Text("Last BVH rebuild: %.2f ms", lastBvhBuildMs);
+        ImGui::ColorEdit3("Mesh Color", glm::value_ptr(scene.meshBaseColor));
+        ImGui::Text("Accumulated Frames: %d", frameIndex);
+        if (ImGui::Button("Reset Accumulation")) frameIndex = 0;
+        ImGui::End();
+
+        ImGui::Begin("Mesh Instances");
+        ImGui::Text("Total Instances: %zu", scene.meshInstances.size());
+        ImGui::Text("TLAS: %zu nodes", scene.tlas.nodes.size());
+
+        // Instances share their BLAS, so duplicates only grow the TLAS
+        if (selectedInstance >= 0 && selectedInstance < (int)scene.meshInstances.size() && ImGui::Button("Duplicate Instance")) {
+            MeshInstance copy = scene.meshInstances[selectedInstance];
+            copy.transform = glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 0.0f, 0.0f)) * copy.transform;
+            scene.meshInstances.push_back(copy);
+            selectedInstance = (int)scene.meshInstances.size() - 1;
+            instancesChanged = true;
+        }
+        ImGui::Separator();
+
+        ImGui::BeginChild("InstanceList", ImVec2(0.0f, 150.0f), true);
+        ImGuiListClipper instanceClipper;
+        instanceClipper.Begin((int)scene.meshInstances.size());
+        while (instanceClipper.Step()) {
+            for (int i = instanceClipper.DisplayStart; i < instanceClipper.DisplayEnd; ++i) {
+                std::string instanceLabel = "Instance " + std::to_string(i) + " (mesh " + std::to_string(scene.meshInstances[i].blas) + ")";
+                if (ImGui::Selectable(instanceLabel.c_str(), selectedInstance == i)) selectedInstance = i;
+            }
+        }
+        ImGui::EndChild();
+
+        if (selectedInstance >= 0 && selectedInstance < (int)scene.meshInstances.size()) {
+            const int i = selectedInstance;
+            MeshInstance& instance = scene.meshInstances[i];
+            ImGui::Text("Instance %d", i);
+
+            instancesChanged |= ImGui::DragFloat3(("Position##instance" + std::to_string(i)).c_str(), glm::value_ptr(instance.transform[3]), 0.01f);
+
+            if (ImGui::Button(("Remove##instance" + std::to_string(i)).c_str())) {
+                scene.meshInstances.erase(scene.meshInstances.begin() + i);
+                selectedInstance = -1;
+                instancesChanged = true;
+            }
+        }
         ImGui::End();
 
         ImGui::Begin("Spheres");
-        ImGui::Text("Total Spheres: %zu", spheres.size());
+        ImGui::Text("Total Spheres: %zu", scene.spheres.size());
+        ImGui::Text("Sphere BVH: %zu nodes", scene.sphereBvh.nodes.size());
         
         if (ImGui::Button("Add Sphere")) {
-            spheres.push_back({
+            scene.spheres.push_back({
                 glm::vec4(0.0f, 0.0f, 0.0f, 1.0f),   // positionRadius
                 glm::vec4(1.0f, 1.0f, 1.0f, 1.0f),   // baseColor
                 glm::vec4(0.0f, 0.0f, 0.0f, 0.0f)    // emissionColorStrength
             });
+            selectedSphere = (int)scene.spheres.size() - 1;
+            sphereListChanged = true;
         }
         ImGui::Separator();
 
-        for (int i = 0; i < (int)spheres.size(); ++i) {
-            std::string sphereLabel = "Sphere " + std::to_string(i);
-            if (ImGui::TreeNode(sphereLabel.c_str())) {
-                ImGui::DragFloat3   (("Position##" + std::to_string(i)).c_str(), glm::value_ptr(spheres[i].positionRadius), 0.01f);
-                ImGui::DragFloat    (("Radius##"   + std::to_string(i)).c_str(), &spheres[i].positionRadius.w, 0.01f, 0.1f, 10.0f);
-                ImGui::ColorEdit3   (("Color##"    + std::to_string(i)).c_str(), glm::value_ptr(spheres[i].baseColor));
-                ImGui::ColorEdit3   (("Emission##" + std::to_string(i)).c_str(), glm::value_ptr(spheres[i].emissionColorStrength));
-                ImGui::DragFloat    (("Strength##" + std::to_string(i)).c_str(), &spheres[i].emissionColorStrength.w, 0.01f, 0.0f, 10.0f);
-
-                if (ImGui::Button(("Remove##" + std::to_string(i)).c_str())) {
-                    spheres.erase(spheres.begin() + i);
-                }
-
-                ImGui::TreePop();
+        // Clipped list: only the visible rows are submitted, so 100k+ spheres stay cheap
+        ImGui::BeginChild("SphereList", ImVec2(0.0f, 150.0f), true);
+        ImGuiListClipper clipper;
+        clipper.Begin((int)scene.spheres.size());
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                std::string sphereLabel = "Sphere " + std::to_string(i);
+                if (ImGui::Selectable(sphereLabel.c_str(), selectedSphere == i)) selectedSphere = i;
+            }
+        }
+        ImGui::EndChild();
+
+        if (selectedSphere >= 0 && selectedSphere < (int)scene.spheres.size()) {
+            const int i = selectedSphere;
+            Sphere& sphere = scene.spheres[i];
+            ImGui::Text("Sphere %d", i);
+
+            bool moved = false, recolored = false;
+            moved     |= ImGui::DragFloat3  (("Position##" + std::to_string(i)).c_str(), glm::value_ptr(sphere.positionRadius), 0.01f);
+            moved     |= ImGui::DragFloat   (("Radius##"   + std::to_string(i)).c_str(), &sphere.positionRadius.w, 0.01f, 0.1f, 10.0f);
+            recolored |= ImGui::ColorEdit3  (("Color##"    + std::to_string(i)).c_str(), glm::value_ptr(sphere.baseColor));
+            recolored |= ImGui::ColorEdit3  (("Emission##" + std::to_string(i)).c_str(), glm::value_ptr(sphere.emissionColorStrength));
+            recolored |= ImGui::DragFloat   (("Strength##" + std::to_string(i)).c_str(), &sphere.emissionColorStrength.w, 0.01f, 0.0f, 10.0f);
+
+            if (moved && !sphereListChanged) RefitSphereBvh(scene, (uint32_t)i, &dirtySphereNodes);
+            if (moved || recolored) dirtySpheres.push_back((uint32_t)i);
+
+            if (ImGui::Button(("Remove##" + std::to_string(i)).c_str())) {
+                scene.spheres.erase(scene.spheres.begin() + i);
+                selectedSphere = -1;
+                sphereListChanged = true;
             }
         }
         ImGui::End();
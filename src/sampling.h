@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "blueNoise.h"
+
+// Random numbers and bounce direction sampling of the CPU tracer; mirrors
+// src/Shaders/sampling.glsl function by function. Every sampler draws
+// cosine-weighted directions, which is what the tracers' rayColor *= baseColor
+// update assumes for Lambertian surfaces.
+
+// Values match the hemisphereSampler uniform
+enum class HemisphereSampler {
+    Random = 0,             // two RNG draws per bounce
+    Stratified = 1,         // Latin hypercube over the samples of a frame
+    R2 = 2,                 // low-discrepancy R2 sequence over every sample accumulated so far
+    Sobol = 3,              // Owen-scrambled Sobol sequence, scrambled per pixel
+    SobolBlueNoise = 4      // the same Sobol points in every pixel, shifted by BlueNoiseTile()
+};
+
+const float PI = 3.14159265f;
+// Dimensions of the light sample of a bounce, far past any bounce count: SampleSquare(...,
+// LIGHT_SAMPLE_DIMENSION + bounce, ...) is the direction towards the light, LIGHT_PICK_DIMENSION + bounce picks it
+const int   LIGHT_SAMPLE_DIMENSION = 0x10000;
+const int   LIGHT_PICK_DIMENSION   = 0x20000;
+// SampleSquare(..., ROULETTE_DIMENSION + bounce, ...).x decides whether a path survives Russian roulette
+const int   ROULETTE_DIMENSION     = 0x30000;
+
+// Which sample of which pixel a path belongs to
+struct SampleIndex {
+    uint32_t pixel;         // row-major image index
+    uint32_t width;         // image width, to find the pixel in the blue-noise tile
+    uint32_t frame;         // TraceSettings::frameIndex
+    uint32_t rayIndex;      // sample within the frame
+    uint32_t sampleCount;   // TraceSettings::maxTracePerPixel
+};
+
+inline float randomValueInt(uint32_t& state)
+{
+    state = state * 747796405u + 2891336453u;
+    uint32_t result = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    result = (result >> 22u) ^ result;
+    return (float)result / 4294967296.0f;
+}
+
+// lowbias32 integer hash
+inline uint32_t HashUint(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// 24 high bits, so the result is exact and never rounds up to 1.0
+inline float UintToUnitFloat(uint32_t bits)
+{
+    return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Kensler's hash-based permutation of [0, count): element i of a random shuffle chosen by seed
+inline uint32_t PermuteIndex(uint32_t i, uint32_t count, uint32_t seed)
+{
+    uint32_t w = count - 1u;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;             i *= 0xe170893du;
+        i ^= seed >> 16;       i ^= (i & w) >> 4;
+        i ^= seed >> 8;        i *= 0x0929eb3fu;
+        i ^= seed >> 23;       i ^= (i & w) >> 1;
+        i *= 1u | seed >> 27;  i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;    i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;     i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;     i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= count);
+    return (i + seed) % count;
+}
+
+// bitfieldReverse()
+inline uint32_t ReverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Hash-based Laine-Karras permutation (Burley 2020): every bit is flipped depending only on the bits below it
+inline uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen (nested uniform) scrambling of the binary fraction 0.x: bits flip depending on the bits above them
+inline uint32_t OwenScramble(uint32_t x, uint32_t seed)
+{
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+// Second Sobol dimension; the first one is ReverseBits(n)
+inline uint32_t SobolDimension1(uint32_t n)
+{
+    uint32_t result = 0u;
+    for (uint32_t v = 0x80000000u; n != 0u; n >>= 1, v ^= v >> 1)
+        if (n & 1u) result ^= v;
+    return result;
+}
+
+// Dimension allocator: bounce b owns dimensions 2b and 2b + 1. Each pair is the 2D Sobol
+// net again, decorrelated by its own index shuffle and scrambles (Burley's padding).
+inline uint32_t SobolDimensionSeed(uint32_t pixelSeed, int bounce)
+{
+    return HashUint(pixelSeed ^ HashUint((uint32_t)bounce + 0x68bc21ebu));
+}
+
+// Point n of the Owen-scrambled 2D Sobol sequence as 0.32 fixed point
+inline glm::uvec2 SobolPoint(uint32_t n, uint32_t seed)
+{
+    const uint32_t shuffled = OwenScramble(n, seed);
+    // OwenScramble(ReverseBits(shuffled)) without the two reversals that cancel
+    return glm::uvec2(ReverseBits(LaineKarrasPermutation(shuffled, HashUint(seed ^ 0xa511e9b3u))),
+                      OwenScramble(SobolDimension1(shuffled), HashUint(seed ^ 0x63d83595u)));
+}
+
+// Toroidal shift of the pixel for this bounce, from a window of the tile that moves with the bounce
+inline glm::uvec2 BlueNoiseShift(const SampleIndex& index, int bounce)
+{
+    static const uint16_t* tile = BlueNoiseTile().data();
+    const uint32_t window = HashUint((uint32_t)bounce);
+    const uint32_t x = (index.pixel % index.width + window) & (BLUE_NOISE_SIZE - 1u);
+    const uint32_t y = (index.pixel / index.width + (window >> 16)) & (BLUE_NOISE_SIZE - 1u);
+    const uint16_t* texel = &tile[2 * (y * BLUE_NOISE_SIZE + x)];
+    return glm::uvec2(texel[0], texel[1]) << (32u - BLUE_NOISE_BITS);
+}
+
+// 2D point in [0, 1)^2 for the bounce'th direction of a path
+inline glm::vec2 SampleSquare(HemisphereSampler sampler, const SampleIndex& index, int bounce, uint32_t& state)
+{
+    if (sampler == HemisphereSampler::Stratified) {
+        const uint32_t seed = HashUint(index.pixel ^ HashUint(index.frame ^ HashUint((uint32_t)bounce)));
+        const float jitterX = randomValueInt(state);
+        const float jitterY = randomValueInt(state);
+        const float strataX = (float)PermuteIndex(index.rayIndex, index.sampleCount, seed);
+        const float strataY = (float)PermuteIndex(index.rayIndex, index.sampleCount, HashUint(seed));
+        return glm::min(glm::vec2(strataX + jitterX, strataY + jitterY) / (float)index.sampleCount, glm::vec2(0.99999994f));
+    }
+    if (sampler == HemisphereSampler::R2) {
+        // 0.32 fixed point keeps the sequence exact however many frames accumulate
+        const uint32_t n = index.frame * index.sampleCount + index.rayIndex;
+        const uint32_t seed = HashUint(index.pixel ^ HashUint((uint32_t)bounce));
+        return glm::vec2(UintToUnitFloat(HashUint(seed) + n * 3242174889u),
+                         UintToUnitFloat(HashUint(seed ^ 0x9e3779b9u) + n * 2447445413u));
+    }
+    if (sampler == HemisphereSampler::Sobol || sampler == HemisphereSampler::SobolBlueNoise) {
+        const uint32_t n = index.frame * index.sampleCount + index.rayIndex;
+        const bool blueNoise = sampler == HemisphereSampler::SobolBlueNoise;
+        glm::uvec2 bits = SobolPoint(n, SobolDimensionSeed(blueNoise ? 0u : HashUint(index.pixel), bounce));
+        if (blueNoise) bits += BlueNoiseShift(index, bounce);
+        return glm::vec2(UintToUnitFloat(bits.x), UintToUnitFloat(bits.y));
+    }
+
+    const float u = randomValueInt(state);
+    const float v = randomValueInt(state);
+    return glm::vec2(u, v);
+}
+
+// Shirley-Chiu concentric mapping of the unit square onto the unit disk
+inline glm::vec2 ConcentricDisk(const glm::vec2& u)
+{
+    const glm::vec2 offset = u * 2.0f - 1.0f;
+    if (offset.x == 0.0f && offset.y == 0.0f) return glm::vec2(0.0f);
+
+    float r, theta;
+    if (std::abs(offset.x) > std::abs(offset.y)) {
+        r = offset.x;
+        theta = (PI / 4.0f) * (offset.y / offset.x);
+    } else {
+        r = offset.y;
+        theta = PI / 2.0f - (PI / 4.0f) * (offset.x / offset.y);
+    }
+    return r * glm::vec2(std::cos(theta), std::sin(theta));
+}
+
+// Branchless orthonormal basis around a unit vector (Duff et al.)
+inline void OrthonormalBasis(const glm::vec3& normal, glm::vec3& tangent, glm::vec3& bitangent)
+{
+    const float s = normal.z >= 0.0f ? 1.0f : -1.0f;
+    const float a = -1.0f / (s + normal.z);
+    const float b = normal.x * normal.y * a;
+    tangent   = glm::vec3(1.0f + s * normal.x * normal.x * a, s * b, -s * normal.x);
+    bitangent = glm::vec3(b, s + normal.y * normal.y * a, -normal.y);
+}
+
+// Cosine-weighted direction around the (unit) normal: the disk point lifted onto the
+// hemisphere (Malley's method)
+inline glm::vec3 SampleCosineHemisphere(const glm::vec3& normal, const glm::vec2& u)
+{
+    const glm::vec2 disk = ConcentricDisk(u);
+    const float z = std::sqrt(std::max(0.0f, 1.0f - glm::dot(disk, disk)));
+
+    glm::vec3 tangent, bitangent;
+    OrthonormalBasis(normal, tangent, bitangent);
+    return disk.x * tangent + disk.y * bitangent + z * normal;
+}
+
+// Direction in the cone of half angle acos(1 - oneMinusCosMax) around the (unit) axis,
+// uniform in solid angle
+inline glm::vec3 SampleCone(const glm::vec3& axis, float oneMinusCosMax, const glm::vec2& u)
+{
+    const float cosTheta = 1.0f - u.y * oneMinusCosMax;
+    const float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    const float phi = 2.0f * PI * u.x;
+
+    glm::vec3 tangent, bitangent;
+    OrthonormalBasis(axis, tangent, bitangent);
+    return (std::cos(phi) * sinTheta) * tangent + (std::sin(phi) * sinTheta) * bitangent + cosTheta * axis;
+}
@@ -0,0 +1,307 @@
+#include "scene.h"
+#include "glTFLoader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+void AppendMeshTriangles(const SimpleMeshData& mesh, const glm::mat4& transform, std::vector<Triangle>& triangles)
+{
+    auto vertex = [&](uint32_t index) {
+        const float* p = &mesh.positions[(size_t)index * 3];
+        return glm::vec4(glm::vec3(transform * glm::vec4(p[0], p[1], p[2], 1.0f)), 0.0f);
+    };
+
+    const size_t vertexCount = mesh.positions.size() / 3;
+    const size_t count = mesh.hasIndices() ? mesh.indices.size() : vertexCount;
+    triangles.reserve(triangles.size() + count / 3);
+    for (size_t i = 0; i + 2 < count; i += 3) {
+        uint32_t i0 = mesh.hasIndices() ? mesh.indices[i + 0] : (uint32_t)(i + 0);
+        uint32_t i1 = mesh.hasIndices() ? mesh.indices[i + 1] : (uint32_t)(i + 1);
+        uint32_t i2 = mesh.hasIndices() ? mesh.indices[i + 2] : (uint32_t)(i + 2);
+        if (std::max({ i0, i1, i2 }) >= vertexCount) continue;  // meshes not from the loader may not be checked
+        triangles.push_back({ vertex(i0), vertex(i1), vertex(i2) });
+    }
+}
+
+uint32_t AddMeshBlas(Scene& scene, const SimpleMeshData& mesh, const MeshMaterial& material)
+{
+    MeshBlas blas;
+    blas.material = material;
+    blas.firstTriangle = (uint32_t)scene.triangles.size();
+    AppendMeshTriangles(mesh, glm::mat4(1.0f), scene.triangles);
+    blas.triangleCount = (uint32_t)scene.triangles.size() - blas.firstTriangle;
+
+    scene.meshBlases.push_back(blas);
+    return (uint32_t)scene.meshBlases.size() - 1;
+}
+
+void AddGltfMeshes(Scene& scene, const GltfSceneMeshes& gltf, const glm::mat4& transform)
+{
+    std::vector<uint32_t> blasOf(gltf.meshes.size());
+    for (size_t i = 0; i < gltf.meshes.size(); ++i) {
+        const SimpleMeshData& mesh = gltf.meshes[i];
+        MeshMaterial material;
+        if (mesh.material >= 0) {
+            const GltfMaterial& gltfMaterial = gltf.materials.at(mesh.material);
+            material.baseColor = glm::vec4(glm::vec3(gltfMaterial.baseColorFactor), 0.0f);
+            material.emissionColorStrength = glm::vec4(gltfMaterial.emissiveFactor, gltfMaterial.emissiveStrength);
+        }
+        blasOf[i] = AddMeshBlas(scene, mesh, material);
+    }
+
+    for (const GltfMeshInstance& instance : gltf.instances)
+        scene.meshInstances.push_back({ blasOf[instance.mesh], transform * instance.transform });
+}
+
+void BuildMeshBvh(Scene& scene, ThreadPool& pool)
+{
+    scene.blasNodes.clear();
+    scene.blasNodes8.clear();
+
+    for (MeshBlas& blas : scene.meshBlases) {
+        Triangle* triangles = scene.triangles.data() + blas.firstTriangle;
+
+        std::vector<Aabb> bounds(blas.triangleCount);
+        for (uint32_t i = 0; i < blas.triangleCount; ++i) {
+            bounds[i].Grow(glm::vec3(triangles[i].v0));
+            bounds[i].Grow(glm::vec3(triangles[i].v1));
+            bounds[i].Grow(glm::vec3(triangles[i].v2));
+        }
+
+        Bvh bvh = BuildBvh(bounds, pool, scene.bvhBuilder, scene.mortonBits);
+        std::vector<Triangle> ordered = ReorderByBvh(bvh, std::vector<Triangle>(triangles, triangles + blas.triangleCount));
+        std::copy(ordered.begin(), ordered.end(), triangles);
+
+        // Rebase the local child / triangle indices onto the shared arrays
+        blas.rootNode = (uint32_t)scene.blasNodes.size();
+        blas.bounds = Aabb();
+        if (!bvh.Empty()) {
+            blas.bounds.min = bvh.nodes[0].boundsMin;
+            blas.bounds.max = bvh.nodes[0].boundsMax;
+        }
+        for (BvhNode node : bvh.nodes) {
+            node.leftFirst += node.IsLeaf() ? blas.firstTriangle : blas.rootNode;
+            scene.blasNodes.push_back(node);
+        }
+    }
+
+    BuildTlas(scene, pool);
+}
+
+static Aabb TransformBounds(const Aabb& bounds, const glm::mat4& transform)
+{
+    Aabb result;
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 p((corner & 1) ? bounds.max.x : bounds.min.x,
+                    (corner & 2) ? bounds.max.y : bounds.min.y,
+                    (corner & 4) ? bounds.max.z : bounds.min.z);
+        result.Grow(glm::vec3(transform * glm::vec4(p, 1.0f)));
+    }
+    return result;
+}
+
+void BuildTlas(Scene& scene, ThreadPool& pool)
+{
+    // Instances of empty BLASes have nothing to hit and are left out
+    std::vector<TlasInstance> instances;
+    std::vector<Aabb> bounds;
+    for (const MeshInstance& instance : scene.meshInstances) {
+        const MeshBlas& blas = scene.meshBlases[instance.blas];
+        if (blas.triangleCount == 0) continue;
+
+        TlasInstance tlasInstance = {};
+        tlasInstance.worldToObject = glm::inverse(instance.transform);
+        tlasInstance.blasRoot = blas.rootNode;
+        tlasInstance.baseColor = blas.material.baseColor;
+        tlasInstance.emissionColorStrength = blas.material.emissionColorStrength;
+        instances.push_back(tlasInstance);
+        bounds.push_back(TransformBounds(blas.bounds, instance.transform));
+    }
+
+    // Instance counts stay small, so the top level always gets the better SAH tree
+    scene.tlas = BuildBvhSah(bounds, pool);
+    scene.tlasInstances = ReorderByBvh(scene.tlas, instances);
+    scene.tlas8.clear();
+    scene.tlasInstanceRoots8.clear();
+}
+
+void BuildWideBvhs(Scene& scene)
+{
+    scene.sphereBvh8.clear();
+    if (!scene.sphereBvh.Empty()) AppendBvh8(scene.sphereBvh.nodes.data(), 0, scene.sphereBvh8);
+
+    // Instances only know their binary BLAS root
+    scene.blasNodes8.clear();
+    std::unordered_map<uint32_t, uint32_t> wideRoots;
+    for (const MeshBlas& blas : scene.meshBlases)
+        if (blas.triangleCount > 0) wideRoots[blas.rootNode] = AppendBvh8(scene.blasNodes.data(), blas.rootNode, scene.blasNodes8);
+
+    scene.tlasInstanceRoots8.clear();
+    for (const TlasInstance& instance : scene.tlasInstances) scene.tlasInstanceRoots8.push_back(wideRoots.at(instance.blasRoot));
+
+    scene.tlas8.clear();
+    if (!scene.tlas.Empty()) AppendBvh8(scene.tlas.nodes.data(), 0, scene.tlas8);
+}
+
+Aabb SphereBounds(const Sphere& sphere)
+{
+    const glm::vec3 center = glm::vec3(sphere.positionRadius);
+    const float radius = std::abs(sphere.positionRadius.w);
+
+    Aabb bounds;
+    bounds.min = center - glm::vec3(radius);
+    bounds.max = center + glm::vec3(radius);
+    return bounds;
+}
+
+void BuildSphereBvh(Scene& scene, ThreadPool& pool)
+{
+    std::vector<Aabb> bounds(scene.spheres.size());
+    for (size_t i = 0; i < scene.spheres.size(); ++i) bounds[i] = SphereBounds(scene.spheres[i]);
+
+    scene.sphereBvh = BuildBvh(bounds, pool, scene.bvhBuilder, scene.mortonBits);
+    PrepareBvhRefit(scene.sphereBvh);
+    scene.sphereBvh8.clear();
+}
+
+void RefitSphereBvh(Scene& scene, uint32_t index, std::vector<uint32_t>* touchedNodes)
+{
+    scene.sphereBvh8.clear();
+    RefitBvhPrimitive(scene.sphereBvh, [&](uint32_t i) { return SphereBounds(scene.spheres[i]); }, index, touchedNodes);
+}
+
+float SpherePower(const Sphere& sphere)
+{
+    const glm::vec3 emission = glm::vec3(sphere.emissionColorStrength);
+    const float luminance = 0.2126f * emission.r + 0.7152f * emission.g + 0.0722f * emission.b;
+    return std::max(luminance * sphere.emissionColorStrength.w, 0.0f) * sphere.positionRadius.w * sphere.positionRadius.w;
+}
+
+// Vose's alias method: every bin holds one light up to aliasThreshold and the rest of
+// its 1 / count share goes to the alias, so picking is one lookup and one compare
+static void BuildLightAliasTable(Scene& scene)
+{
+    std::vector<Light>& lights = scene.lights;
+    const size_t count = lights.size();
+    double totalPower = 0.0;
+    for (const Light& light : lights) totalPower += SpherePower(scene.spheres[light.sphere]);
+
+    std::vector<double>   scaled(count);
+    std::vector<uint32_t> small, large;
+    for (uint32_t i = 0; i < count; ++i) {
+        const double pmf = SpherePower(scene.spheres[lights[i].sphere]) / totalPower;
+        lights[i].pmf = (float)pmf;
+        lights[i].alias = i;
+        scaled[i] = pmf * count;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const uint32_t under = small.back(); small.pop_back();
+        const uint32_t over = large.back();
+        lights[under].aliasThreshold = (float)scaled[under];
+        lights[under].alias = over;
+        scaled[over] -= 1.0 - scaled[under];
+        if (scaled[over] < 1.0) {
+            large.pop_back();
+            small.push_back(over);
+        }
+    }
+    // What is left is 1 up to rounding
+    for (uint32_t i : small) lights[i].aliasThreshold = 1.0f;
+    for (uint32_t i : large) lights[i].aliasThreshold = 1.0f;
+}
+
+static Aabb LightBvhLeafBounds(const Scene& scene, uint32_t light)
+{
+    return SphereBounds(scene.spheres[scene.lights[light].sphere]);
+}
+
+// Median split along the longest centroid axis: one light per leaf and depth
+// ceil(log2(count)), so every trail fits in Light::bvhTrail
+static void BuildLightBvhNode(Scene& scene, std::vector<uint32_t>& order, const std::vector<glm::vec3>& centroids,
+                              uint32_t nodeIndex, size_t first, size_t count, uint32_t trail, uint32_t depth)
+{
+    if (count == 1) {
+        const uint32_t light = order[first];
+        const Aabb bounds = LightBvhLeafBounds(scene, light);
+        scene.lightBvh[nodeIndex] = { bounds.min, SpherePower(scene.spheres[scene.lights[light].sphere]), bounds.max, LIGHT_BVH_LEAF | light };
+        scene.lights[light].bvhTrail = trail;
+        scene.lightBvhLeaves[light] = nodeIndex;
+        return;
+    }
+
+    Aabb centroidBounds;
+    for (size_t i = first; i < first + count; ++i) centroidBounds.Grow(centroids[order[i]]);
+    const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+    const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    const size_t half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                     [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    const uint32_t left = (uint32_t)scene.lightBvh.size();
+    scene.lightBvh.resize(left + 2);
+    scene.lightBvhParents.resize(left + 2);
+    scene.lightBvhParents[left] = scene.lightBvhParents[left + 1] = nodeIndex;
+    BuildLightBvhNode(scene, order, centroids, left,     first,        half,         trail,                depth + 1);
+    BuildLightBvhNode(scene, order, centroids, left + 1, first + half, count - half, trail | (1u << depth), depth + 1);
+
+    const LightBvhNode& l = scene.lightBvh[left];
+    const LightBvhNode& r = scene.lightBvh[left + 1];
+    scene.lightBvh[nodeIndex] = { glm::min(l.boundsMin, r.boundsMin), l.power + r.power, glm::max(l.boundsMax, r.boundsMax), left };
+}
+
+void BuildLights(Scene& scene)
+{
+    scene.lights.clear();
+    scene.sphereLights.assign(scene.spheres.size(), -1);
+    for (uint32_t i = 0; i < (uint32_t)scene.spheres.size(); ++i) {
+        if (SpherePower(scene.spheres[i]) <= 0.0f) continue;
+        scene.sphereLights[i] = (int32_t)scene.lights.size();
+        scene.lights.push_back({ i, 0, 1.0f, 0.0f, 0 });
+    }
+
+    scene.lightBvh.clear();
+    scene.lightBvhParents.clear();
+    scene.lightBvhLeaves.assign(scene.lights.size(), 0);
+    if (scene.lights.empty()) return;
+
+    BuildLightAliasTable(scene);
+
+    std::vector<uint32_t>  order(scene.lights.size());
+    std::vector<glm::vec3> centroids(scene.lights.size());
+    for (uint32_t i = 0; i < (uint32_t)scene.lights.size(); ++i) {
+        order[i] = i;
+        centroids[i] = glm::vec3(scene.spheres[scene.lights[i].sphere].positionRadius);
+    }
+    scene.lightBvh.reserve(2 * scene.lights.size() - 1);
+    scene.lightBvh.resize(1);
+    scene.lightBvhParents.assign(1, 0);
+    BuildLightBvhNode(scene, order, centroids, 0, 0, order.size(), 0, 0);
+}
+
+bool UpdateLight(Scene& scene, uint32_t index, std::vector<uint32_t>* touchedNodes)
+{
+    const int32_t light = scene.sphereLights[index];
+    if ((light >= 0) != (SpherePower(scene.spheres[index]) > 0.0f)) return false;
+    if (light < 0) return true;
+
+    BuildLightAliasTable(scene);
+
+    uint32_t node = scene.lightBvhLeaves[light];
+    const Aabb bounds = LightBvhLeafBounds(scene, (uint32_t)light);
+    scene.lightBvh[node].boundsMin = bounds.min;
+    scene.lightBvh[node].boundsMax = bounds.max;
+    scene.lightBvh[node].power = SpherePower(scene.spheres[index]);
+    if (touchedNodes) touchedNodes->push_back(node);
+    while (node != 0) {
+        node = scene.lightBvhParents[node];
+        const LightBvhNode& l = scene.lightBvh[scene.lightBvh[node].child];
+        const LightBvhNode& r = scene.lightBvh[scene.lightBvh[node].child + 1];
+        scene.lightBvh[node].boundsMin = glm::min(l.boundsMin, r.boundsMin);
+        scene.lightBvh[node].boundsMax = glm::max(l.boundsMax, r.boundsMax);
+        scene.lightBvh[node].power = l.power + r.power;
+        if (touchedNodes) touchedNodes->push_back(node);
+    }
+    return true;
+}
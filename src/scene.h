@@ -0,0 +1,147 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "bvh8.h"
+
+struct SimpleMeshData;
+struct GltfSceneMeshes;
+
+// Layout matches the std430 SphereBuffer of rayTracingCommon.glsl
+struct Sphere {
+    glm::vec4  positionRadius;      // position (xyz) + radius (w)
+    glm::vec4  baseColor;           // baseColor (xyz) + padding (w)
+    glm::vec4  emissionColorStrength; // emissionColor (xyz) + emissionStrength (w)
+};
+
+struct Triangle {
+    glm::vec4  v0;                  // vertex 0 (xyz) + padding (w)
+    glm::vec4  v1;                  // vertex 1 (xyz) + padding (w)
+    glm::vec4  v2;                  // vertex 2 (xyz) + padding (w)
+};
+
+// Layout matches the std430 Light of rayTracingCommon.glsl
+struct Light {
+    uint32_t sphere;
+    uint32_t alias;                 // alias table: the light that fills the rest of this one's bin
+    float    aliasThreshold;        // keep this light when the second pick number is below, else take alias
+    float    pmf;                   // power / total power, what the alias table picks it with
+    uint32_t bvhTrail;              // path from the light BVH root to its leaf, bit k set: right child at depth k
+};
+
+// Layout matches the std430 LightBvhNode of rayTracingCommon.glsl
+struct LightBvhNode {
+    glm::vec3 boundsMin;
+    float     power;                // sum over the lights below
+    glm::vec3 boundsMax;
+    uint32_t  child;                // left child (the right one follows it), or LIGHT_BVH_LEAF | light
+};
+
+const uint32_t LIGHT_BVH_LEAF = 0x80000000u;
+
+// Surface of a mesh primitive; baseColor is tinted by Scene::meshBaseColor when shaded
+struct MeshMaterial {
+    glm::vec4  baseColor = glm::vec4(1.0f);               // baseColor (xyz) + padding (w)
+    glm::vec4  emissionColorStrength = glm::vec4(0.0f);   // emissionColor (xyz) + emissionStrength (w)
+};
+
+// Bottom level: one object-space BVH per unique mesh primitive over
+// triangles[firstTriangle, firstTriangle + triangleCount)
+struct MeshBlas {
+    uint32_t     firstTriangle = 0;
+    uint32_t     triangleCount = 0;
+    uint32_t     rootNode = 0;          // into Scene::blasNodes, set by BuildMeshBvh
+    Aabb         bounds;                // object space, set by BuildMeshBvh
+    MeshMaterial material;              // copied into every TlasInstance of this BLAS
+};
+
+// One placement of a BLAS in the world; moving it only needs BuildTlas
+struct MeshInstance {
+    uint32_t  blas;
+    glm::mat4 transform;                // object to world
+};
+
+// Layout matches the std430 TlasInstance of rayTracingCommon.glsl
+struct TlasInstance {
+    glm::mat4 worldToObject;
+    uint32_t  blasRoot;                 // root node in blasNodes
+    uint32_t  padding[3];
+    glm::vec4 baseColor;                // MeshMaterial of the BLAS, inline so a hit needs no extra lookup
+    glm::vec4 emissionColorStrength;
+};
+
+// Everything the CPU tracer needs to know about the world
+struct Scene {
+    std::vector<Sphere>   spheres;
+    Bvh                   sphereBvh;    // leaves index spheres through sphereBvh.primIndices
+
+    // Next-event estimation over the emissive spheres, set by BuildLights
+    std::vector<Light>        lights;
+    std::vector<int32_t>      sphereLights;      // lights index per sphere, -1 if it does not emit
+    std::vector<LightBvhNode> lightBvh;          // one light per leaf, balanced; root is node 0
+    std::vector<uint32_t>     lightBvhParents;   // CPU-only, for refits
+    std::vector<uint32_t>     lightBvhLeaves;    // CPU-only, leaf node of every light
+
+    std::vector<Triangle>     triangles;     // object space, grouped per BLAS, each group in leaf order once BuildMeshBvh ran
+    std::vector<MeshBlas>     meshBlases;
+    std::vector<BvhNode>      blasNodes;     // every BLAS back to back; child and triangle indices are global
+    std::vector<MeshInstance> meshInstances;
+    Bvh                       tlas;          // over the world bounds of meshInstances
+    std::vector<TlasInstance> tlasInstances; // meshInstances in tlas leaf order, what the tracers read
+
+    // CPU-only 8-wide copies of the BVHs above, filled by BuildWideBvhs. Any rebuild or
+    // refit drops the affected copy, so the CPU tracer falls back to the binary tree.
+    std::vector<Bvh8Node>     sphereBvh8;          // root is node 0
+    std::vector<Bvh8Node>     blasNodes8;
+    std::vector<uint32_t>     tlasInstanceRoots8;  // wide BLAS root per tlasInstances entry
+    std::vector<Bvh8Node>     tlas8;               // root is node 0
+    glm::vec4             meshBaseColor = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
+
+    // Builder used for the BLASes and the sphere BVH; LBVH trades traversal speed for much faster rebuilds
+    BvhBuilder            bvhBuilder = BvhBuilder::Sah;
+    int                   mortonBits = 30;
+};
+
+// Appends the (indexed or non-indexed) triangles of mesh, transformed by transform;
+// triangles with an index past the positions are skipped
+void AppendMeshTriangles(const SimpleMeshData& mesh, const glm::mat4& transform, std::vector<Triangle>& triangles);
+
+// Appends the triangles of mesh as a new BLAS and returns its index. Instance it
+// through scene.meshInstances, then run BuildMeshBvh.
+uint32_t AddMeshBlas(Scene& scene, const SimpleMeshData& mesh, const MeshMaterial& material = MeshMaterial());
+
+// Adds one BLAS per loaded primitive, with its material's base color and emission,
+// and one instance per glTF node, placed by transform * node transform
+void AddGltfMeshes(Scene& scene, const GltfSceneMeshes& gltf, const glm::mat4& transform);
+
+// Builds every BLAS (reordering its triangles into leaf order), packs them into
+// blasNodes and builds the TLAS
+void BuildMeshBvh(Scene& scene, ThreadPool& pool);
+
+// Rebuilds only the top level, enough after instances moved, were added or removed
+void BuildTlas(Scene& scene, ThreadPool& pool);
+
+// Collapses the current sphere, BLAS and TLAS trees into their 8-wide CPU copies
+void BuildWideBvhs(Scene& scene);
+
+Aabb SphereBounds(const Sphere& sphere);
+
+// Full rebuild of sphereBvh, needed whenever spheres are added or removed
+void BuildSphereBvh(Scene& scene, ThreadPool& pool);
+
+// Refits sphereBvh after spheres[index] moved or changed radius
+void RefitSphereBvh(Scene& scene, uint32_t index, std::vector<uint32_t>* touchedNodes = nullptr);
+
+// Emitted power of a sphere up to a constant factor: luminance * strength * area; lights are the spheres where it is > 0
+float SpherePower(const Sphere& sphere);
+
+// Rebuilds lights, their alias table, sphereLights and the light BVH, needed after
+// spheres were added or removed
+void BuildLights(Scene& scene);
+
+// Brings the lights up to date after spheres[index] moved or was recolored: refits the
+// light BVH above its leaf and rebuilds the alias table (linear, the weights of every bin
+// depend on the total). Returns false without changing anything when the edit turned the
+// sphere into a light or back; BuildLights is needed then.
+bool UpdateLight(Scene& scene, uint32_t index, std::vector<uint32_t>* touchedNodes = nullptr);
@@ -0,0 +1,134 @@
+#include "threadPool.h"
+
+// Index of the queue owned by the current thread, -1 for non-worker threads
+static thread_local int t_workerIndex = -1;
+static thread_local const ThreadPool* t_workerPool = nullptr;
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+
+    const unsigned workerCount = threadCount - 1;
+    const unsigned queueCount = workerCount > 0 ? workerCount : 1;
+    for (unsigned i = 0; i < queueCount; ++i)
+        queues.push_back(std::make_unique<WorkQueue>());
+
+    for (unsigned i = 0; i < workerCount; ++i)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleepCv.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::Push(std::function<void()> task)
+{
+    // Workers push onto their own queue; outside threads spread round-robin
+    unsigned index;
+    if (t_workerPool == this && t_workerIndex >= 0) index = (unsigned)t_workerIndex;
+    else index = nextQueue.fetch_add(1, std::memory_order_relaxed) % (unsigned)queues.size();
+
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pendingTasks.fetch_add(1, std::memory_order_release);
+    }
+    sleepCv.notify_one();
+}
+
+bool ThreadPool::TryRunOne()
+{
+    std::function<void()> task;
+    const unsigned count = (unsigned)queues.size();
+    const int own = (t_workerPool == this) ? t_workerIndex : -1;
+
+    // Own queue first (LIFO), then steal from the others (FIFO)
+    if (own >= 0) {
+        WorkQueue& q = *queues[own];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        }
+    }
+    const unsigned start = own >= 0 ? (unsigned)own + 1 : 0;
+    for (unsigned i = 0; !task && i < count; ++i) {
+        WorkQueue& q = *queues[(start + i) % count];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+    }
+    if (!task) return false;
+
+    pendingTasks.fetch_sub(1, std::memory_order_acq_rel);
+    task();
+    return true;
+}
+
+void ThreadPool::WorkerLoop(unsigned index)
+{
+    t_workerIndex = (int)index;
+    t_workerPool = this;
+
+    while (true) {
+        if (TryRunOne()) continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCv.wait(lock, [this] { return stopping || pendingTasks.load(std::memory_order_acquire) > 0; });
+        if (stopping) return;
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+    TaskGroup group(*this);
+    for (size_t i = 0; i < count; ++i)
+        group.Run([&fn, i] { fn(i); });
+    group.Wait();
+}
+
+void TaskGroup::Run(std::function<void()> fn)
+{
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+    pool.Push([this, fn = std::move(fn)] {
+        // An exception must not skip the decrement or unwind into a worker loop
+        try {
+            fn();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) error = std::current_exception();
+        }
+        outstanding.fetch_sub(1, std::memory_order_acq_rel);
+    });
+}
+
+void TaskGroup::Drain()
+{
+    // Help out instead of blocking so nested groups cannot deadlock the pool
+    while (outstanding.load(std::memory_order_acquire) > 0) {
+        if (!pool.TryRunOne()) std::this_thread::yield();
+    }
+}
+
+void TaskGroup::Wait()
+{
+    Drain();
+    std::exception_ptr first;
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        std::swap(first, error);
+    }
+    if (first) std::rethrow_exception(first);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Every worker owns a deque: it pops its own work LIFO (hot in cache) and
+// steals FIFO from the other workers when it runs dry. Threads that wait on a
+// TaskGroup help executing tasks instead of blocking, so groups may be nested.
+class ThreadPool
+{
+    public:
+        // threadCount includes the calling thread; 0 -> hardware_concurrency
+        explicit ThreadPool(unsigned threadCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        unsigned ThreadCount() const { return (unsigned)workers.size() + 1; }
+
+        // Runs fn(i) for i in [0, count) and returns when all calls finished.
+        // Rethrows the first exception a call threw.
+        void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    private:
+        friend class TaskGroup;
+
+        struct WorkQueue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        void Push(std::function<void()> task);
+        bool TryRunOne();
+        void WorkerLoop(unsigned index);
+
+        std::vector<std::thread> workers;
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        std::atomic<unsigned> nextQueue{0};
+        std::atomic<size_t> pendingTasks{0};
+        std::mutex sleepMutex;
+        std::condition_variable sleepCv;
+        bool stopping = false;
+};
+
+// Set of tasks that can be waited on together.
+// A task that throws still counts as finished; Wait() rethrows the first
+// exception once every task is done.
+class TaskGroup
+{
+    public:
+        explicit TaskGroup(ThreadPool& pool) : pool(pool) {}
+        ~TaskGroup() { Drain(); }
+
+        void Run(std::function<void()> fn);
+        void Wait();
+
+    private:
+        void Drain();
+
+        ThreadPool& pool;
+        std::atomic<size_t> outstanding{0};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+};